@@ -0,0 +1,107 @@
+/***********************************************************************
+ *
+ * decbench.c - Measure how fast instructions are decoded
+ *
+ * Fills memory with random valid instruction words, twice as many as
+ * the predecode cache holds, so that walking through them in order
+ * misses it every time, and times fetch_decoded on them.  Then times
+ * iname on the decoded instructions, the way disassembly and traces
+ * name them, and find_instr on the names, the way the assembler and
+ * the tools look them up.  Build with
+ *
+ *     gcc -O2 -o decbench decbench.c libssim.a -lpthread
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+
+#define NWORDS (2 * PREDECODE_SIZE)
+
+static double secs_since(struct timeval *t0)
+{
+    struct timeval t1;
+    gettimeofday(&t1, NULL);
+    return (t1.tv_sec - t0->tv_sec) + (t1.tv_usec - t0->tv_usec) / 1e6;
+}
+
+/* A random word encoding instruction i */
+static uword_t encode(instr_ptr i, unsigned *x)
+{
+    uword_t w;
+
+    if (i->code == I_HALT)
+	return 0;
+    *x = *x * 1103515245 + 12345;
+    w = ((*x >> 8) << 7) | i->code;
+    if (i->code != I_LUI && i->code != I_AUIPC && i->code != I_JAL)
+	w = (w & ~0x7000) | ((uword_t) i->ifun1 << 12);
+    if (i->code == I_R || (i->code == I_OP && (i->ifun1 & 3) == 1))
+	w = (w & 0x01ffffff) | ((uword_t) i->ifun2 << 25);
+    if (i->code == I_AMO)
+	w = (w & 0x07ffffff) | ((uword_t) (i->ifun2 >> 2) << 27);
+    return w;
+}
+
+int main(int argc, char *argv[])
+{
+    int reps = argc > 1 ? atoi(argv[1]) : 100;
+    sim_t s = sim_create();
+    mem_t m = sim_get_mem(s);
+    char **names = (char **) malloc(NWORDS * sizeof(char *));
+    struct timeval t0;
+    unsigned x = 12345;
+    long long n = (long long) reps * NWORDS, found = 0;
+    double secs;
+    uword_t w;
+    int i, j;
+
+    /* Instructions are fetched in the byte order of .yo files */
+    for (i = 0; i < NWORDS; i++) {
+	x = x * 1103515245 + 12345;
+	w = encode(&instruction_set[(x >> 16) % NUM_INSTR], &x);
+	for (j = 0; j < 4; j++)
+	    set_byte_val(m, 4 * i + j, w >> (24 - 8 * j));
+    }
+
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < reps; i++)
+	for (j = 0; j < NWORDS; j++)
+	    found += fetch_decoded(s, 4 * j)->handler != H_BAD;
+    secs = secs_since(&t0);
+    if (found != n) {
+	fprintf(stderr, "%lld of %lld instructions didn't decode\n",
+		n - found, n);
+	exit(1);
+    }
+    printf("fetch_decoded: %.1f M instructions/s\n", n / secs / 1e6);
+
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < reps; i++)
+	for (j = 0; j < NWORDS; j++) {
+	    decode_ptr d = fetch_decoded(s, 4 * j);
+	    names[j] = iname(d->icode, d->ifun1, d->ifun2);
+	}
+    secs = secs_since(&t0);
+    printf("fetch_decoded and iname: %.1f M instructions/s\n",
+	   n / secs / 1e6);
+
+    found = 0;
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < reps; i++)
+	for (j = 0; j < NWORDS; j++)
+	    found += find_instr(names[j]) != NULL;
+    secs = secs_since(&t0);
+    if (found != n) {
+	fprintf(stderr, "%lld of %lld names weren't found\n", n - found, n);
+	exit(1);
+    }
+    printf("find_instr: %.1f M names/s\n", n / secs / 1e6);
+    free(names);
+    sim_destroy(s);
+    return 0;
+}
@@ -1,115 +1,223 @@
 char simname[] = "Risc-v Processor: seq";
 #include <stdio.h>
 #include "isa.h"
+#include "libssim.h"
 #include "sim.h"
-int sim_main(int argc, char *argv[]);
 word_t gen_pc(){return 0;}
-int main(int argc, char *argv[])
-  {return sim_main(argc,argv);}
 
 /////////////////////////////
-//PART B: you need add (icode)==(...) in right place.
-//PART C: you need add (icode)==(...) in right place.Be careful, in some places you will change more than that.
+//Control signals of each icode, one bit each, so that every decision
+//below is a single load from icode_ctl.
+//PART B: you need add the signals of the icode in the right place.
+//PART C: you need add the signals of the icode in the right place.Be careful, in some places you will change more than that.
+
+#define C_VALID     0x000001	//instr_valid
+#define C_IFUN1     0x000002	//has ifun1
+#define C_IFUN2     0x000004	//has ifun2
+#define C_SHIFT     0x000008	//has ifun2 if it is a shift (ifun1 1 or 5)
+#define C_RS1       0x000010	//has rs1
+#define C_RS2       0x000020	//has rs2
+#define C_RD        0x000040	//has rd
+#define C_VALC      0x000080	//has imm
+#define C_SRCA      0x000100	//reads rs1
+#define C_SRCB      0x000200	//reads rs2
+#define C_DSTE      0x000400	//writes the ALU result to rd
+#define C_DSTM      0x000800	//writes the value from memory to rd
+#define C_ALUA_VALA 0x001000	//aluA is vala
+#define C_ALUA_PC   0x002000	//aluA is the pc
+#define C_ALUB_VALB 0x004000	//aluB is valb
+#define C_ALUB_VALC 0x008000	//aluB is valc
+#define C_MEM_READ  0x010000	//reads memory
+#define C_MEM_WRITE 0x020000	//writes valb to memory
+#define C_MEM_ADDR  0x040000	//vale is a memory address
+#define C_BRANCH    0x080000	//goes to pc+valc if cond
+#define C_JUMP      0x100000	//goes to vale
+
+static const unsigned int icode_ctl[128] = {
+    [I_HALT]  = C_VALID,
+    [I_LUI]   = C_VALID | C_RD | C_VALC | C_DSTE | C_ALUB_VALC,
+    [I_AUIPC] = C_VALID | C_RD | C_VALC | C_DSTE | C_ALUA_PC | C_ALUB_VALC,
+    [I_JAL]   = C_VALID | C_RD | C_VALC | C_DSTE | C_ALUB_VALC | C_JUMP,
+    [I_JALR]  = C_VALID | C_IFUN1 | C_RS1 | C_RD | C_VALC | C_SRCA | C_DSTE |
+		C_ALUA_VALA | C_ALUB_VALC | C_JUMP,
+    [I_B]     = C_VALID | C_IFUN1 | C_RS1 | C_RS2 | C_VALC | C_SRCA | C_SRCB |
+		C_ALUA_VALA | C_ALUB_VALB | C_BRANCH,
+    [I_S]     = C_VALID | C_IFUN1 | C_RS1 | C_RS2 | C_VALC | C_SRCA | C_SRCB |
+		C_ALUA_VALA | C_ALUB_VALC | C_MEM_WRITE | C_MEM_ADDR,
+    [I_R]     = C_VALID | C_IFUN1 | C_IFUN2 | C_RS1 | C_RS2 | C_RD | C_SRCA |
+		C_SRCB | C_DSTE | C_ALUA_VALA | C_ALUB_VALB,
+    [I_CSR]   = C_VALID | C_IFUN1 | C_RS1 | C_RD,
+    [I_OP]    = C_VALID | C_IFUN1 | C_SHIFT | C_RS1 | C_RD | C_VALC | C_SRCA |
+		C_DSTE | C_ALUA_VALA | C_ALUB_VALC,
+    [I_L]     = C_VALID | C_IFUN1 | C_RS1 | C_RD | C_VALC | C_SRCA | C_DSTE |
+		C_DSTM | C_ALUA_VALA | C_ALUB_VALC | C_MEM_READ | C_MEM_ADDR,
+    [I_AMO]   = C_VALID | C_IFUN1 | C_IFUN2 | C_RS1 | C_RS2 | C_RD | C_SRCA |
+		C_SRCB | C_DSTM | C_ALUA_VALA | C_MEM_ADDR,
+    [I_FENCE] = C_VALID | C_IFUN1,
+};
+
+#define CTL(s) (icode_ctl[(s)->icode & 0x7f])
 
 //if the instruction has ifun1
-long long gen_need_ifun1()
+long long gen_need_ifun1(sim_t s)
 {
-    return ((icode)==(I_JALR) || (icode)==(I_B) || (icode)==(I_S) || (icode)==(I_R) || (icode)==(I_CSR) || (icode) == (I_OP) || (icode)==(I_L));
+    return (CTL(s) & C_IFUN1) != 0;
 }
 //if the instruction has ifun2
-long long gen_need_ifun2()
+long long gen_need_ifun2(sim_t s)
 {
-    return ((icode)==(I_R) || ((icode) == (I_OP) && ((ifun1 == 5)||(ifun1 == 1))));
+    return (CTL(s) & C_IFUN2) || ((CTL(s) & C_SHIFT) && (s->ifun1 & 3) == 1);
 }
 //if the instruction is valid
-long long gen_instr_valid()
+long long gen_instr_valid(sim_t s)
 {
-    return ((icode)==(I_HALT) || (icode)==(I_LUI) || (icode)==(I_AUIPC) || (icode)==(I_JAL) ||
-		 (icode)==(I_JALR) || (icode)==(I_B) || (icode)==(I_S) ||
-		(icode)==(I_R) || (icode)==(I_CSR) || (icode)==(I_OP) || (icode)==(I_L));
+    return (CTL(s) & C_VALID) != 0;
 }
 //if the instruction has rs1
-long long gen_need_rs1()
+long long gen_need_rs1(sim_t s)
 {
-    return ((icode)==(I_JALR) || (icode)==(I_B) || (icode)==(I_S) ||
-		(icode)==(I_R) || (icode)==(I_CSR) || (icode)==(I_OP) || (icode)==(I_L));
+    return (CTL(s) & C_RS1) != 0;
 }
 //if the instruction has rs2
-long long gen_need_rs2()
+long long gen_need_rs2(sim_t s)
 {
-    return ((icode)==(I_B) || (icode)==(I_S) || (icode)==(I_R));
+    return (CTL(s) & C_RS2) != 0;
 }
 //if the instruction has imm
-long long gen_need_valC()
+long long gen_need_valC(sim_t s)
 {
-    return ((icode)==(I_LUI) || (icode)==(I_AUIPC) || (icode)==(I_JAL) ||
-		 (icode)==(I_JALR) || (icode)==(I_B) || (icode)==(I_S) || (icode)==(I_OP) || (icode)==(I_L));
+    return (CTL(s) & C_VALC) != 0;
 }
 //if the instruction has rd
-long long gen_need_rd()
+long long gen_need_rd(sim_t s)
 {
-    return ((icode)==(I_LUI) || (icode)==(I_AUIPC) || (icode)==(I_JAL) ||
-		 (icode)==(I_JALR) || (icode)==(I_R) || (icode)==(I_CSR) || (icode)==(I_OP) || (icode)==(I_L));
+    return (CTL(s) & C_RD) != 0;
 }
 //get the value of rs1 if the instruction has rs1
-long long gen_srcA()
+long long gen_srcA(sim_t s)
 {
-    return (((icode)==(I_JALR) || (icode)==(I_B) || (icode)==(I_S) || (icode)==(I_L) || (icode)==(I_OP) || (icode)==(I_R)) ? (rs1) : (REG_NONE));
+    return (CTL(s) & C_SRCA) ? (s->rs1) : (REG_NONE);
 }
 //get the value of rs2 if the instruction has rs2
-long long gen_srcB()
+long long gen_srcB(sim_t s)
 {
-    return (((icode)==(I_B) || (icode)==(I_S) || (icode)==(I_R)) ? (rs2) : (REG_NONE));
+    return (CTL(s) & C_SRCB) ? (s->rs2) : (REG_NONE);
 }
 //write the value calculated by ALU to rd
-long long gen_dstE()
+long long gen_dstE(sim_t s)
 {
-    return (((icode)==(I_LUI) || (icode)==(I_AUIPC) || (icode)==(I_JAL) || (icode)==(I_OP) || (icode)==(I_L) || (icode)==(I_JALR) || (icode)==(I_R)) ? (rd) : (REG_NONE));
+    return (CTL(s) & C_DSTE) ? (s->rd) : (REG_NONE);
 }
 //write the value in memory to rd
-long long gen_dstM()
+long long gen_dstM(sim_t s)
 {
-    return ( icode == I_L ? rd : REG_NONE);
+    return (CTL(s) & C_DSTM) ? (s->rd) : (REG_NONE);
 }
 //in alu, there are two operands,one is in aluA, another is in aluB
-long long gen_aluA()
+long long gen_aluA(sim_t s)
 {
-    return (((icode)==(I_JALR) || (icode)==(I_B) || (icode)==(I_S) || (icode)==(I_OP) || (icode)==(I_L) || (icode)==(I_R)) ? (vala) : (((icode)==(I_AUIPC)) ? (pc) : 0));
+    return (CTL(s) & C_ALUA_VALA) ? (s->vala) :
+	(CTL(s) & C_ALUA_PC) ? (s->pc) : 0;
 }
 
-long long gen_aluB()
+long long gen_aluB(sim_t s)
 {
-    return (((icode)==(I_B) || (icode)==(I_R)) ? (valb) : (((icode)==(I_LUI) || (icode)==(I_AUIPC) || (icode)==(I_L) || (icode)==(I_OP) || (icode)==(I_JAL) || (icode)==(I_JALR) || (icode)==(I_S)) ? (valc) : 0));
+    return (CTL(s) & C_ALUB_VALB) ? (s->valb) :
+	(CTL(s) & C_ALUB_VALC) ? (s->valc) : 0;
 }
 //if the instruction needs to read data from memory
-long long gen_mem_read()
+long long gen_mem_read(sim_t s)
 {
-    return (icode)==(I_L);
+    return (CTL(s) & C_MEM_READ) != 0;
 }
 //if the instruction needs to write data from memory
-long long gen_mem_write()
+long long gen_mem_write(sim_t s)
 {
-    return ((icode) == (I_S));
+    return (CTL(s) & C_MEM_WRITE) != 0;
 }
-//the address of the memory
-long long gen_mem_addr()
+//the address of the memory, atomics doing their own access with it
+long long gen_mem_addr(sim_t s)
 {
-    return (((icode)==(I_L) || ((icode)==(I_S))) ? (vale) : 0);
+    return (CTL(s) & C_MEM_ADDR) ? (s->vale) : 0;
 }
 //the data which will be written into memory
-long long gen_mem_data()
+long long gen_mem_data(sim_t s)
 {
-    return (((icode)==(I_S)) ? (valb) : 0);
+    return (CTL(s) & C_MEM_WRITE) ? (s->valb) : 0;
 }
 //get the Stat(like the Y86)
-long long gen_Stat()
+long long gen_Stat(sim_t s)
 {
-    return (((imem_error) | (dmem_error)) ? (STAT_ADR) : !(instr_valid) ?
-      (STAT_INS) : ((icode) == (I_HALT)) ? (STAT_HLT) : (STAT_AOK));
+    return (((s->imem_error) | (s->dmem_error)) ? (STAT_ADR) : !(s->instr_valid) ?
+      (STAT_INS) : ((s->icode) == (I_HALT)) ? (STAT_HLT) : (STAT_AOK));
 }
 //the new pc
-long long gen_new_pc()
+long long gen_new_pc(sim_t s)
+{
+    return ((CTL(s) & C_BRANCH) && (s->cond)) ? (s->valc+s->pc) :
+	(CTL(s) & C_JUMP) ? (s->vale) : (s->valp);
+}
+
+//////////////////////////////////////
+//PIPE: control logic of the five-stage pipeline (ssim-pipe.c).
+//writeback writes the register file before decode reads it, so values
+//are only forwarded from execute and memory.
+
+//where fetch goes next: where the branch predictors say if there are
+//any, otherwise the target of jal or the next word
+long long gen_f_predPC(sim_t s)
+{
+    return ((s->bpred) ? (s->pipe->f_bpredPC) :
+	((s->pipe->f.icode)==(I_JAL)) ? (s->pipe->f.valc) : (s->pipe->f_pc+4));
+}
+//the value of srcA, forwarded from the newest instruction writing it
+long long gen_d_valA(sim_t s)
+{
+    return (((s->pipe->d_srcA)==(REG_NONE) || (s->pipe->d_srcA)==(REG_X0)) ? 0 :
+	((s->pipe->d_srcA)==(s->pipe->e_dstE)) ? (s->pipe->e_valE) :
+	((s->pipe->d_srcA)==(s->pipe->M.dstM)) ? (s->pipe->m_valM) :
+	((s->pipe->d_srcA)==(s->pipe->M.dstE)) ? (s->pipe->M.vale) :
+	get_reg_val(s->reg, s->pipe->d_srcA));
+}
+//the value of srcB, forwarded the same way
+long long gen_d_valB(sim_t s)
+{
+    return (((s->pipe->d_srcB)==(REG_NONE) || (s->pipe->d_srcB)==(REG_X0)) ? 0 :
+	((s->pipe->d_srcB)==(s->pipe->e_dstE)) ? (s->pipe->e_valE) :
+	((s->pipe->d_srcB)==(s->pipe->M.dstM)) ? (s->pipe->m_valM) :
+	((s->pipe->d_srcB)==(s->pipe->M.dstE)) ? (s->pipe->M.vale) :
+	get_reg_val(s->reg, s->pipe->d_srcB));
+}
+//the instruction in decode is left to sim_step: halt, invalid, not
+//fetched, an atomic or fence, or the last of the run
+long long gen_d_handoff(sim_t s)
+{
+    return ((s->pipe->D.stat) != (STAT_BUB) &&
+	((s->pipe->D.stat) != (STAT_AOK) || (s->pipe->D.d.handler) <= (H_FENCE) ||
+	 (s->pipe->issued) >= (s->pipe->last)));
+}
+//a load in execute writes a register the instruction in decode reads
+long long gen_load_use(sim_t s)
+{
+    return ((s->pipe->E.dstM) != (REG_NONE) && (s->pipe->E.dstM) != (REG_X0) &&
+	((s->pipe->E.dstM)==(s->pipe->d_srcA) || (s->pipe->E.dstM)==(s->pipe->d_srcB)));
+}
+//the instruction in execute doesn't go where fetch went after it
+long long gen_e_mispredict(sim_t s)
+{
+    return ((s->pipe->e_target) != (s->pipe->E.predpc));
+}
+long long gen_D_stall(sim_t s)
+{
+    return (gen_load_use(s) && !gen_e_mispredict(s));
+}
+long long gen_D_bubble(sim_t s)
+{
+    return (gen_e_mispredict(s) ||
+	(!gen_load_use(s) && (gen_d_handoff(s) || (s->pipe->stopped))));
+}
+long long gen_E_bubble(sim_t s)
 {
-    return (((icode)==(I_B) && (cond)) ? (valc+pc) : (((icode)==(I_JAL) || (icode)==(I_JALR)) ? (vale) : (valp)));
+    return (gen_e_mispredict(s) || gen_load_use(s));
 }
 //////////////////////////////////////
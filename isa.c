@@ -2,6 +2,11 @@
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "isa.h"
 
 
@@ -80,7 +85,7 @@ int reg_valid(reg_id_t id)
 
 
 
-instr_t instruction_set[] =
+instr_t instruction_set[NUM_INSTR+1] =
 {  //{name, icode, bytes, ifun1,ifun2}
    //if the instruction do not have ifun1/ifun2, write 0 in that position.
     {"lui", 0x37, 4, 0, 0 },
@@ -128,8 +133,26 @@ instr_t instruction_set[] =
     {"or", 0x33, 4, 6, 0 },
     {"and", 0x33, 4, 7, 0 },
 
-    {"halt", 0x0, 4, 0, 0 }
+    {"halt", 0x0, 4, 0, 0 },
 
+////////////////////////////
+    //A extension, with ifun2 the top five bits shifted up past aq
+    //and rl, which are dropped
+    {"lr.w", 0x2f, 4, 2, 0x08 },
+    {"sc.w", 0x2f, 4, 2, 0x0c },
+    {"amoswap.w", 0x2f, 4, 2, 0x04 },
+    {"amoadd.w", 0x2f, 4, 2, 0x00 },
+    {"amoxor.w", 0x2f, 4, 2, 0x10 },
+    {"amoand.w", 0x2f, 4, 2, 0x30 },
+    {"amoor.w", 0x2f, 4, 2, 0x20 },
+    {"amomin.w", 0x2f, 4, 2, 0x40 },
+    {"amomax.w", 0x2f, 4, 2, 0x50 },
+    {"amominu.w", 0x2f, 4, 2, 0x60 },
+    {"amomaxu.w", 0x2f, 4, 2, 0x70 },
+    {"fence", 0x0f, 4, 0, 0 },
+    {"fence.i", 0x0f, 4, 1, 0 },
+
+    {NULL, 0, 0, 0, 0 }
 };
 
 
@@ -138,23 +161,75 @@ instr_t instruction_set[] =
 instr_t invalid_instr =
     {"XXX", 0, 0, 0, 0 };
 
+/*
+ * Tables built from instruction_set[] before main runs, so that
+ * decoding and disassembly take one load and find_instr hashes
+ * rather than scanning.  instr_map is indexed by the slot of the
+ * icode in icode_slot, ifun1, and ifun2 without the two low bits,
+ * which no entry uses, and holds the index in instruction_set, or
+ * NUM_INSTR if there is none.  name_hash holds one more than the
+ * index of each name, by open addressing.
+ */
+#define ICODE_SLOTS 16
+#define NAME_HASH   128
+static byte_t icode_slot[128];
+static byte_t instr_map[ICODE_SLOTS][8][32];
+static byte_t name_hash[NAME_HASH];
+
+static unsigned hash_name(char *name)
+{
+    unsigned h = 2166136261u;
+    while (*name)
+	h = (h ^ (byte_t) *name++) * 16777619u;
+    return h;
+}
+
+__attribute__((constructor))
+static void build_instr_tables(void)
+{
+    int i, slots = 1;
+    unsigned h;
+    instr_ptr p;
+
+    memset(instr_map, NUM_INSTR, sizeof(instr_map));
+    for (i = NUM_INSTR - 1; i >= 0; i--) {
+	p = &instruction_set[i];
+	if (!icode_slot[p->code])
+	    icode_slot[p->code] = slots++;
+	/* The first of any duplicates wins, as it did for the scan */
+	instr_map[icode_slot[p->code]][p->ifun1][p->ifun2 >> 2] = i;
+    }
+    for (i = 0; i < NUM_INSTR; i++) {
+	for (h = hash_name(instruction_set[i].name);
+	     name_hash[h % NAME_HASH]; h++)
+	    ;
+	name_hash[h % NAME_HASH] = i + 1;
+    }
+}
+
 instr_ptr find_instr(char *name)
 {
+    unsigned h;
     int i;
-    for (i = 0; instruction_set[i].name; i++)
-	if (strcmp(instruction_set[i].name,name) == 0)
-	    return &instruction_set[i];
+    for (h = hash_name(name); (i = name_hash[h % NAME_HASH]); h++)
+	if (strcmp(instruction_set[i-1].name, name) == 0)
+	    return &instruction_set[i-1];
     return NULL;
 }
 
+/* Return index in instruction_set of an encoding, NUM_INSTR if none */
+int instr_index(int icode, int ifun1, int ifun2)
+{
+    if ((unsigned) icode >= 128 || (unsigned) ifun1 >= 8 ||
+	(ifun2 & ~0x7c))
+	return NUM_INSTR;
+    return instr_map[icode_slot[icode]][ifun1][ifun2 >> 2];
+}
+
 /* Return name of instruction given its encoding */
 char *iname(int icode,int ifun1,int ifun2) {
-    int i;
-    for (i = 0; instruction_set[i].name; i++) {
-	if (icode == instruction_set[i].code && ifun1 == instruction_set[i].ifun1 && ifun2 == instruction_set[i].ifun2)
-	    return instruction_set[i].name;
-    }
-    return "<bad>";
+    int i = instr_index(icode, ifun1, ifun2);
+    return i < NUM_INSTR ? instruction_set[i].name : "<bad>";
 }
 
 
@@ -164,54 +239,488 @@ instr_ptr bad_instr()
 }
 
 
-mem_t init_mem(int len)
+mem_t init_mem(long long len)
 {
 
     mem_t result = (mem_t) malloc(sizeof(mem_rec));
+    if (len <= 0)
+	len = BPL;
     len = ((len+BPL-1)/BPL)*BPL;
-    result->len = len;
-    result->contents = (byte_t *) calloc(len, 1);
+    result->last = (uword_t) (len - 1);
+    result->maxaddr = 0;
+    result->npages = (int) ((len + PAGE_SIZE - 1) >> PAGE_BITS);
+    result->resident = 0;
+    result->pages = (byte_t **) calloc(result->npages, sizeof(byte_t *));
+    result->wpages = (byte_t **) calloc(result->npages, sizeof(byte_t *));
+    result->le_code = FALSE;
+    result->maps = NULL;
+    result->ck = NULL;
+    result->lock = 0;
     return result;
 }
 
+/* Pages of a file mapped into a memory by load_image */
+struct mem_map_rec {
+    byte_t *addr;
+    size_t len;
+    struct mem_map_rec *next;
+};
+
+/* Is page p part of a file mapping? */
+static bool_t page_mapped(mem_t m, byte_t *p)
+{
+    struct mem_map_rec *mp;
+    for (mp = m->maps; mp; mp = mp->next)
+	if (p >= mp->addr && p < mp->addr + mp->len)
+	    return TRUE;
+    return FALSE;
+}
+
+/* Drop all file mappings, leaving the pages they held unallocated */
+static void unmap_pages(mem_t m)
+{
+    struct mem_map_rec *mp, *next;
+    int i;
+    if (!m->maps)
+	return;
+    for (i = 0; i < m->npages; i++)
+	if (m->pages[i] && page_mapped(m, m->pages[i])) {
+	    m->pages[i] = m->wpages[i] = NULL;
+	    m->resident--;
+	}
+    for (mp = m->maps; mp; mp = next) {
+	next = mp->next;
+	munmap(mp->addr, mp->len);
+	free((void *) mp);
+    }
+    m->maps = NULL;
+}
+
+/* Free page p of m, unless it belongs to a file mapping */
+static void free_page(mem_t m, byte_t *p)
+{
+    if (p && !page_mapped(m, p))
+	free((void *) p);
+}
+
+/* Allocated pages stay allocated, mapped ones are dropped */
 void clear_mem(mem_t m)
 {
-    memset(m->contents, 0, m->len);
+    int i;
+    mem_drop_checkpoints(m);
+    unmap_pages(m);
+    for (i = 0; i < m->npages; i++)
+	if (m->pages[i])
+	    memset(m->pages[i], 0, PAGE_SIZE);
+    m->le_code = FALSE;
 }
 
 void free_mem(mem_t m)
 {
-    free((void *) m->contents);
+    int i;
+    mem_drop_checkpoints(m);
+    unmap_pages(m);
+    for (i = 0; i < m->npages; i++)
+	free((void *) m->pages[i]);
+    free((void *) m->pages);
+    free((void *) m->wpages);
     free((void *) m);
 }
 
-mem_t copy_mem(mem_t oldm)
+/*
+ * A page changed between checkpoints.  Pages written since the last
+ * checkpoint belong to the memory, the others to the checkpoint that
+ * first held them.
+ */
+typedef struct {
+    int page;
+    byte_t *cur;	/* Contents at this checkpoint */
+    byte_t *old;	/* Contents at the one before, NULL if unallocated */
+} ckpt_page;
+
+/* Pages changed since the checkpoint before */
+typedef struct {
+    ckpt_page *pages;
+    int cnt;
+} ckpt_rec;
+
+struct mem_ckpt_rec {
+    ckpt_rec *ckpts;	/* In the order taken */
+    int cnt, max;
+    int base;		/* Checkpoint the contents are based on */
+    ckpt_page *dirty;	/* Written since then, cur not filled in */
+    int ndirty, maxdirty;
+};
+
+/* Note that page i, holding old, is being replaced since the checkpoint */
+static void add_dirty(struct mem_ckpt_rec *ck, int i, byte_t *old)
 {
-    mem_t newm = init_mem(oldm->len);
-    memcpy(newm->contents, oldm->contents, oldm->len);
-    return newm;
+    if (ck->ndirty == ck->maxdirty) {
+	ck->maxdirty = ck->maxdirty ? 2*ck->maxdirty : 64;
+	ck->dirty = (ckpt_page *)
+	    realloc(ck->dirty, ck->maxdirty * sizeof(ckpt_page));
+    }
+    ck->dirty[ck->ndirty].page = i;
+    ck->dirty[ck->ndirty].cur = NULL;
+    ck->dirty[ck->ndirty].old = old;
+    ck->ndirty++;
 }
 
-bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile)
+/*
+ * Pages that belong to a checkpoint are read-only: wpages is NULL for
+ * them, and the first write copies the page.
+ */
+byte_t *mem_page(mem_t m, uword_t a)
+{
+    int i = a >> PAGE_BITS;
+    byte_t *p = m->wpages[i];
+    if (p)
+	return p;
+    /* Another hart may be allocating the same page */
+    while (__atomic_exchange_n(&m->lock, 1, __ATOMIC_ACQUIRE))
+	;
+    p = m->wpages[i];
+    if (!p) {
+	p = (byte_t *) malloc(PAGE_SIZE);
+	if (m->pages[i]) {
+	    memcpy(p, m->pages[i], PAGE_SIZE);
+	} else {
+	    memset(p, 0, PAGE_SIZE);
+	    m->resident++;
+	}
+	if (m->ck)
+	    add_dirty(m->ck, i, m->pages[i]);
+	/* Readers on other threads don't lock, so publish p filled in */
+	__atomic_store_n(&m->pages[i], p, __ATOMIC_RELEASE);
+	__atomic_store_n(&m->wpages[i], p, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&m->lock, 0, __ATOMIC_RELEASE);
+    return p;
+}
+
+/* Put p in slot i of the page table, read-only */
+static void set_page(mem_t m, int i, byte_t *p)
+{
+    if (!m->pages[i] && p)
+	m->resident++;
+    else if (m->pages[i] && !p)
+	m->resident--;
+    m->pages[i] = p;
+    m->wpages[i] = NULL;
+}
+
+/* Free the pages of checkpoints after k, none of which are in use */
+static void drop_after(mem_t m, int k)
+{
+    struct mem_ckpt_rec *ck = m->ck;
+    int j;
+    while (ck->cnt > k + 1) {
+	ckpt_rec *c = &ck->ckpts[--ck->cnt];
+	for (j = 0; j < c->cnt; j++)
+	    free_page(m, c->pages[j].cur);
+	free((void *) c->pages);
+    }
+}
+
+int mem_checkpoint(mem_t m)
+{
+    struct mem_ckpt_rec *ck = m->ck;
+    ckpt_rec *c;
+    int i;
+
+    if (!ck) {
+	ck = m->ck = (struct mem_ckpt_rec *) calloc(1, sizeof(*ck));
+	ck->base = -1;
+	/* Everything so far goes into the first checkpoint */
+	for (i = 0; i < m->npages; i++)
+	    if (m->pages[i])
+		add_dirty(ck, i, NULL);
+    }
+    /* Any after the one last restored are replaced by this one */
+    drop_after(m, ck->base);
+    if (ck->cnt == ck->max) {
+	ck->max = ck->max ? 2*ck->max : 16;
+	ck->ckpts = (ckpt_rec *) realloc(ck->ckpts, ck->max * sizeof(ckpt_rec));
+    }
+    c = &ck->ckpts[ck->cnt++];
+    c->pages = ck->dirty;
+    c->cnt = ck->ndirty;
+    for (i = 0; i < c->cnt; i++) {
+	c->pages[i].cur = m->pages[c->pages[i].page];
+	m->wpages[c->pages[i].page] = NULL;
+    }
+    ck->dirty = NULL;
+    ck->ndirty = ck->maxdirty = 0;
+    return ck->base = ck->cnt - 1;
+}
+
+bool_t mem_restore(mem_t m, int k)
+{
+    struct mem_ckpt_rec *ck = m->ck;
+    int i, j;
+    if (!ck || k < 0 || k >= ck->cnt)
+	return FALSE;
+    /* Throw away what was written since the last checkpoint */
+    for (i = 0; i < ck->ndirty; i++) {
+	free_page(m, m->pages[ck->dirty[i].page]);
+	set_page(m, ck->dirty[i].page, ck->dirty[i].old);
+    }
+    ck->ndirty = 0;
+    /* Then step from that checkpoint to k */
+    for (j = ck->base; j > k; j--)
+	for (i = 0; i < ck->ckpts[j].cnt; i++)
+	    set_page(m, ck->ckpts[j].pages[i].page, ck->ckpts[j].pages[i].old);
+    for (j = ck->base + 1; j <= k; j++)
+	for (i = 0; i < ck->ckpts[j].cnt; i++)
+	    set_page(m, ck->ckpts[j].pages[i].page, ck->ckpts[j].pages[i].cur);
+    ck->base = k;
+    return TRUE;
+}
+
+void mem_drop_checkpoints(mem_t m)
 {
-    word_t pos;
-    int len = oldm->len;
+    struct mem_ckpt_rec *ck = m->ck;
+    int i, j;
+    if (!ck)
+	return;
+    /* The pages in use go back to the memory, the rest are freed */
+    for (j = 0; j < ck->cnt; j++) {
+	ckpt_rec *c = &ck->ckpts[j];
+	for (i = 0; i < c->cnt; i++)
+	    if (m->pages[c->pages[i].page] != c->pages[i].cur)
+		free_page(m, c->pages[i].cur);
+	free((void *) c->pages);
+    }
+    for (i = 0; i < m->npages; i++)
+	m->wpages[i] = m->pages[i];
+    free((void *) ck->ckpts);
+    free((void *) ck->dirty);
+    free((void *) ck);
+    m->ck = NULL;
+}
+
+/* Little-endian word at offset off of page p, which reads as zeros if NULL */
+static word_t page_word(byte_t *p, int off)
+{
+    return p ? p[off] | p[off+1] << 8 | p[off+2] << 16 |
+	(word_t) ((uword_t) p[off+3] << 24) : 0;
+}
+
+/*
+ * Print the words that differ between old and new contents op and np
+ * of the page holding addresses pos to end, either of which may be
+ * NULL for zeros.  Return TRUE if there are any.  Stops at the first
+ * if outfile is NULL.
+ */
+static bool_t diff_page(byte_t *op, byte_t *np, uword_t pos, uword_t end,
+			FILE *outfile)
+{
+    static byte_t zeros[PAGE_SIZE];
     bool_t diff = FALSE;
-    if (newm->len < len)
-	len = newm->len;
-    for (pos = 0; (!diff || outfile) && pos < len; pos += 4) {
-        word_t ov = 0;  word_t nv = 0;
-	get_halfword_val(oldm, pos, &ov);
-	get_halfword_val(newm, pos, &nv);
+    uword_t base = pos & ~(uword_t) PAGE_MASK;
+    int off, last = end & PAGE_MASK;
+    /* Most pages are the same, which memcmp finds out fastest */
+    if (op == np || !memcmp(op ? op : zeros, np ? np : zeros, PAGE_SIZE))
+	return FALSE;
+    /* Go by the offset in the page, as pos + 4 wraps on the last one */
+    for (off = pos & PAGE_MASK; (!diff || outfile) && off + 3 <= last;
+	 off += 4) {
+	word_t ov = page_word(op, off);
+	word_t nv = page_word(np, off);
 	if (nv != ov) {
 	    diff = TRUE;
 	    if (outfile)
-		fprintf(outfile, "0x%.4x:\t0x%.8x\t0x%.8x\n", pos, ov, nv);
+		fprintf(outfile, "0x%.4x:\t0x%.8x\t0x%.8x\n",
+			base + off, ov, nv);
+	}
+    }
+    return diff;
+}
+
+/* A page that may have changed since a checkpoint */
+typedef struct {
+    int page;
+    int seq;		/* Order noted in */
+    byte_t *old;	/* Contents before the change */
+} changed_page;
+
+/* Order by page, then by when noted */
+static int cmp_changed(const void *a, const void *b)
+{
+    const changed_page *x = (const changed_page *) a;
+    const changed_page *y = (const changed_page *) b;
+    if (x->page != y->page)
+	return x->page < y->page ? -1 : 1;
+    return x->seq - y->seq;
+}
+
+bool_t diff_mem_checkpoint(mem_t m, int k, FILE *outfile)
+{
+    struct mem_ckpt_rec *ck = m->ck;
+    changed_page *changed;
+    bool_t diff = FALSE;
+    int n = 0, i, j, max;
+
+    if (!ck || k < 0 || k > ck->base)
+	return FALSE;
+    /*
+     * Only pages written since the last checkpoint or changed by the
+     * ones after k can differ.  For each, the contents at k are the old
+     * contents noted last, walking back from now.
+     */
+    max = ck->ndirty;
+    for (j = ck->base; j > k; j--)
+	max += ck->ckpts[j].cnt;
+    changed = (changed_page *) malloc((max + 1) * sizeof(changed_page));
+    for (i = 0; i < ck->ndirty; i++, n++) {
+	changed[n].page = ck->dirty[i].page;
+	changed[n].seq = n;
+	changed[n].old = ck->dirty[i].old;
+    }
+    for (j = ck->base; j > k; j--)
+	for (i = 0; i < ck->ckpts[j].cnt; i++, n++) {
+	    changed[n].page = ck->ckpts[j].pages[i].page;
+	    changed[n].seq = n;
+	    changed[n].old = ck->ckpts[j].pages[i].old;
 	}
+    qsort(changed, n, sizeof(changed_page), cmp_changed);
+
+    for (i = 0; (!diff || outfile) && i < n; i++) {
+	uword_t pos, end;
+	if (i + 1 < n && changed[i+1].page == changed[i].page)
+	    continue;
+	pos = (uword_t) changed[i].page << PAGE_BITS;
+	end = pos + PAGE_SIZE - 1;
+	if (end > m->last)
+	    end = m->last;
+	if (diff_page(changed[i].old, m->pages[changed[i].page], pos, end,
+		      outfile))
+	    diff = TRUE;
+    }
+    free((void *) changed);
+    return diff;
+}
+
+mem_t copy_mem(mem_t oldm)
+{
+    mem_t newm = init_mem((long long) oldm->last + 1);
+    int i;
+    for (i = 0; i < oldm->npages; i++)
+	if (oldm->pages[i])
+	    memcpy(mem_page(newm, (uword_t) i << PAGE_BITS),
+		   oldm->pages[i], PAGE_SIZE);
+    newm->le_code = oldm->le_code;
+    return newm;
+}
+
+bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile)
+{
+    uword_t pos, end;
+    uword_t last = oldm->last;
+    bool_t diff = FALSE;
+    int i;
+    if (newm->last < last)
+	last = newm->last;
+    for (i = 0; (!diff || outfile) && i <= (int) (last >> PAGE_BITS); i++) {
+	pos = (uword_t) i << PAGE_BITS;
+	end = pos + PAGE_SIZE - 1;
+	if (end > last)
+	    end = last;
+	if (diff_page(oldm->pages[i], newm->pages[i], pos, end, outfile))
+	    diff = TRUE;
     }
     return diff;
 }
 
+long long parse_mem_size(char *str)
+{
+    char *end;
+    long long len = strtoll(str, &end, 0);
+    switch (*end) {
+    case 'k': case 'K':
+	len <<= 10; end++;
+	break;
+    case 'm': case 'M':
+	len <<= 20; end++;
+	break;
+    case 'g': case 'G':
+	len <<= 30; end++;
+	break;
+    }
+    if (*end || len <= 0 || len > (1LL << 32))
+	return 0;
+    return len;
+}
+
+symtab_t new_symtab()
+{
+    return (symtab_t) calloc(1, sizeof(symtab_rec));
+}
+
+void clear_symtab(symtab_t t)
+{
+    int i;
+    for (i = 0; i < t->n; i++)
+	free(t->labels[i].name);
+    t->n = 0;
+}
+
+void free_symtab(symtab_t t)
+{
+    clear_symtab(t);
+    free(t->labels);
+    free(t);
+}
+
+void add_label(symtab_t t, word_t a, char *name, int len)
+{
+    label_ptr l;
+    if (t->n == t->max) {
+	t->max = t->max ? 2*t->max : 64;
+	t->labels = (label_ptr) realloc(t->labels, t->max * sizeof(label_rec));
+    }
+    l = &t->labels[t->n++];
+    l->addr = a;
+    l->name = (char *) malloc(len + 1);
+    memcpy(l->name, name, len);
+    l->name[len] = '\0';
+    t->sorted = FALSE;
+}
+
+static int cmp_label(const void *a, const void *b)
+{
+    const label_rec *la = (const label_rec *) a;
+    const label_rec *lb = (const label_rec *) b;
+    if (la->addr != lb->addr)
+	return (uword_t) la->addr < (uword_t) lb->addr ? -1 : 1;
+    return strcmp(la->name, lb->name);
+}
+
+char *find_label(symtab_t t, word_t a, word_t *offp)
+{
+    int lo = 0, hi = t->n;
+    if (!t->sorted) {
+	qsort(t->labels, t->n, sizeof(label_rec), cmp_label);
+	t->sorted = TRUE;
+    }
+    /* Find the first label past a */
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+	if ((uword_t) t->labels[mid].addr <= (uword_t) a)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo == 0)
+	return NULL;
+    /* The first of those at the same address as the one before it */
+    a -= t->labels[lo-1].addr;
+    while (lo > 1 && t->labels[lo-2].addr == t->labels[lo-1].addr)
+	lo--;
+    *offp = a;
+    return t->labels[lo-1].name;
+}
+
 int hex2dig(char c)
 {
     if (isdigit((int)c))
@@ -222,133 +731,618 @@ int hex2dig(char c)
 	return c - 'a' + 10;
 }
 
+/* .yo files are read this many bytes at a time, more for longer lines */
+#define LOAD_CHUNK (1<<20)
+/* Slack after the data, so the hex scanner can look 16 bytes ahead */
+#define LOAD_PAD 32
+/* Longest source text passed to the GUI */
 #define LINELEN 4096
-int load_mem(mem_t m, FILE *infile, int report_error)
+
+/* Value of each hex digit plus one, 0 for anything else */
+static const byte_t hex_plus1[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+};
+
+/* Same as isspace in the C locale */
+#define IS_SPACE(c) ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+/* Bit i set if p[i] is a hex digit, for i < 16 */
+static inline unsigned hex_mask16(const char *p)
 {
-    /* Read contents of .yo file */
-    char buf[LINELEN];
-    char c, ch, cl;
-    int byte_cnt = 0;
-    int lineno = 0;
-    word_t bytepos = 0;
+    __m128i c = _mm_loadu_si128((const __m128i *) p);
+    __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i dig = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+				_mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    __m128i let = _mm_and_si128(_mm_cmpgt_epi8(lc, _mm_set1_epi8('a' - 1)),
+				_mm_cmplt_epi8(lc, _mm_set1_epi8('f' + 1)));
+    return _mm_movemask_epi8(_mm_or_si128(dig, let));
+}
+
+/* Convert the hex digits in c to pairs packed in the low half */
+static inline __m128i hex_pack(__m128i c)
+{
+    __m128i lc = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i letter = _mm_cmpgt_epi8(lc, _mm_set1_epi8('9'));
+    __m128i v = _mm_add_epi8(_mm_and_si128(lc, _mm_set1_epi8(0x0f)),
+			     _mm_and_si128(letter, _mm_set1_epi8(9)));
+    __m128i hi = _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 4);
+    __m128i lo = _mm_srli_epi16(v, 8);
+    __m128i b = _mm_or_si128(hi, lo);
+    return _mm_packus_epi16(b, b);
+}
+#endif
+
+/* Number of hex digits starting at p */
+static size_t hex_run(const char *p)
+{
+    size_t n = 0;
+#if defined(__SSE2__)
+    unsigned mask;
+    while ((mask = hex_mask16(p + n)) == 0xffff)
+	n += 16;
+    n += __builtin_ctz(~mask);
+#else
+    while (hex_plus1[(byte_t) p[n]])
+	n++;
+#endif
+    return n;
+}
+
+/* Convert the 2*n hex digits at p to n bytes at out */
+static void hex_decode(const char *p, byte_t *out, size_t n)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 8 <= n; i += 8)
+	_mm_storel_epi64((__m128i *) (out + i),
+			 hex_pack(_mm_loadu_si128((const __m128i *) (p + 2*i))));
+    if (i + 4 <= n) {
+	int w = _mm_cvtsi128_si32(
+	    hex_pack(_mm_loadl_epi64((const __m128i *) (p + 2*i))));
+	memcpy(out + i, &w, 4);
+	i += 4;
+    }
+#endif
+    for (; i < n; i++)
+	out[i] = (hex_plus1[(byte_t) p[2*i]] - 1) * 16 +
+	    hex_plus1[(byte_t) p[2*i+1]] - 1;
+}
+
+/*
+ * Load one line of a .yo file, NUL terminated.  Return the number of
+ * bytes loaded, or -1 if the line is bad.
+ */
+static long long load_line(mem_t m, char *buf, int lineno, int report_error,
+			   symtab_t syms)
+{
+    char *p = buf;
+    uword_t bytepos = 0;
+    uword_t start;
+    size_t ndig, nbytes, done, n;
 #ifdef HAS_GUI
-    int empty_line = 1;
-    int addr = 0;
+    static int line_no = 0;
     char hexcode[21];
-    /* For display */
-    int line_no = 0;
     char line[LINELEN];
     int index = 0;
-#endif /* HAS_GUI */
-    while (fgets(buf, LINELEN, infile)) {
-	int cpos = 0;
-#ifdef HAS_GUI
-	empty_line = 1;
+    word_t addr;
 #endif
-	lineno++;
-	/* Skip white space */
-	while (isspace((int)buf[cpos]))
-	    cpos++;
-
-	if (buf[cpos] != '0' ||
-	    (buf[cpos+1] != 'x' && buf[cpos+1] != 'X'))
-	    continue; /* Skip this line */
-	cpos+=2;
-
-	/* Get address */
-	bytepos = 0;
-	while (isxdigit((int)(c=buf[cpos]))) {
-	    cpos++;
-	    bytepos = bytepos*16 + hex2dig(c);
+
+    /* Skip white space */
+    while (IS_SPACE(*p))
+	p++;
+
+    if (p[0] != '0' || (p[1] != 'x' && p[1] != 'X'))
+	return 0; /* Skip this line */
+    p += 2;
+
+    /* Get address */
+    while (hex_plus1[(byte_t) *p])
+	bytepos = bytepos*16 + hex_plus1[(byte_t) *p++] - 1;
+
+    while (IS_SPACE(*p))
+	p++;
+
+    if (*p++ != ':') {
+	if (report_error) {
+	    fprintf(stderr, "Error reading file. Expected colon\n");
+	    fprintf(stderr, "Line %d:%s\n", lineno, buf);
+	    fprintf(stderr,
+		    "Reading '%c' at position %d\n", *p, (int) (p - buf));
 	}
+	return -1;
+    }
 
-	while (isspace((int)buf[cpos]))
-	    cpos++;
+#ifdef HAS_GUI
+    addr = bytepos;
+#endif
+    start = bytepos;
 
-	if (buf[cpos++] != ':') {
+    while (IS_SPACE(*p))
+	p++;
+
+    /* Get code, a page at a time */
+    ndig = hex_run(p);
+    nbytes = ndig / 2;
+    for (done = 0; done < nbytes; done += n) {
+	if (bytepos > m->last) {
 	    if (report_error) {
-		fprintf(stderr, "Error reading file. Expected colon\n");
-		fprintf(stderr, "Line %d:%s\n", lineno, buf);
 		fprintf(stderr,
-			"Reading '%c' at position %d\n", buf[cpos], cpos);
+			"Error reading file. Invalid address. 0x%x\n",
+			bytepos);
+		fprintf(stderr, "Line %d:%s\n", lineno, buf);
 	    }
-	    return 0;
+	    return -1;
+	}
+	n = PAGE_SIZE - (bytepos & PAGE_MASK);
+	if (n > nbytes - done)
+	    n = nbytes - done;
+	if (n > (size_t) (m->last - bytepos) + 1)
+	    n = (size_t) (m->last - bytepos) + 1;
+	hex_decode(p + 2*done, mem_page(m, bytepos) + (bytepos & PAGE_MASK), n);
+	bytepos += n;
+    }
+
+    if (syms) {
+	/* A label starting the comment names the line's address */
+	char *q = p + ndig;
+	char *name;
+	while (IS_SPACE(*q))
+	    q++;
+	if (*q++ == '|') {
+	    while (IS_SPACE(*q))
+		q++;
+	    name = q;
+	    while (isalnum((byte_t) *q) || *q == '_' || *q == '.' || *q == '$')
+		q++;
+	    if (q > name && *q == ':' && !isdigit((byte_t) *name))
+		add_label(syms, start, name, q - name);
 	}
+    }
 
 #ifdef HAS_GUI
-	addr = bytepos;
+    /* Fill rest of hexcode with blanks.
+       Needs to be 2x longest instruction */
+    for (; index < 20 && index < (int) (2*nbytes); index++)
+	hexcode[index] = p[index];
+    for (; index < 20; index++)
+	hexcode[index] = ' ';
+    hexcode[index] = '\0';
+
+    if (gui_mode) {
+	char c;
+	/* Now get the rest of the line */
+	p += ndig + 1;
+	while (IS_SPACE(*p))
+	    p++;
+	p++; /* Skip over '|' */
+
 	index = 0;
-#endif
+	while ((c = *p++) != '\0' && c != '\n' && index < LINELEN-1) {
+	    line[index++] = c;
+	}
+	line[index] = '\0';
+	if (nbytes > 0)
+	    report_line(line_no++, addr, hexcode, line);
+    }
+#endif /* HAS_GUI */
+    return nbytes;
+}
 
-	while (isspace((int)buf[cpos]))
-	    cpos++;
-
-	/* Get code */
-	while (isxdigit((int)(ch=buf[cpos++])) &&
-	       isxdigit((int)(cl=buf[cpos++]))) {
-	    byte_t byte = 0;
-	    if (bytepos >= m->len) {
-		if (report_error) {
-		    fprintf(stderr,
-			    "Error reading file. Invalid address. 0x%x\n",
-			    bytepos);
-		    fprintf(stderr, "Line %d:%s\n", lineno, buf);
-		}
-		return 0;
+long long load_mem(mem_t m, FILE *infile, int report_error, symtab_t syms)
+{
+    /* Read contents of .yo file */
+    size_t size = LOAD_CHUNK;
+    char *buf = (char *) malloc(size + LOAD_PAD);
+    size_t have = 0;		/* Bytes in buf */
+    size_t start = 0;		/* Where the next line starts */
+    bool_t eof = FALSE;
+    long long byte_cnt = 0;
+    int lineno = 0;
+
+    for (;;) {
+	char *nl = (char *) memchr(buf + start, '\n', have - start);
+	char *end;
+	char saved;
+	long long cnt;
+	if (!nl && !eof) {
+	    /* Keep the partial line, making room for it to get longer */
+	    size_t n;
+	    memmove(buf, buf + start, have - start);
+	    have -= start;
+	    start = 0;
+	    if (have == size) {
+		size *= 2;
+		buf = (char *) realloc(buf, size + LOAD_PAD);
 	    }
-	    byte = hex2dig(ch)*16+hex2dig(cl);
-	    m->contents[bytepos++] = byte;
-	    byte_cnt++;
-#ifdef HAS_GUI
-	    empty_line = 0;
-	    hexcode[index++] = ch;
-	    hexcode[index++] = cl;
-#endif
+	    n = fread(buf + have, 1, size - have, infile);
+	    if (n == 0)
+		eof = TRUE;
+	    have += n;
+	    continue;
 	}
-#ifdef HAS_GUI
-	/* Fill rest of hexcode with blanks.
-	   Needs to be 2x longest instruction */
-	for (; index < 20; index++)
-	    hexcode[index] = ' ';
-	hexcode[index] = '\0';
-
-	if (gui_mode) {
-	    /* Now get the rest of the line */
-	    while (isspace((int)buf[cpos]))
-		cpos++;
-	    cpos++; /* Skip over '|' */
-
-	    index = 0;
-	    while ((c = buf[cpos++]) != '\0' && c != '\n') {
-		line[index++] = c;
+	if (start == have)
+	    break;
+	end = nl ? nl + 1 : buf + have;
+	saved = *end;
+	*end = '\0';
+	cnt = load_line(m, buf + start, ++lineno, report_error, syms);
+	if (cnt < 0) {
+	    free(buf);
+	    return 0;
+	}
+	byte_cnt += cnt;
+	*end = saved;
+	start = end - buf;
+    }
+    free(buf);
+    return byte_cnt;
+}
+/*
+ * Map len bytes of file fd from offset off privately, so writes to
+ * them go to copies, and record the mapping in m.  Return NULL if the
+ * file can't be mapped.
+ */
+static byte_t *map_file(mem_t m, int fd, off_t off, size_t len)
+{
+    struct mem_map_rec *mp;
+    byte_t *p = (byte_t *) mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+				fd, off);
+    if (p == (byte_t *) MAP_FAILED)
+	return NULL;
+    mp = (struct mem_map_rec *) malloc(sizeof(struct mem_map_rec));
+    mp->addr = p;
+    mp->len = len;
+    mp->next = m->maps;
+    m->maps = mp;
+    return p;
+}
+
+/*
+ * Put len bytes of file fd from offset off at address a of m.  Whole
+ * pages not yet allocated are mapped from the file if the offset lines
+ * up with the address; the rest is copied.  Return FALSE on a read
+ * error.
+ */
+static bool_t load_segment(mem_t m, int fd, off_t off, uword_t a, uword_t len)
+{
+    uword_t first = (a + PAGE_MASK) & ~PAGE_MASK;
+    uword_t end = (a + len) & ~PAGE_MASK;
+    uword_t pos, n;
+    int i;
+
+    /* Map the whole pages, unless some of them already hold something */
+    if (len > 0 && first >= a && first < end &&
+	((off + (first - a)) & PAGE_MASK) == 0) {
+	bool_t free_run = TRUE;
+	byte_t *p = NULL;
+	for (pos = first; free_run && pos < end; pos += PAGE_SIZE)
+	    free_run = m->pages[pos >> PAGE_BITS] == NULL;
+	if (free_run)
+	    p = map_file(m, fd, off + (first - a), end - first);
+	if (p) {
+	    for (i = 0; i < (int) ((end - first) >> PAGE_BITS); i++) {
+		m->pages[(first >> PAGE_BITS) + i] =
+		    m->wpages[(first >> PAGE_BITS) + i] = p + (i << PAGE_BITS);
+		m->resident++;
 	    }
-	    line[index] = '\0';
-	    if (!empty_line)
-		report_line(line_no++, addr, hexcode, line);
+	    /* Copy what's left on either side */
+	    return load_segment(m, fd, off, a, first - a) &&
+		load_segment(m, fd, off + (end - a), end, a + len - end);
 	}
-#endif /* HAS_GUI */
     }
+
+    /* Copy a page at a time */
+    for (pos = 0; pos < len; pos += n) {
+	uword_t addr = a + pos;
+	n = PAGE_SIZE - (addr & PAGE_MASK);
+	if (n > len - pos)
+	    n = len - pos;
+	if (pread(fd, mem_page(m, addr) + (addr & PAGE_MASK), n, off + pos)
+	    != (ssize_t) n)
+	    return FALSE;
+    }
+    return TRUE;
+}
+
+long long load_image(mem_t m, char *fname, word_t *entryp, int report_error)
+{
+    Elf32_Ehdr eh;
+    Elf32_Phdr ph;
+    struct stat st;
+    long long byte_cnt = 0;
+    int fd, i;
+
+    *entryp = 0;
+    /* Mapped pages aren't tracked as written since a checkpoint */
+    mem_drop_checkpoints(m);
+    if ((fd = open(fname, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	if (report_error)
+	    fprintf(stderr, "Couldn't open image %s\n", fname);
+	if (fd >= 0)
+	    close(fd);
+	return 0;
+    }
+
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) ||
+	memcmp(eh.e_ident, ELFMAG, SELFMAG)) {
+	/* Raw binary, placed at address 0 */
+	if ((long long) st.st_size - 1 > (long long) m->last) {
+	    if (report_error)
+		fprintf(stderr, "Error reading image. Too big for memory\n");
+	    close(fd);
+	    return 0;
+	}
+	if (!load_segment(m, fd, 0, 0, st.st_size)) {
+	    if (report_error)
+		fprintf(stderr, "Error reading image %s\n", fname);
+	    close(fd);
+	    return 0;
+	}
+	m->le_code = TRUE;
+	close(fd);
+	return st.st_size;
+    }
+
+    if (eh.e_ident[EI_CLASS] != ELFCLASS32 ||
+	eh.e_ident[EI_DATA] != ELFDATA2LSB ||
+	eh.e_machine != EM_RISCV || eh.e_phentsize != sizeof(ph)) {
+	if (report_error)
+	    fprintf(stderr, "Error reading image. Not a little-endian RV32 ELF\n");
+	close(fd);
+	return 0;
+    }
+    for (i = 0; i < eh.e_phnum; i++) {
+	if (pread(fd, &ph, sizeof(ph), eh.e_phoff + i * sizeof(ph))
+	    != sizeof(ph)) {
+	    if (report_error)
+		fprintf(stderr, "Error reading image. Bad program header\n");
+	    close(fd);
+	    return 0;
+	}
+	if (ph.p_type != PT_LOAD || ph.p_memsz == 0)
+	    continue;
+	if (ph.p_filesz > ph.p_memsz ||
+	    (long long) ph.p_vaddr + ph.p_memsz - 1 > (long long) m->last) {
+	    if (report_error)
+		fprintf(stderr,
+			"Error reading image. Invalid address. 0x%x\n",
+			ph.p_vaddr + ph.p_memsz - 1);
+	    close(fd);
+	    return 0;
+	}
+	/* Pages past p_filesz (.bss) are left to be allocated on demand */
+	if (!load_segment(m, fd, ph.p_offset, ph.p_vaddr, ph.p_filesz)) {
+	    if (report_error)
+		fprintf(stderr, "Error reading image %s\n", fname);
+	    close(fd);
+	    return 0;
+	}
+	byte_cnt += ph.p_filesz;
+    }
+    m->le_code = TRUE;
+    *entryp = eh.e_entry;
+    close(fd);
     return byte_cnt;
 }
 
+/*
+ * Start of a snapshot file, in the byte order of the host that wrote
+ * it.  The register file and the numbers of the pages stored follow,
+ * then the pages themselves from the next page boundary on, so they
+ * can be mapped.
+ */
+typedef struct {
+    char magic[8];	/* SNAP_MAGIC */
+    unsigned flags;	/* SNAP_LE_CODE */
+    uword_t pc;
+    uword_t last;	/* Highest address in the memory */
+    unsigned npages;	/* Pages stored */
+    unsigned reg_len;	/* Bytes of register file */
+    unsigned pad[3];
+} snap_hdr;
+
+#define SNAP_MAGIC "ssimsnp1"
+#define SNAP_LE_CODE 0x1
+
+/* Where the pages of a snapshot with header h start */
+static off_t snap_data_off(snap_hdr *h)
+{
+    off_t off = sizeof(snap_hdr) + h->reg_len + h->npages * sizeof(unsigned);
+    return (off + PAGE_MASK) & ~(off_t) PAGE_MASK;
+}
+
+bool_t save_snapshot(mem_t m, mem_t r, word_t pc, char *fname)
+{
+    static byte_t zeros[PAGE_SIZE];
+    unsigned *index = (unsigned *) malloc(m->npages * sizeof(unsigned));
+    byte_t *regs;
+    snap_hdr h;
+    bool_t ok;
+    FILE *f;
+    int i;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+    h.flags = m->le_code ? SNAP_LE_CODE : 0;
+    h.pc = pc;
+    h.last = m->last;
+    h.reg_len = r->last + 1;
+    /* Pages holding only zeros don't need storing */
+    for (i = 0; i < m->npages; i++)
+	if (m->pages[i] && memcmp(m->pages[i], zeros, PAGE_SIZE))
+	    index[h.npages++] = i;
+
+    if ((f = fopen(fname, "wb")) == NULL) {
+	free((void *) index);
+	return FALSE;
+    }
+    regs = (byte_t *) malloc(h.reg_len);
+    for (i = 0; i < (int) h.reg_len; i++)
+	get_byte_val(r, i, &regs[i]);
+    fwrite(&h, sizeof(h), 1, f);
+    fwrite(regs, 1, h.reg_len, f);
+    fwrite(index, sizeof(unsigned), h.npages, f);
+    fwrite(zeros, 1, snap_data_off(&h) - ftell(f), f);
+    for (i = 0; i < (int) h.npages; i++)
+	fwrite(m->pages[index[i]], 1, PAGE_SIZE, f);
+    ok = !ferror(f);
+    if (fclose(f) != 0)
+	ok = FALSE;
+    free((void *) regs);
+    free((void *) index);
+    return ok;
+}
+
+bool_t is_snapshot(char *fname)
+{
+    char magic[8];
+    FILE *f = fopen(fname, "rb");
+    bool_t ok;
+    if (!f)
+	return FALSE;
+    ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+	!memcmp(magic, SNAP_MAGIC, sizeof(magic));
+    fclose(f);
+    return ok;
+}
+
+mem_t load_snapshot(char *fname, mem_t r, word_t *pcp, int report_error)
+{
+    snap_hdr h;
+    struct stat st;
+    unsigned *index = NULL;
+    byte_t *regs = NULL;
+    byte_t *p = NULL;
+    mem_t m = NULL;
+    off_t data;
+    int fd, i;
+
+    if ((fd = open(fname, O_RDONLY)) < 0) {
+	if (report_error)
+	    fprintf(stderr, "Couldn't open snapshot %s\n", fname);
+	return NULL;
+    }
+    if (fstat(fd, &st) < 0 ||
+	pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+	memcmp(h.magic, SNAP_MAGIC, sizeof(h.magic)) ||
+	h.reg_len != r->last + 1 ||
+	h.npages > (h.last >> PAGE_BITS) + 1 ||
+	st.st_size < snap_data_off(&h) + (off_t) h.npages * PAGE_SIZE)
+	goto bad;
+
+    regs = (byte_t *) malloc(h.reg_len);
+    index = (unsigned *) malloc(h.npages * sizeof(unsigned) + 1);
+    if (pread(fd, regs, h.reg_len, sizeof(h)) != (ssize_t) h.reg_len ||
+	pread(fd, index, h.npages * sizeof(unsigned), sizeof(h) + h.reg_len)
+	!= (ssize_t) (h.npages * sizeof(unsigned)))
+	goto bad;
+    m = init_mem((long long) h.last + 1);
+    for (i = 0; i < (int) h.npages; i++)
+	if (index[i] >= (unsigned) m->npages || m->pages[index[i]])
+	    goto bad;
+
+    /* Map the pages where they lie in the file, or failing that copy them */
+    data = snap_data_off(&h);
+    if (h.npages > 0)
+	p = map_file(m, fd, data, (size_t) h.npages * PAGE_SIZE);
+    for (i = 0; i < (int) h.npages; i++) {
+	if (p) {
+	    m->pages[index[i]] = m->wpages[index[i]] =
+		p + ((size_t) i << PAGE_BITS);
+	    m->resident++;
+	} else if (pread(fd, mem_page(m, index[i] << PAGE_BITS), PAGE_SIZE,
+			 data + (off_t) i * PAGE_SIZE) != PAGE_SIZE)
+	    goto bad;
+    }
+    m->le_code = (h.flags & SNAP_LE_CODE) != 0;
+
+    for (i = 0; i < (int) h.reg_len; i++)
+	set_byte_val(r, i, regs[i]);
+    *pcp = h.pc;
+    free((void *) regs);
+    free((void *) index);
+    close(fd);
+    return m;
+
+ bad:
+    if (report_error)
+	fprintf(stderr, "Error reading snapshot %s\n", fname);
+    if (m)
+	free_mem(m);
+    free((void *) regs);
+    free((void *) index);
+    close(fd);
+    return NULL;
+}
+
 bool_t get_byte_val(mem_t m, word_t pos, byte_t *dest)
 {
-    if (pos < 0 || pos >= m->len)
+    uword_t a = pos;
+    byte_t *p;
+    if (a > m->last)
 	return FALSE;
-    *dest = m->contents[pos];
+    p = m->pages[a >> PAGE_BITS];
+    *dest = p ? p[a & PAGE_MASK] : 0;
     return TRUE;
 }
 
+/*
+ * Page holding the len bytes at a, or NULL if they aren't all on one
+ * page that has been allocated.  The accesses below fall back to one
+ * byte at a time when this is NULL.
+ */
+#define PAGE_OF(m, a, len) \
+    (((a) & PAGE_MASK) <= PAGE_SIZE - (len) ? (m)->pages[(a) >> PAGE_BITS] \
+     : NULL)
+
+/* Same for writing */
+#define WPAGE_OF(m, a, len) \
+    (((a) & PAGE_MASK) <= PAGE_SIZE - (len) ? (m)->wpages[(a) >> PAGE_BITS] \
+     : NULL)
+
+/*
+ * Aligned words never cross a page, so on little-endian hosts they are
+ * read and written with one host access.  Everything else goes a byte
+ * at a time.
+ */
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NATIVE_WORDS 1
+#else
+#define NATIVE_WORDS 0
+#endif
+
 bool_t get_halfword_val(mem_t m, word_t pos, word_t *dest)
 {
     int i;
     word_t val;
-    if (pos < 0 || pos + 4 > m->len)
+    uword_t a = pos;
+    byte_t *p;
+    if (a > m->last - 3)
 	return FALSE;
+    if (NATIVE_WORDS && !(a & 3)) {
+	if ((p = m->pages[a >> PAGE_BITS]) != NULL)
+	    memcpy(dest, p + (a & PAGE_MASK), 4);
+	else
+	    *dest = 0;
+	return TRUE;
+    }
     val = 0;
-    for (i = 0; i < 4; i++) {
-	word_t b =  m->contents[pos+i] & 0xFF;
-	val = val | (b <<(8*i));
+    if ((p = PAGE_OF(m, a, 4)) != NULL) {
+	p += a & PAGE_MASK;
+	for (i = 0; i < 4; i++)
+	    val = val | ((word_t) p[i] << (8*i));
+    } else {
+	for (i = 0; i < 4; i++) {
+	    byte_t b = 0;
+	    get_byte_val(m, a+i, &b);
+	    val = val | ((word_t) b << (8*i));
+	}
     }
     *dest = val;
     return TRUE;
@@ -358,27 +1352,53 @@ bool_t get_riscv4byte_val(mem_t m, word_t pos, word_t *dest)
 {
     int i;
     word_t val;
-    if (pos < 0 || pos + 4 > m->len)
+    uword_t a = pos;
+    byte_t *p;
+    if (a > m->last - 3)
 	return FALSE;
     val = 0;
-    for (i = 0; i < 4; i++) {
-	word_t b =  m->contents[pos+i] & 0xFF;
-	val = (val << 8) | b;
+    if ((p = PAGE_OF(m, a, 4)) != NULL) {
+	p += a & PAGE_MASK;
+	for (i = 0; i < 4; i++)
+	    val = (val << 8) | p[i];
+    } else {
+	for (i = 0; i < 4; i++) {
+	    byte_t b = 0;
+	    get_byte_val(m, a+i, &b);
+	    val = (val << 8) | b;
+	}
     }
     *dest = val;
     return TRUE;
 }
 
+bool_t get_instr_val(mem_t m, word_t pos, word_t *dest)
+{
+#if NATIVE_WORDS
+    uword_t a = pos;
+    byte_t *p;
+    if (m->le_code && a <= m->last - 3 && (p = PAGE_OF(m, a, 4)) != NULL) {
+	memcpy(dest, p + (a & PAGE_MASK), 4);
+	return TRUE;
+    }
+#endif
+    if (m->le_code)
+	return get_halfword_val(m, pos, dest);
+    return get_riscv4byte_val(m, pos, dest);
+}
+
 bool_t get_word_val(mem_t m, word_t pos, word_t *dest)
 {
     int i;
     word_t val;
-    if (pos < 0 || pos + 8 > m->len)
+    uword_t a = pos;
+    if (m->last < 7 || a > m->last - 7)
 	return FALSE;
     val = 0;
     for (i = 0; i < 8; i++) {
-	word_t b =  m->contents[pos+i] & 0xFF;
-	val = val | (b <<(8*i));
+	byte_t b = 0;
+	get_byte_val(m, a+i, &b);
+	val = val | ((word_t) b << (8*i));
     }
     *dest = val;
     return TRUE;
@@ -386,20 +1406,35 @@ bool_t get_word_val(mem_t m, word_t pos, word_t *dest)
 
 bool_t set_byte_val(mem_t m, word_t pos, byte_t val)
 {
-    if (pos < 0 || pos >= m->len)
+    uword_t a = pos;
+    if (a > m->last)
 	return FALSE;
-    m->contents[pos] = val;
+    mem_page(m, a)[a & PAGE_MASK] = val;
     return TRUE;
 }
 
 bool_t set_halfword_val(mem_t m, word_t pos, word_t val)
 {
     int i;
-    if (pos < 0 || pos + 4 > m->len)
+    uword_t a = pos;
+    byte_t *p;
+    if (a > m->last - 3)
 	return FALSE;
-    for (i = 0; i < 4; i++) {
-	m->contents[pos+i] = (byte_t) val & 0xFF;
-	val >>= 8;
+    if (NATIVE_WORDS && !(a & 3)) {
+	memcpy(mem_page(m, a) + (a & PAGE_MASK), &val, 4);
+	return TRUE;
+    }
+    if ((p = WPAGE_OF(m, a, 4)) != NULL) {
+	p += a & PAGE_MASK;
+	for (i = 0; i < 4; i++) {
+	    p[i] = (byte_t) val & 0xFF;
+	    val >>= 8;
+	}
+    } else {
+	for (i = 0; i < 4; i++) {
+	    set_byte_val(m, a+i, (byte_t) val & 0xFF);
+	    val >>= 8;
+	}
     }
     return TRUE;
 }
@@ -407,10 +1442,11 @@ bool_t set_halfword_val(mem_t m, word_t pos, word_t val)
 bool_t set_word_val(mem_t m, word_t pos, word_t val)
 {
     int i;
-    if (pos < 0 || pos + 8 > m->len)
+    uword_t a = pos;
+    if (m->last < 7 || a > m->last - 7)
 	return FALSE;
     for (i = 0; i < 8; i++) {
-	m->contents[pos+i] = (byte_t) val & 0xFF;
+	set_byte_val(m, a+i, (byte_t) val & 0xFF);
 	val >>= 8;
     }
     return TRUE;
@@ -426,8 +1462,10 @@ void dump_memory(FILE *outfile, mem_t m, word_t pos, int len)
 
     len = ((len+BPL-1)/BPL)*BPL;
 
-    if (pos+len > m->len)
-	len = m->len-pos;
+    if ((uword_t) pos > m->last)
+	return;
+    if ((long long) (uword_t) pos + len > (long long) m->last + 1)
+	len = m->last - pos + 1;
 
     for (i = 0; i < len; i+=BPL) {
 	word_t val = 0;
@@ -441,7 +1479,10 @@ void dump_memory(FILE *outfile, mem_t m, word_t pos, int len)
 
 mem_t init_reg()
 {
-    return init_mem(128);
+    mem_t r = init_mem(128);
+    /* Always resident, so compiled code can address it directly */
+    mem_page(r, 0);
+    return r;
 }
 
 void free_reg(mem_t r)
@@ -456,17 +1497,18 @@ mem_t copy_reg(mem_t oldr)
 
 bool_t diff_reg(mem_t oldr, mem_t newr, FILE *outfile)
 {
-    word_t pos;
-    int len = oldr->len;
+    uword_t pos;
+    uword_t last = oldr->last;
     bool_t diff = FALSE;
-    if (newr->len < len)
-	len = newr->len;
-    for (pos = 0; (!diff || outfile) && pos < len; pos += 4) {
-
-        word_t ov = 0;
-        word_t nv = 0;
-	get_halfword_val(oldr, pos, &ov);
-	get_halfword_val(newr, pos, &nv);
+    if (newr->last < last)
+	last = newr->last;
+    /* Register files are always resident in page 0 */
+    if (oldr->pages[0] && newr->pages[0] &&
+	!memcmp(oldr->pages[0], newr->pages[0], last + 1))
+	return FALSE;
+    for (pos = 0; (!diff || outfile) && pos + 3 <= last; pos += 4) {
+	word_t ov = get_reg_val(oldr, pos/4);
+	word_t nv = get_reg_val(newr, pos/4);
 	if (nv != ov) {
 	    diff = TRUE;
 	    if (outfile)
@@ -477,27 +1519,6 @@ bool_t diff_reg(mem_t oldr, mem_t newr, FILE *outfile)
     return diff;
 }
 
-word_t get_reg_val(mem_t r, reg_id_t id)
-{
-    word_t val = 0;
-    if (id >= REG_NONE)
-	return 0;
-    get_halfword_val(r,id*4, &val);
-    return val;
-}
-
-void set_reg_val(mem_t r, reg_id_t id, word_t val)
-{
-    if (id < REG_NONE) {
-	set_halfword_val(r,id*4,val);
-#ifdef HAS_GUI
-	if (gui_mode) {
-	    signal_register_update(id, val);
-	}
-#endif /* HAS_GUI */
-    }
-}
-
 void dump_reg(FILE *outfile, mem_t r) {
     reg_id_t id;
     for (id = 0; reg_valid(id); id++) {
@@ -505,9 +1526,7 @@ void dump_reg(FILE *outfile, mem_t r) {
     }
     fprintf(outfile, "\n");
     for (id = 0; reg_valid(id); id++) {
-	word_t val = 0;
-	get_halfword_val(r, id*4, &val);
-	fprintf(outfile, " %x", val);
+	fprintf(outfile, " %x", get_reg_val(r, id));
     }
     fprintf(outfile, "\n");
 }
@@ -616,13 +1635,16 @@ char *stat_name(stat_t e)
 
 /**************** Implementation of ISA model ************************/
 
-state_ptr new_state(int memlen)
+state_ptr new_state(long long memlen)
 {
     state_ptr result = (state_ptr) malloc(sizeof(state_rec));
     result->pc = 0;
     result->r = init_reg();
     result->m = init_mem(memlen);
     result->cc = DEFAULT_CC;
+    result->wreg = REG_NONE;
+    result->wlen = 0;
+    result->resv = FALSE;
     return result;
 }
 
@@ -639,6 +1661,11 @@ state_ptr copy_state(state_ptr s) {
     result->r = copy_reg(s->r);
     result->m = copy_mem(s->m);
     result->cc = s->cc;
+    result->wreg = s->wreg;
+    result->wval = s->wval;
+    result->wlen = s->wlen;
+    result->waddr = s->waddr;
+    result->wdata = s->wdata;
     return result;
 }
 
@@ -702,8 +1729,258 @@ bool_t cond_holds(cc_t cc, cond_t bcond) {
 }
 
 
-/* Execute single instruction.  Return status. */
+/* Sign-extend the low bits bits of val */
+#define SEXT(val, bits) \
+    ((word_t) ((((uword_t) (val)) ^ (1u << ((bits)-1))) - (1u << ((bits)-1))))
+
+/* Read len bytes at pos, little-endian.  Return TRUE if all were there */
+static bool_t get_bytes(mem_t m, word_t pos, int len, uword_t *dest)
+{
+    int i;
+    byte_t b;
+    uword_t val = 0;
+    for (i = 0; i < len; i++) {
+	if (!get_byte_val(m, pos+i, &b))
+	    return FALSE;
+	val |= (uword_t) b << (8*i);
+    }
+    *dest = val;
+    return TRUE;
+}
+
+/*
+ * Execute single instruction.  Return status.
+ *
+ * This is the RV32I reference model: it follows the ISA manual rather
+ * than the HCL control logic, so the -t check in ssim can compare the
+ * two.  Instruction words are fetched in the same byte order as the
+ * simulator does.  The all-zero word halts, and fence and the system
+ * instructions (ecall, ebreak, csr*) have no effect.  Of the A
+ * extension, sc.w succeeds if the last lr.w was from the same address
+ * and the word there still holds what it loaded.  Writes made are
+ * recorded in s->wreg/wval and s->wlen/waddr/wdata.
+ */
 stat_t step_state(state_ptr s, FILE *error_file)
 {
+    word_t instr;
+    word_t npc = s->pc + 4;
+    int opcode, rd, f3, f7, i;
+    word_t v1, v2, imm, val = 0, addr;
+    uword_t ld;
+    bool_t write_rd = TRUE;
+
+    s->wreg = REG_NONE;
+    s->wlen = 0;
+
+    if (!get_instr_val(s->m, s->pc, &instr)) {
+	if (error_file)
+	    fprintf(error_file,
+		    "PC = 0x%x, Invalid instruction address\n", s->pc);
+	return STAT_ADR;
+    }
+    if (instr == 0)
+	return STAT_HLT;
+
+    opcode = instr & 0x7f;
+    rd = (instr >> 7) & 0x1f;
+    f3 = (instr >> 12) & 0x7;
+    f7 = ((uword_t) instr >> 25) & 0x7f;
+    v1 = get_reg_val(s->r, (instr >> 15) & 0x1f);
+    v2 = get_reg_val(s->r, (instr >> 20) & 0x1f);
+
+    switch (opcode) {
+    case I_LUI:
+	val = instr & 0xfffff000;
+	break;
+    case I_AUIPC:
+	val = s->pc + (instr & 0xfffff000);
+	break;
+    case I_JAL:
+	imm = SEXT((((uword_t) instr >> 31) & 0x1) << 20 |
+		   ((instr >> 12) & 0xff) << 12 |
+		   ((instr >> 20) & 0x1) << 11 |
+		   ((instr >> 21) & 0x3ff) << 1, 21);
+	val = npc;
+	npc = s->pc + imm;
+	break;
+    case I_JALR:
+	if (f3 != 0)
+	    goto bad;
+	val = npc;
+	npc = (v1 + SEXT((uword_t) instr >> 20, 12)) & ~1;
+	break;
+    case I_B:
+	imm = SEXT((((uword_t) instr >> 31) & 0x1) << 12 |
+		   ((instr >> 7) & 0x1) << 11 |
+		   ((instr >> 25) & 0x3f) << 5 |
+		   ((instr >> 8) & 0xf) << 1, 13);
+	switch (f3) {
+	case 0: val = v1 == v2; break;
+	case 1: val = v1 != v2; break;
+	case 4: val = v1 < v2; break;
+	case 5: val = v1 >= v2; break;
+	case 6: val = (uword_t) v1 < (uword_t) v2; break;
+	case 7: val = (uword_t) v1 >= (uword_t) v2; break;
+	default: goto bad;
+	}
+	if (val)
+	    npc = s->pc + imm;
+	write_rd = FALSE;
+	break;
+    case I_L:
+	addr = v1 + SEXT((uword_t) instr >> 20, 12);
+	switch (f3) {
+	case 0: case 4:
+	    if (!get_bytes(s->m, addr, 1, &ld))
+		goto bad_addr;
+	    val = f3 == 0 ? SEXT(ld, 8) : (word_t) ld;
+	    break;
+	case 1: case 5:
+	    if (!get_bytes(s->m, addr, 2, &ld))
+		goto bad_addr;
+	    val = f3 == 1 ? SEXT(ld, 16) : (word_t) ld;
+	    break;
+	case 2:
+	    if (!get_bytes(s->m, addr, 4, &ld))
+		goto bad_addr;
+	    val = ld;
+	    break;
+	default:
+	    goto bad;
+	}
+	break;
+    case I_S:
+	addr = v1 + SEXT(((uword_t) instr >> 25) << 5 | ((instr >> 7) & 0x1f), 12);
+	if (f3 > 2)
+	    goto bad;
+	s->wlen = 1 << f3;
+	if (!get_bytes(s->m, addr, s->wlen, &ld)) {
+	    s->wlen = 0;
+	    goto bad_addr;
+	}
+	s->waddr = addr;
+	s->wdata = s->wlen == 4 ? v2 : v2 & ((1 << (8*s->wlen)) - 1);
+	for (i = 0; i < s->wlen; i++)
+	    set_byte_val(s->m, addr + i, (v2 >> (8*i)) & 0xff);
+	write_rd = FALSE;
+	break;
+    case I_OP:
+	imm = SEXT((uword_t) instr >> 20, 12);
+	switch (f3) {
+	case 0: val = v1 + imm; break;
+	case 2: val = v1 < imm; break;
+	case 3: val = (uword_t) v1 < (uword_t) imm; break;
+	case 4: val = v1 ^ imm; break;
+	case 6: val = v1 | imm; break;
+	case 7: val = v1 & imm; break;
+	case 1:
+	    if (f7 != 0)
+		goto bad;
+	    val = (uword_t) v1 << (imm & 0x1f);
+	    break;
+	case 5:
+	    if (f7 == 0)
+		val = (uword_t) v1 >> (imm & 0x1f);
+	    else if (f7 == 0x20)
+		val = v1 >> (imm & 0x1f);
+	    else
+		goto bad;
+	    break;
+	}
+	break;
+    case I_R:
+	if (f7 != 0 && !(f7 == 0x20 && (f3 == 0 || f3 == 5)))
+	    goto bad;
+	switch (f3) {
+	case 0: val = f7 ? v1 - v2 : v1 + v2; break;
+	case 1: val = (uword_t) v1 << (v2 & 0x1f); break;
+	case 2: val = v1 < v2; break;
+	case 3: val = (uword_t) v1 < (uword_t) v2; break;
+	case 4: val = v1 ^ v2; break;
+	case 5:
+	    val = f7 ? v1 >> (v2 & 0x1f) : (word_t) ((uword_t) v1 >> (v2 & 0x1f));
+	    break;
+	case 6: val = v1 | v2; break;
+	case 7: val = v1 & v2; break;
+	}
+	break;
+    case I_AMO:
+	/* Bit n of the mask is set if n is a valid funct5 */
+	if (f3 != 2 || !((0x1111111f >> (f7 >> 2)) & 1))
+	    goto bad;
+	addr = v1;
+	if ((addr & 3) || !get_bytes(s->m, addr, 4, &ld))
+	    goto bad_addr;
+	val = ld;
+	switch (f7 >> 2) {
+	case 0x02:	/* lr.w */
+	    s->resv = TRUE;
+	    s->resv_addr = addr;
+	    s->resv_val = val;
+	    break;
+	case 0x03:	/* sc.w */
+	    if (!s->resv || s->resv_addr != addr || s->resv_val != val) {
+		s->resv = FALSE;
+		val = 1;
+		break;
+	    }
+	    s->resv = FALSE;
+	    s->wlen = 4;
+	    s->wdata = v2;
+	    val = 0;
+	    break;
+	case 0x01: s->wlen = 4; s->wdata = v2; break;
+	case 0x00: s->wlen = 4; s->wdata = val + v2; break;
+	case 0x04: s->wlen = 4; s->wdata = val ^ v2; break;
+	case 0x0c: s->wlen = 4; s->wdata = val & v2; break;
+	case 0x08: s->wlen = 4; s->wdata = val | v2; break;
+	case 0x10: s->wlen = 4; s->wdata = val < v2 ? val : v2; break;
+	case 0x14: s->wlen = 4; s->wdata = val > v2 ? val : v2; break;
+	case 0x18:
+	    s->wlen = 4;
+	    s->wdata = (uword_t) val < (uword_t) v2 ? val : v2;
+	    break;
+	case 0x1c:
+	    s->wlen = 4;
+	    s->wdata = (uword_t) val > (uword_t) v2 ? val : v2;
+	    break;
+	default:
+	    goto bad;
+	}
+	if (s->wlen) {
+	    s->waddr = addr;
+	    for (i = 0; i < 4; i++)
+		set_byte_val(s->m, addr + i, (s->wdata >> (8*i)) & 0xff);
+	}
+	break;
+    case I_FENCE:
+	if (f3 > 1)
+	    goto bad;
+	/* Fall through */
+    case I_CSR:
+	write_rd = FALSE;
+	break;
+    default:
+	goto bad;
+    }
+
+    if (write_rd && rd != REG_X0) {
+	set_reg_val(s->r, rd, val);
+	s->wreg = rd;
+	s->wval = val;
+    }
+    s->pc = npc;
     return STAT_AOK;
+
+ bad:
+    if (error_file)
+	fprintf(error_file, "PC = 0x%x, Invalid instruction 0x%.8x\n",
+		s->pc, instr);
+    return STAT_INS;
+
+ bad_addr:
+    if (error_file)
+	fprintf(error_file, "PC = 0x%x, Invalid data address 0x%x\n",
+		s->pc, addr);
+    return STAT_ADR;
 }
@@ -37,7 +37,7 @@ typedef enum { R_ARG, M_ARG, I_ARG, NO_ARG } arg_t;
 ////////////////////////////////////
 //PART B: add the icode of addi/slti/sltiu/xori/ori/andi/slli/srli/srai
 //PART C: add the icode of lw
-typedef enum { I_HALT=0x0, I_NOP=0x1, I_LUI=0x37, I_AUIPC=0x17, I_JAL=0x6f, I_JALR=0x67, I_B=0x63, I_S=0x23, I_R=0x33, I_CSR=0x73 , I_OP=0x13 , I_L=0x03 } itype_t;
+typedef enum { I_HALT=0x0, I_NOP=0x1, I_LUI=0x37, I_AUIPC=0x17, I_JAL=0x6f, I_JALR=0x67, I_B=0x63, I_S=0x23, I_R=0x33, I_CSR=0x73 , I_OP=0x13 , I_L=0x03 , I_FENCE=0x0f , I_AMO=0x2f } itype_t;
 ///////////////////////////////////
 
 
@@ -84,6 +84,13 @@ typedef struct {
 
 instr_ptr find_instr(char *name);
 
+/* Entries in instruction_set, which ends with one whose name is NULL */
+#define NUM_INSTR 45
+extern instr_t instruction_set[];
+
+/* Return index in instruction_set of an encoding, NUM_INSTR if none */
+int instr_index(int icode, int ifun1, int ifun2);
+
 /* Return invalid instruction for error handling purposes */
 instr_ptr bad_instr();
 
@@ -94,36 +101,127 @@ typedef unsigned char byte_t;
 typedef int word_t;
 typedef unsigned uword_t;
 
-/* Represent a memory as an array of bytes */
+/*
+ * Represent a memory as pages of bytes, covering addresses 0 to last.
+ * A page is only allocated when it is first written; until then it
+ * reads as zeros.  Pages loaded from an image may be private mappings
+ * of the file instead.
+ */
+#define PAGE_BITS 12
+#define PAGE_SIZE (1<<PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE-1)
+
 typedef struct {
-  int len;
+  uword_t last;     /* Highest address in the memory */
   word_t maxaddr;
-  byte_t *contents;
+  int npages;       /* Entries in the page table */
+  int resident;     /* Pages allocated */
+  byte_t **pages;   /* Page table, NULL for pages never written */
+  byte_t **wpages;  /* Same, but NULL where a write must first allocate
+		       the page or copy it from a checkpoint */
+  bool_t le_code;   /* Instructions little-endian, as in images, rather
+		       than byte-reversed as in .yo files */
+  struct mem_map_rec *maps; /* File mappings holding pages */
+  struct mem_ckpt_rec *ck;  /* Checkpoints, NULL if none taken */
+  int lock;         /* Held while a page is allocated for writing, so
+		       harts on different threads can share the memory */
 } mem_rec, *mem_t;
 
-/* Create a memory with len bytes */
-mem_t init_mem(int len);
+/* Create a memory with len bytes, up to 4 GiB */
+mem_t init_mem(long long len);
 void free_mem(mem_t m);
 
 /* Set contents of memory to 0 */
 void clear_mem(mem_t m);
 
+/* Return the page holding address a for writing, allocating it if needed */
+byte_t *mem_page(mem_t m, uword_t a);
+
+/*
+ * Checkpoints share pages with the memory until it writes them, so
+ * taking one or restoring one costs time in proportion to the pages
+ * written in between.  They are numbered from 0 in the order taken;
+ * taking one after restoring an earlier one drops those after it.
+ */
+int mem_checkpoint(mem_t m);
+/* Go back, or forward, to checkpoint k.  Return FALSE if there is none */
+bool_t mem_restore(mem_t m, int k);
+/* Forget all checkpoints, keeping the current contents */
+void mem_drop_checkpoints(mem_t m);
+/* Same as diff_mem, against checkpoint k, which must not be past the
+   last one restored or taken */
+bool_t diff_mem_checkpoint(mem_t m, int k, FILE *outfile);
+
 /* Make a copy of a memory */
 mem_t copy_mem(mem_t oldm);
 /* Print the differences between two memories */
 bool_t diff_mem(mem_t oldm, mem_t newm, FILE *outfile);
 
-/* How big should the memory be? */
-#ifdef BIG_MEM
-#define MEM_SIZE (1<<16)
-#else
+/* Default memory size, changed at run time with ssim -m */
 #define MEM_SIZE (1<<13)
-#endif
+
+/* Parse a memory size like 8192, 0x2000, 64K, 16M or 4G.  Return 0 if bad */
+long long parse_mem_size(char *str);
 
 /*** In the following functions, a return value of 1 means success ***/
 
-/* Load memory from .yo file.  Return number of bytes read */
-int load_mem(mem_t m, FILE *infile, int report_error);
+/* Addresses named by labels */
+typedef struct {
+    word_t addr;
+    char *name;
+} label_rec, *label_ptr;
+
+typedef struct {
+    int n;
+    int max;
+    bool_t sorted;	/* labels is in order of address */
+    label_ptr labels;
+} symtab_rec, *symtab_t;
+
+symtab_t new_symtab();
+void free_symtab(symtab_t t);
+void clear_symtab(symtab_t t);
+
+/* Name address a with the len characters at name */
+void add_label(symtab_t t, word_t a, char *name, int len);
+
+/*
+ * Return the label of address a, or failing that the closest one
+ * below it, and set *offp to how far past it a is.  NULL if none.
+ */
+char *find_label(symtab_t t, word_t a, word_t *offp);
+
+/*
+ * Load memory from .yo file.  Return number of bytes read.  If syms
+ * is nonNULL, labels starting the comment of a line, as in
+ * "0x010:          | loop:", are added to it.
+ */
+long long load_mem(mem_t m, FILE *infile, int report_error, symtab_t syms);
+
+/*
+ * Load memory from an ELF32 executable, or failing that a raw
+ * little-endian binary placed at address 0, mapping whole pages of
+ * the file where it can.  Return number of bytes of the image, and
+ * set *entryp to its entry point.
+ */
+long long load_image(mem_t m, char *fname, word_t *entryp,
+		     int report_error);
+
+/*
+ * Write memory m, registers r and pc to snapshot file fname, storing
+ * only the pages that aren't all zeros.  Return FALSE on failure.
+ */
+bool_t save_snapshot(mem_t m, mem_t r, word_t pc, char *fname);
+
+/* Is fname a snapshot written by save_snapshot? */
+bool_t is_snapshot(char *fname);
+
+/*
+ * Load snapshot file fname, mapping its pages copy-on-write.  Return
+ * a new memory holding them, after loading the register file into r
+ * and setting *pcp.  Return NULL if fname isn't a good snapshot.
+ */
+mem_t load_snapshot(char *fname, mem_t r, word_t *pcp, int report_error);
 
 /* Get byte from memory */
 bool_t get_byte_val(mem_t m, word_t pos, byte_t *dest);
@@ -131,6 +229,9 @@ bool_t get_byte_val(mem_t m, word_t pos, byte_t *dest);
 /* Get 4 bytes from memory */
 bool_t get_riscv4byte_val(mem_t m, word_t pos, word_t *dest);
 
+/* Fetch instruction word, in the byte order it was loaded in */
+bool_t get_instr_val(mem_t m, word_t pos, word_t *dest);
+
 /* Get 4 bytes from memory */
 bool_t get_halfword_val(mem_t m, word_t pos, word_t *dest);
 
@@ -151,6 +252,13 @@ void dump_memory(FILE *outfile, mem_t m, word_t pos, int cnt);
 
 /********** Implementation of Register File *************/
 
+/*
+ * The registers are held as native words in page 0 of the register
+ * file, which is always resident, so reading or writing one is a
+ * single load or store.
+ */
+#define REG_FILE(r) ((uword_t *) (r)->pages[0])
+
 mem_t init_reg();
 void free_reg();
 
@@ -160,8 +268,29 @@ mem_t copy_reg(mem_t oldr);
 bool_t diff_reg(mem_t oldr, mem_t newr, FILE *outfile);
 
 
-word_t get_reg_val(mem_t r, reg_id_t id);
-void set_reg_val(mem_t r, reg_id_t id, word_t val);
+#ifdef HAS_GUI
+extern int gui_mode;
+void signal_register_update(reg_id_t r, word_t val);
+#endif
+
+/* Value of register id, 0 for pc and anything past it */
+static inline word_t get_reg_val(mem_t r, reg_id_t id)
+{
+    return id < REG_PC ? (word_t) REG_FILE(r)[id] : 0;
+}
+
+/* Set register id.  x0 is hard-wired to 0, so writes to it are dropped */
+static inline void set_reg_val(mem_t r, reg_id_t id, word_t val)
+{
+    if (id > REG_X0 && id < REG_PC) {
+	REG_FILE(r)[id] = val;
+#ifdef HAS_GUI
+	if (gui_mode)
+	    signal_register_update(id, val);
+#endif /* HAS_GUI */
+    }
+}
+
 void dump_reg(FILE *outfile, mem_t r);
 
 
@@ -202,9 +331,19 @@ typedef struct {
   mem_t r;
   mem_t m;
   cc_t cc;
+  /* Writes made by the last step_state */
+  reg_id_t wreg;  /* Register written, REG_NONE if none */
+  word_t wval;    /* Value written to wreg */
+  int wlen;       /* Bytes stored, 0 if none */
+  word_t waddr;   /* Address of the store */
+  word_t wdata;   /* Data stored, zero-extended from wlen bytes */
+  /* Reservation made by lr.w */
+  bool_t resv;    /* Held, until the next sc.w */
+  word_t resv_addr;
+  word_t resv_val; /* Word loaded, which sc.w expects to find */
 } state_rec, *state_ptr;
 
-state_ptr new_state(int memlen);
+state_ptr new_state(long long memlen);
 void free_state(state_ptr s);
 
 state_ptr copy_state(state_ptr s);
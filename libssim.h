@@ -0,0 +1,364 @@
+/***********************************************************************
+ *
+ * libssim.h - Interface to the RISC-V simulator library
+ *
+ * All the state of a simulation lives in a simulator created with
+ * sim_create, so any number of them can exist in one process.  A
+ * simulator must only be used by one thread at a time, but different
+ * simulators can run on different threads at once.
+ *
+ * Include isa.h before this file.
+ *
+ ***********************************************************************/
+
+/* Handle on one simulator */
+typedef struct sim_rec *sim_t;
+
+/*
+ * Create a simulator with empty memory of MEM_SIZE bytes and empty
+ * registers, using the SEQ model
+ */
+sim_t sim_create();
+
+/* Free a simulator and everything it holds */
+void sim_destroy(sim_t s);
+
+/* Clear memory, registers, pc and labels */
+void sim_reset(sim_t s);
+
+/*
+ * Load memory from .yo file, and the labels in its comments (see
+ * load_mem).  Return number of bytes read
+ */
+long long sim_load(sim_t s, FILE *infile, int report_error);
+
+/*
+ * Load memory from an ELF32 executable or raw little-endian binary
+ * (see load_image) and set pc to its entry point.  A snapshot written
+ * by sim_save_snapshot replaces memory, registers and pc instead.
+ * Return number of bytes in the image.
+ */
+long long sim_load_image(sim_t s, char *fname, int report_error);
+
+/*
+ * Write memory, registers and pc to snapshot file fname, for
+ * sim_load_image to map back in later.  Return FALSE on failure.
+ */
+bool_t sim_save_snapshot(sim_t s, char *fname);
+
+/* Replace memory and registers with copies of m and r */
+void sim_load_state(sim_t s, mem_t m, mem_t r);
+
+/*
+ * Replace memory with an empty one covering addresses 0 to len-1, up
+ * to the whole 32-bit space.  Return FALSE if len is out of range.
+ */
+bool_t sim_set_mem_size(sim_t s, long long len);
+
+/*
+ * Take a checkpoint of memory, registers and pc, after applying any
+ * pending writes.  Return its number; they count up from 0.  Memory
+ * pages are shared with the checkpoint until written, so the time
+ * taken depends only on the pages written since the last one.  Taking
+ * a checkpoint after restoring an earlier one drops those after it.
+ */
+int sim_checkpoint(sim_t s);
+
+/*
+ * Go back, or forward, to checkpoint n, in time depending on the
+ * pages written in between.  Return FALSE if there is no checkpoint n.
+ */
+bool_t sim_restore(sim_t s, int n);
+
+/*
+ * Print the memory words changed since checkpoint n, in the same form
+ * as diff_mem.  n must not be past the last checkpoint taken or
+ * restored.  Return TRUE if there are any.
+ */
+bool_t sim_diff_mem(sim_t s, int n, FILE *outfile);
+
+/*
+ * Select the engine used by sim_run: "seq", "threaded", "block",
+ * "jit" or "pipe".  Return FALSE if there is no engine called name.
+ */
+bool_t sim_set_engine(sim_t s, char *name);
+
+/* If dumpfile set nonNULL, lots of status info printed out */
+void sim_set_dumpfile(sim_t s, FILE *file);
+
+/* Trace categories logged to the dumpfile, or'ed together */
+#define TRACE_FETCH	0x1	/* Each instruction fetched */
+#define TRACE_REGWRITE	0x2	/* Each register written */
+#define TRACE_MEMWRITE	0x4	/* Each store */
+#define TRACE_BRANCH	0x8	/* Where each branch and jump went */
+#define TRACE_ALL	0xf
+#define TRACE_DEFAULT	(TRACE_FETCH | TRACE_MEMWRITE)
+
+/*
+ * Select the trace categories logged while there is a dumpfile,
+ * TRACE_DEFAULT to begin with.  With none selected the engines run
+ * code that has no tracing in it at all.
+ */
+void sim_set_trace(sim_t s, int mask);
+
+/*
+ * Write a binary trace (see sstrace.h) of every instruction run from
+ * now on to file, or stop if file is NULL.  Stopping returns FALSE if
+ * any of the trace couldn't be written.  Stop before closing file.
+ */
+bool_t sim_set_trace_file(sim_t s, FILE *file);
+
+/*
+ * Execute one instruction on the SEQ model.  Return its status.  Like
+ * the hardware, the model leaves the register and memory writes of
+ * the instruction pending until the next one starts.
+ */
+byte_t sim_step(sim_t s);
+
+/* Apply the writes left pending by the last instruction executed */
+void sim_commit(sim_t s);
+
+/*
+  Run processor until one of following occurs:
+  - An status error is encountered
+  - max_instr instructions have completed
+
+  Return number of instructions executed.
+  if statusp nonnull, then will be set to status of final instruction
+*/
+word_t sim_run(sim_t s, word_t max_instr, byte_t *statusp);
+
+/*
+ * Same as sim_run on the SEQ model, stepping the ISA model in isa
+ * alongside it and comparing what each instruction changed.  Stops at
+ * the first difference, which is reported on stdout, and clears *okp.
+ */
+word_t sim_run_checked(sim_t s, word_t max_instr, byte_t *statusp,
+		       state_ptr isa, bool_t *okp);
+
+/*
+ * State of the simulator.  Writes still pending (see sim_commit) are
+ * not included.  The memory and register file returned belong to the
+ * simulator.
+ */
+word_t sim_get_pc(sim_t s);
+word_t sim_get_reg(sim_t s, reg_id_t id);
+mem_t sim_get_mem(sim_t s);
+mem_t sim_get_regs(sim_t s);
+byte_t sim_get_status(sim_t s);
+
+/* Start the next instruction at pc */
+void sim_set_pc(sim_t s, word_t pc);
+
+/* Print cache and engine statistics */
+void sim_report(sim_t s, FILE *outfile);
+
+/* What the program did while being counted */
+typedef struct {
+    long long instrs;		/* Instructions run */
+    long long ops[NUM_INSTR+1];	/* Of each kind in instruction_set, and
+				   the rest in ops[NUM_INSTR] */
+    long long loads;
+    long long stores;
+    long long taken;		/* Conditional branches taken */
+    long long not_taken;	/* Conditional branches not taken */
+    long long jal;
+    long long jalr;
+    long long code_pages;	/* Distinct pages instructions came from */
+    long long data_pages;	/* Distinct pages loaded from or stored to */
+} sim_counters_rec, *sim_counters_ptr;
+
+/*
+ * Start counting what the program does, from zero, or stop if on is
+ * FALSE.  The counting is done by the same copies of the engine loops
+ * as tracing, so the jit engine compiles nothing while counting.
+ */
+void sim_set_counting(sim_t s, bool_t on);
+
+/* Fill in *c with the counts so far.  Return FALSE if not counting */
+bool_t sim_get_counters(sim_t s, sim_counters_ptr c);
+
+/*
+ * Start profiling from scratch, or stop if on is FALSE.  The profile
+ * counts the runs of each pc, and which call stack they ran in.  Calls
+ * are jal and jalr that link to ra, and returns are jalr x0 to ra.
+ * Nothing is compiled while profiling.
+ */
+void sim_set_profiling(sim_t s, bool_t on);
+
+/*
+ * Write the profile as folded stacks, as taken by flamegraph.pl: a line
+ * for each call stack instructions ran in, giving the functions in it
+ * from the outermost, separated by semicolons, and the instructions
+ * run.  Functions are named by the labels loaded.  Return FALSE if not
+ * profiling.
+ */
+bool_t sim_write_folded(sim_t s, FILE *out);
+
+/*
+ * Write the profile as a listing of every pc run, in order of address,
+ * with its runs, the percentage of all instructions and the instruction
+ * there now, headed by any labels.  Return FALSE if not profiling.
+ */
+bool_t sim_write_profile(sim_t s, FILE *out);
+
+/*
+ * Cycles taken by the pipe engine, which models a five-stage pipeline.
+ * Every cycle either retires an instruction or a bubble, or waits for
+ * the caches if they are being simulated, so cycles is instrs plus the
+ * bubbles of each cause plus cache_stall.
+ */
+typedef struct {
+    long long cycles;
+    long long instrs;		/* Instructions retired */
+    long long fill;		/* Bubbles from starting with an empty pipeline */
+    long long load_use;		/* from stalling for the result of a load */
+    long long mispredict;	/* from fetching past a branch or jump wrongly */
+    long long refetch;		/* from fetching an instruction again after a
+				   store changed it */
+    long long mispredicts;	/* Branches and jumps fetched past wrongly */
+    long long cache_stall;	/* Cycles waiting for a cache past a hit in
+				   one */
+} sim_pipe_stats_rec, *sim_pipe_stats_ptr;
+
+/*
+ * Fill in *p with the cycles so far.  Return FALSE if the pipe engine
+ * hasn't run.
+ */
+bool_t sim_get_pipe_stats(sim_t s, sim_pipe_stats_ptr p);
+
+/* Most direction predictors run side by side */
+#define SIM_MAX_PREDICTORS 8
+
+/*
+ * Predict branches and jumps with the predictors listed in spec,
+ * comma-separated from static (backward taken, forward not), bimodal,
+ * gshare and tournament (bimodal and gshare with a chooser), each
+ * optionally followed by :n for n two-bit counters per table (default
+ * 4096).  btb=n[:w] sets the branch target buffer to n entries in sets
+ * of w (default 512:4, 0 for none) and ras=n the return address stack
+ * to n entries (default 16, 0 for none).  Any n can end in K or M.
+ * Every predictor is scored on every conditional branch; the first one
+ * listed is the one the pipe engine fetches by.  NULL stops predicting.
+ * Return FALSE, predicting nothing, if spec isn't understood.  Nothing
+ * is compiled while predicting.
+ */
+bool_t sim_set_predictors(sim_t s, const char *spec);
+
+/*
+ * How the predictors did.  Targets of taken branches and jumps come
+ * from the BTB, except returns (jalr x0 to ra) which come from the RAS.
+ */
+typedef struct {
+    int npred;
+    char names[SIM_MAX_PREDICTORS][24];	/* As "gshare:4096" */
+    long long misses[SIM_MAX_PREDICTORS];	/* Directions guessed wrong */
+    long long branches;		/* Conditional branches */
+    long long btb_lookups;	/* Taken branches and jumps other than returns */
+    long long btb_misses;	/* of them whose target the BTB didn't have */
+    long long returns;
+    long long ras_misses;	/* Returns whose target the RAS didn't have */
+    int btb_entries;
+    int btb_ways;
+    int ras_entries;
+} sim_bpred_stats_rec, *sim_bpred_stats_ptr;
+
+/* Fill in *p with the scores so far.  Return FALSE if not predicting */
+bool_t sim_get_bpred_stats(sim_t s, sim_bpred_stats_ptr p);
+
+/*
+ * Write every conditional branch run, in order of address, with its
+ * runs, how often it was taken and how often each predictor guessed it
+ * wrong.  Return FALSE if not predicting.
+ */
+bool_t sim_write_branches(sim_t s, FILE *out);
+
+/* Replacement policies of a cache */
+typedef enum {
+    CACHE_LRU, CACHE_PLRU, CACHE_RANDOM
+} cache_repl_t;
+
+/*
+ * Simulate caches as described by spec: a comma-separated list of
+ * l1i, l1d and l2, each optionally followed by =size[:ways[:line
+ * [:latency]]] (size in bytes with an optional K or M, the line in
+ * bytes and the latency of a hit in cycles) and by any of :lru, :plru
+ * or :random for the replacement policy and :wb or :wt for
+ * write-back, allocating on a write miss, or write-through, not
+ * allocating.  mem=n sets the cycles to memory.  The L1 instruction
+ * and data caches are always there, 16K:2:32:1 and 16K:4:32:1 unless
+ * given, both LRU and the data cache write-back; the L2, 256K:8:64:10
+ * LRU write-back by default, is only there if given, and is shared by
+ * both.  Memory takes 100 cycles by default.  NULL stops simulating
+ * caches.  Return FALSE, simulating none, if spec isn't understood.
+ * Nothing is compiled while simulating caches.
+ */
+bool_t sim_set_caches(sim_t s, const char *spec);
+
+/* How one cache is laid out, and how it did */
+typedef struct {
+    char name[4];		/* "L1I", "L1D" or "L2" */
+    long long size;		/* In bytes */
+    int ways;
+    int line;			/* Bytes in a line */
+    int repl;			/* cache_repl_t */
+    bool_t write_back;
+    int latency;		/* Cycles for a hit */
+    long long accesses;
+    long long misses;
+    long long writebacks;	/* Dirty lines written to the next level */
+    long long miss_cycles;	/* Cycles its accesses took past a hit */
+} sim_cache_level_rec;
+
+typedef struct {
+    int ncaches;		/* 2, or 3 with an L2 */
+    sim_cache_level_rec c[3];	/* L1I, L1D and L2 */
+    int mem_latency;
+} sim_cache_stats_rec, *sim_cache_stats_ptr;
+
+/*
+ * Fill in *p with what the caches did so far.  Instruction fetches
+ * are L1I accesses, one per instruction.  Return FALSE if not
+ * simulating caches.
+ */
+bool_t sim_get_cache_stats(sim_t s, sim_cache_stats_ptr p);
+
+/* Most harts sim_set_harts allows */
+#define SIM_MAX_HARTS 256
+
+/*
+ * Run n harts sharing the memory of s, which becomes hart 0: the
+ * others start with copies of its registers and pc, except that a0
+ * holds the number of each, and use its engine.  They are freed with
+ * s, or when n is 1, or when s loads, resizes or resets its memory.
+ * Hart 0 is the only one that traces, counts, profiles, predicts or
+ * simulates caches.  Return FALSE if n is out of range.
+ */
+bool_t sim_set_harts(sim_t s, int n);
+
+/* Hart n of s, to look at after a run, or NULL if there is none */
+sim_t sim_get_hart(sim_t s, int n);
+
+/*
+ * Run each hart of s on a host thread of its own until it halts, fails
+ * or has run max_instr instructions.  With quantum > 0 the harts take
+ * turns, in order, quantum instructions at a time, so every run comes
+ * out the same.  With quantum 0 they all run at once, as fast as the
+ * host allows, and only atomics and fences order what they do to
+ * memory.  Code one hart writes is only picked up by another after it
+ * runs fence.i.  If icounts and statuses are nonNULL, they get the
+ * instructions run and the final status of each hart.  Return the
+ * instructions run by all of them.
+ */
+long long sim_run_harts(sim_t s, word_t quantum, word_t max_instr,
+			word_t *icounts, byte_t *statuses);
+
+/*
+ * Run every .yo file in directory (or listed in manifest) src on
+ * nworkers processes using engine and mem_size bytes of memory,
+ * writing status, instruction count and final state hash of each to
+ * outname.  Return the exit status: 1 if any program couldn't be
+ * loaded or the results couldn't be written, 0 otherwise.
+ */
+int sim_batch(char *src, int nworkers, char *outname,
+	      char *engine, long long mem_size, word_t max_instr);
@@ -1,76 +1,553 @@
-
 /********** Defines **************/
 
+/*
+ * Per-instruction handlers selected at decode time.  The other engines
+ * leave those up to H_FENCE to sim_step.
+ */
+typedef enum {
+    H_BAD, H_HALT, H_AMO, H_FENCE, H_CSR, H_LUI, H_AUIPC, H_JAL, H_JALR,
+    H_BEQ, H_BNE, H_BLT, H_BGE, H_BLTU, H_BGEU, H_BNONE,
+    H_LW, H_LSTALE, H_SW,
+    H_ADDI, H_SLLI, H_SLTI, H_SLTIU, H_XORI, H_SRLI, H_SRAI, H_ORI, H_ANDI,
+    H_ADD, H_SUB, H_SLL, H_SLT, H_SLTU, H_XOR, H_SRL, H_SRA, H_OR, H_AND,
+    H_NUM
+} handler_t;
+
+/*
+ * Decoded form of one instruction word.  Binary traces copy icode
+ * through rd as they lie (see TRACE_FIELDS in sstrace.h)
+ */
+typedef struct {
+    word_t tag;      /* PC of the cached instruction, -1 if empty */
+    word_t valc;     /* Sign-extended immediate */
+    byte_t icode;
+    byte_t ifun1;
+    byte_t ifun2;
+    byte_t rs1;
+    byte_t rs2;
+    byte_t rd;
+    byte_t handler;  /* handler_t */
+    byte_t op;       /* Index in instruction_set, NUM_INSTR if none */
+} decode_rec, *decode_ptr;
+
+/* Predecode cache, direct mapped on the instruction address */
+#define PREDECODE_SIZE (1<<14)
+
+/* Block engine state, private to ssim-block.c */
+struct block_cache_rec;
+
+/* Native code buffer, private to ssim-jit.c */
+struct jit_buf_rec;
+
+/* Registers and pc at a checkpoint, private to ssim-simple.c */
+struct sim_ckpt_rec;
+
+/* Binary trace being written (sstrace.h) */
+struct trace_writer_rec;
+
+/* Branch predictors, private to ssim-bpred.c */
+struct bpred_rec;
+
+/*
+ * Counts kept while counting (sim_set_counting).  instrs, jal and jalr
+ * are worked out from ops when asked for.
+ */
+typedef struct {
+    sim_counters_rec c;
+    byte_t *code_seen;		/* Bit per page, set once fetched from */
+    byte_t *data_seen;		/* Bit per page, set once loaded or stored */
+} count_rec, *count_ptr;
+
+/* Count the page holding address a, if it isn't set in seen yet */
+static inline void count_page(byte_t *seen, long long *n, word_t a)
+{
+    uword_t p = (uword_t) a >> PAGE_BITS;
+    if (!(seen[p >> 3] & (1 << (p & 7)))) {
+	seen[p >> 3] |= 1 << (p & 7);
+	(*n)++;
+    }
+}
+
+/* Count the decoded instruction d, run from address a */
+static inline void count_instr(count_ptr k, decode_ptr d, word_t a)
+{
+    k->c.ops[d->op]++;
+    count_page(k->code_seen, &k->c.code_pages, a);
+}
+
+/* Count a conditional branch */
+static inline void count_branch(count_ptr k, bool_t taken)
+{
+    if (taken)
+	k->c.taken++;
+    else
+	k->c.not_taken++;
+}
+
+/* Count the load or store of the word at a */
+static inline void count_data(count_ptr k, word_t a, bool_t store)
+{
+    if (store)
+	k->c.stores++;
+    else
+	k->c.loads++;
+    count_page(k->data_seen, &k->c.data_pages, a);
+    count_page(k->data_seen, &k->c.data_pages, a + 3);
+}
+
+/*
+ * An open-addressed table of the indexes of records in an array, by the
+ * hash of their keys, kept no more than half full (ssim-profile.c).
+ * Callers probe from hash_first with hash_next until an empty slot,
+ * comparing keys themselves, and add a new index at that slot.
+ */
+typedef struct {
+    int n;			/* Index of the record, -1 if empty */
+    unsigned hash;		/* Hash of its key */
+} hash_slot_rec, *hash_slot_ptr;
+
+typedef struct {
+    hash_slot_ptr slots;
+    unsigned mask;		/* Slots, less one */
+    int count;			/* Indexes held */
+} hash_index_rec, *hash_index_ptr;
+
+/* Start h empty, with size slots, a power of two */
+void hash_init(hash_index_ptr h, int size);
+
+/* Put index n, with hash, in the empty slot e, growing h if need be */
+void hash_add(hash_index_ptr h, hash_slot_ptr e, int n, unsigned hash);
 
-/************ Global state declaration ****************/
+/* The first slot of h to look in for hash */
+static inline hash_slot_ptr hash_first(hash_index_ptr h, unsigned hash)
+{
+    return &h->slots[hash & h->mask];
+}
 
+/* The slot of h to look in after e */
+static inline hash_slot_ptr hash_next(hash_index_ptr h, hash_slot_ptr e)
+{
+    return &h->slots[(e - h->slots + 1) & h->mask];
+}
 
-/* Both instruction and data memory */
-extern mem_t mem;
+/* Profile kept while profiling (sim_set_profiling), see ssim-profile.c */
+typedef struct prof_rec {
+    long long **pcs;		/* Runs of each pc, a page of them at a time */
+    long long *self;		/* Instructions run in the current stack */
+    struct prof_node_rec *nodes;	/* Call stacks, node 0 is the outermost */
+    int nnodes;
+    int maxnodes;
+    int cur;			/* Node of the current call stack */
+    hash_index_rec index;	/* Nodes by parent and function */
+    struct prof_frame_rec *stack;	/* Calls not yet returned from */
+    int depth;
+} prof_rec, *prof_ptr;
 
-/* Keep track of range of addresses that have been written */
-//extern word_t minAddr;
-//extern word_t memCnt;
+/* Allocate the counters of the page holding pc */
+long long *profile_page(prof_ptr p, word_t pc);
 
-/* Register file */
-extern mem_t reg;
+/* Call target from pc, to return to ret */
+void profile_call(prof_ptr p, word_t target, word_t ret);
 
-/* Program counter */
-extern word_t pc;
+/* Return to target */
+void profile_return(prof_ptr p, word_t target);
 
-/* Intermdiate stage values that must be used by control functions */
-extern byte_t imem_icode;
-extern byte_t imem_ifun;
-extern byte_t icode;
-extern word_t ifun1;
-extern word_t ifun2;
-extern word_t rs1;
-extern word_t rs2;
-extern word_t rd;
-extern word_t valc;
-extern word_t valp;
-extern bool_t imem_error;
-extern bool_t instr_valid;
-extern word_t vala;
-extern word_t valb;
-extern word_t vale;
-extern bool_t bcond;
-extern bool_t cond;
-extern word_t valm;
-extern bool_t dmem_error;
-extern byte_t status;
+/* Count a run of the instruction at pc */
+static inline void profile_instr(prof_ptr p, word_t pc)
+{
+    long long *c = p->pcs[(uword_t) pc >> PAGE_BITS];
+    if (!c)
+	c = profile_page(p, pc);
+    c[(pc & PAGE_MASK) >> 2]++;
+    (*p->self)++;
+}
 
-/* Log file */
-extern FILE *dumpfile;
+/* Print the instruction d at pc in assembler form */
+void print_instr(FILE *out, decode_ptr d, word_t pc);
 
+/* Follow the jal or jalr d at pc, which went to target */
+static inline void profile_jump(prof_ptr p, decode_ptr d, word_t pc,
+				word_t target)
+{
+    if (d->rd == REG_X1)
+	profile_call(p, target, pc + 4);
+    else if (d->icode == I_JALR && d->rd == REG_X0 && d->rs1 == REG_X1)
+	profile_return(p, target);
+}
 
-/* Sets the simulator name (called from main routine in HCL file) */
-void set_simname(char *name);
+/* One cache of the hierarchy kept while simulating caches (ssim-cache.c) */
+typedef struct cache_level_rec {
+    uword_t *tags;		/* Line held by each way, a set at a time */
+    byte_t *flags;		/* CL_VALID and CL_DIRTY of each way */
+    unsigned long long *used;	/* LRU: when each way was last used */
+    unsigned long long *tree;	/* PLRU: tree bits of each set */
+    int ways;
+    uword_t set_mask;
+    int line_bits;
+    byte_t repl;		/* cache_repl_t */
+    bool_t write_back;		/* Else write-through, without allocating */
+    int latency;		/* Cycles for a hit */
+    int miss_latency;		/* Cycles to memory, if next is NULL */
+    uword_t last;		/* Line last accessed, which hits again */
+    int last_way;		/* Where it is */
+    unsigned long long clock;
+    unsigned seed;
+    sim_cache_level_rec st;
+    struct cache_level_rec *next;
+} cache_level_rec, *cache_level_ptr;
 
-/* Initialize simulator */
-void sim_init();
+typedef struct {
+    cache_level_rec l1i;
+    cache_level_rec l1d;
+    cache_level_rec l2;		/* Unused unless l1i and l1d lead to it */
+} cache_rec, *cache_ptr;
 
-/* Reset simulator state, including register, instruction, and data memories */
-void sim_reset();
+/* Read or write the word at a through cache l and those below it */
+void cache_access(cache_level_ptr l, word_t a, bool_t write);
+
+/* Fetch the instruction at pc through the instruction cache */
+static inline void cache_fetch(cache_ptr c, word_t pc)
+{
+    if (((uword_t) pc >> c->l1i.line_bits) == c->l1i.last)
+	c->l1i.st.accesses++;
+    else
+	cache_access(&c->l1i, pc, FALSE);
+}
+
+/* Load or store the word at a through the data cache */
+void cache_data(cache_ptr c, word_t a, bool_t write);
+
+/* Cycles the caches have taken so far past a one-cycle hit */
+long long cache_stall(cache_ptr c);
+
+/* Print how the caches did */
+void cache_report(sim_t s, FILE *outfile);
 
 /*
-  Run processor until one of following occurs:
-  - An status error is encountered
-  - max_instr instructions have completed
+ * Read a number from *p into *n, moving *p past it and any K or M
+ * after it.  Return FALSE if there isn't one.  Cache and branch
+ * predictor specs are read with it.
+ */
+bool_t parse_number(const char **p, long long *n);
+
+static inline bool_t power_of_two(long long n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+/* Why a pipeline register holds a bubble */
+typedef enum {
+    BUB_FILL, BUB_LOAD, BUB_MISPREDICT, BUB_REFETCH
+} bubble_t;
+
+/* Contents of a pipeline register: an instruction or a bubble */
+typedef struct {
+    byte_t stat;	/* STAT_BUB for a bubble, else the fetch status */
+    byte_t cause;	/* bubble_t, for a bubble */
+    bool_t handoff;	/* Left to sim_step when it gets to writeback */
+    word_t pc;
+    word_t predpc;	/* Where fetch went after it */
+    decode_rec d;
+    word_t srcA;
+    word_t srcB;
+    word_t dstE;
+    word_t dstM;
+    word_t vala;
+    word_t valb;
+    word_t vale;
+    word_t valm;
+    bool_t cond;
+    word_t newpc;	/* Where it went, once executed */
+} pipe_reg_rec, *pipe_reg_ptr;
+
+/*
+ * Pipe engine state (ssim-pipe.c).  The pipeline registers are named
+ * for the stage they feed, and the signals computed during a cycle for
+ * the stage computing them, as in the control logic.
+ */
+typedef struct pipe_rec {
+    word_t F_predPC;
+    pipe_reg_rec D, E, M, W;
+
+    word_t f_pc;
+    decode_rec f;	/* Instruction fetched */
+    word_t f_bpredPC;	/* Where the branch predictors would go next */
+    word_t d_srcA;
+    word_t d_srcB;
+    word_t e_dstE;
+    word_t e_valE;
+    word_t e_target;	/* Where the instruction in execute really goes */
+    word_t m_valM;
+
+    word_t vale;	/* vale of the last instruction executed */
+    word_t issued;	/* Instructions of the run past decode */
+    word_t last;	/* Those past decode before the last of the run */
+    bool_t stopped;	/* Nothing more to fetch this run */
+    sim_pipe_stats_rec st;
+} pipe_rec, *pipe_ptr;
 
-  Return number of instructions executed.
-  if statusp nonnull, then will be set to status of final instruction
-  if ccp nonnull, then will be set to condition codes of final instruction
-*/
-word_t sim_run(word_t max_instr, byte_t *statusp);
 
-/* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *file);
+/************ Simulator state ****************/
+
+/*
+ * Everything belonging to one simulator.  Users of the library only
+ * see a sim_t handle (libssim.h); the engines and the control logic
+ * work on the fields directly.
+ */
+struct sim_rec {
+    /* Both instruction and data memory */
+    mem_t mem;
+
+    /* Register file */
+    mem_t reg;
+
+    /* Program counter */
+    word_t pc;
+    word_t pc_in;
+
+    /* Intermdiate stage values that must be used by control functions */
+    byte_t icode;
+    word_t ifun1;
+    word_t ifun2;
+    word_t instr;
+    word_t rs1;
+    word_t rs2;
+    word_t rd;
+    word_t valc;
+    word_t valp;
+    bool_t imem_error;
+    bool_t instr_valid;
+    word_t srcA;
+    word_t srcB;
+    word_t destE;
+    word_t destM;
+    word_t vala;
+    word_t valb;
+    word_t vale;
+    bool_t cond;
+    word_t valm;
+    bool_t dmem_error;
+    bool_t mem_write;
+    word_t mem_addr;
+    word_t mem_data;
+    byte_t status;
+
+    /* Log file, and the trace categories written to it */
+    FILE *dumpfile;
+    int trace;
+
+    /* Binary trace, NULL unless one is being written */
+    struct trace_writer_rec *btrace;
+
+    /* Counts, NULL unless counting */
+    count_ptr counts;
+
+    /* Profile, NULL unless profiling */
+    prof_ptr prof;
+
+    /* Branch predictors, NULL unless predicting */
+    struct bpred_rec *bpred;
+
+    /* Caches, NULL unless simulating them */
+    cache_ptr cache;
+
+    /* Labels of the program loaded */
+    symtab_t syms;
+
+    /* Engine used by sim_run, index in the engine table */
+    int engine;
+
+    /* Predecode cache and its statistics */
+    decode_ptr predecode;
+    long long predecode_hits;
+    long long predecode_misses;
+    long long predecode_invalidations;
+    decode_rec unaligned_rec;	/* Misaligned PCs aren't cached */
+    decode_rec fetch_error_rec;	/* Decoded form of an unfetchable word */
+    decode_rec peek_rec;	/* Decoded by peek_decoded, uncached */
+
+    /* Pipe engine, NULL until it first runs */
+    pipe_ptr pipe;
+
+    /* Block engine, NULL until first flushed */
+    struct block_cache_rec *blocks;
+
+    /* Native code, NULL until something is compiled */
+    struct jit_buf_rec *jit;
+    long long jit_compiled;
+    long long jit_rejected;
+
+    /* Checkpoints, numbered the same as those of mem */
+    struct sim_ckpt_rec *ckpts;
+    int nckpts;
+    int maxckpts;
+
+    /* Harts sharing mem (ssim-smp.c): all of them, hart 0 first, in
+       hart 0, which owns mem, and NULL if it is the only one */
+    struct sim_rec **harts;
+    int nharts;
+    int hartid;
+
+    /* Reservation made by lr.w, and whether the last atomic stored */
+    bool_t resv;
+    word_t resv_addr;
+    word_t resv_val;
+    bool_t amo_write;
+};
+
+
+/************ Control logic (hcl.c) ****************/
+
+long long gen_need_ifun1(sim_t s);
+long long gen_need_ifun2(sim_t s);
+long long gen_need_rs1(sim_t s);
+long long gen_need_rs2(sim_t s);
+long long gen_need_rd(sim_t s);
+long long gen_need_valC(sim_t s);
+long long gen_instr_valid(sim_t s);
+long long gen_srcA(sim_t s);
+long long gen_srcB(sim_t s);
+long long gen_dstE(sim_t s);
+long long gen_dstM(sim_t s);
+long long gen_aluA(sim_t s);
+long long gen_aluB(sim_t s);
+long long gen_mem_addr(sim_t s);
+long long gen_mem_data(sim_t s);
+long long gen_mem_read(sim_t s);
+long long gen_mem_write(sim_t s);
+long long gen_Stat(sim_t s);
+long long gen_new_pc(sim_t s);
+long long gen_f_predPC(sim_t s);
+long long gen_d_valA(sim_t s);
+long long gen_d_valB(sim_t s);
+long long gen_d_handoff(sim_t s);
+long long gen_load_use(sim_t s);
+long long gen_e_mispredict(sim_t s);
+long long gen_D_stall(sim_t s);
+long long gen_D_bubble(sim_t s);
+long long gen_E_bubble(sim_t s);
+
+
+/************ Engines ****************/
+
+/* Return decoded instruction at address a.  Sets imem_error on failure */
+decode_ptr fetch_decoded(sim_t s, word_t a);
+
+/*
+ * Same as fetch_decoded, but only looks: nothing is counted, cached or
+ * flagged, so listing the code after a run doesn't change its report
+ */
+decode_ptr peek_decoded(sim_t s, word_t a);
+
+/* Drop any cached decodings of the 4 bytes starting at a */
+void predecode_invalidate(sim_t s, word_t a);
+
+/* Same as sim_run, on the SEQ model */
+word_t sim_run_seq(sim_t s, word_t max_instr, byte_t *statusp);
+
+/* Same as sim_run, using the threaded-code dispatch engine */
+word_t sim_run_threaded(sim_t s, word_t max_instr, byte_t *statusp);
+
+/* Same as sim_run, using the basic-block engine */
+word_t sim_run_block(sim_t s, word_t max_instr, byte_t *statusp);
+
+/* Drop any translated blocks containing the 4 bytes starting at a */
+void block_invalidate(sim_t s, word_t a);
+
+/* Throw away every translated block */
+void block_flush(sim_t s);
+
+/* Free the block engine state */
+void block_free(sim_t s);
+
+/* Print block cache statistics */
+void block_report(sim_t s, FILE *outfile);
+
+/* Same as sim_run, compiling hot blocks to native code */
+word_t sim_run_jit(sim_t s, word_t max_instr, byte_t *statusp);
+
+/* Print block cache and native code statistics */
+void jit_report(sim_t s, FILE *outfile);
+
+/*
+ * Score and train the branch predictors on the branch or jump d at pc,
+ * which went to next, taken or not.  Anything else is ignored.
+ */
+void bpred_update(struct bpred_rec *b, decode_ptr d, word_t pc,
+		  bool_t taken, word_t next);
+
+/* Where the first predictor expects d, fetched from pc, to go next */
+word_t bpred_predict(struct bpred_rec *b, decode_ptr d, word_t pc);
+
+/* Print how the branch predictors did */
+void bpred_report(sim_t s, FILE *outfile);
+
+/*
+ * Do the atomic f5 (the top five bits of an A extension instruction)
+ * of hart s on the word at a, with src from rs2, as one host atomic.
+ * Set *valp to what rd gets, and s->amo_write if memory was written.
+ * Return FALSE if a isn't an aligned address in memory.
+ */
+bool_t amo_exec(sim_t s, int f5, word_t a, word_t src, word_t *valp);
+
+/* Same as sim_run, on the five-stage pipeline model */
+word_t sim_run_pipe(sim_t s, word_t max_instr, byte_t *statusp);
+
+/* Print cycle statistics of the pipeline */
+void pipe_report(sim_t s, FILE *outfile);
+
+/* Free the pipe engine state */
+void pipe_free(sim_t s);
+
+/* Arguments and results of a call to compiled code */
+typedef struct {
+    word_t pc;		/* Out: address to continue at */
+    word_t vale;	/* In/out: value of vale */
+    word_t done;	/* Out: instructions completed */
+    word_t pad;
+    byte_t *regs;	/* Register file contents */
+    byte_t *mem;	/* Page table of the memory */
+    byte_t *wmem;	/* Page table of the memory for writing */
+    uword_t limit;	/* Highest address a word can be accessed at */
+    sim_t sim;		/* Simulator running the code */
+} jit_ctx_rec, *jit_ctx_ptr;
+
+/* Ways out of compiled code */
+typedef enum {
+    JIT_FALL,		/* Fell through or branch not taken */
+    JIT_TAKEN,		/* Branch or jump taken */
+    JIT_BAIL,		/* Instruction done needs the interpreter */
+    JIT_STALE		/* A store rewrote the block */
+} jit_exit_t;
+
+typedef int (*jit_fn)(jit_ctx_ptr ctx);
+
+/* Compile n predecoded instructions and the record closing them */
+jit_fn jit_compile(sim_t s, decode_ptr rec, int n);
+
+/* Throw away all compiled code */
+void jit_flush(sim_t s);
+
+/* Free the native code buffer */
+void jit_free(sim_t s);
+
+/* Called by compiled code after a store to a */
+int jit_store(jit_ctx_ptr ctx, word_t a);
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... );
+void sim_log(sim_t s, const char *format, ... );
+
+/* Is trace category cat (one of TRACE_* in libssim.h) being logged? */
+#define TRACE_ON(s, cat) ((s)->dumpfile && ((s)->trace & (cat)))
+
+/* Log the fetch of decoded instruction d from address a */
+void sim_log_fetch(sim_t s, decode_ptr d, word_t a);
+
+/* Log the write of val to register id */
+void sim_log_reg(sim_t s, reg_id_t id, word_t val);
 
-								       
+/* Log the branch or jump at a, which went to target if taken */
+void sim_log_branch(sim_t s, word_t a, bool_t taken, word_t target);
@@ -0,0 +1,349 @@
+/***********************************************************************
+ *
+ * ssbench.c - Time the engines on the benchmark kernels
+ *
+ * Runs each kernel in bench/ (or each .yo file named) on each engine
+ * and prints the instructions it ran, the host time, the simulated
+ * MIPS and the peak RSS.  Every run is made in a child process of its
+ * own, so its peak RSS is its own.  The engines must agree on how many
+ * instructions each kernel runs and the registers it leaves behind.
+ * -o writes the results to a file, and -b compares a run against such
+ * a file, failing if any kernel got slower on any engine by more than
+ * the threshold.  Build with
+ *
+ *     gcc -O2 -o ssbench ssbench.c libssim.a -lpthread
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "isa.h"
+#include "libssim.h"
+
+#define MAXNAME 4096
+#define MAXENGINES 16
+
+/* Result of running one kernel on one engine */
+typedef struct {
+    int status;			/* stat_t, or -1 if it couldn't be run */
+    word_t icount;
+    unsigned long long hash;	/* Of the final pc and registers */
+    double secs;		/* Host time of the fastest run */
+    long rss_kb;		/* Peak RSS of the largest run */
+} bench_result;
+
+static char **kernels = NULL;
+static int kernel_cnt = 0;
+static char *engines[MAXENGINES];
+static int engine_cnt = 0;
+
+static long long mem_size = 1 << 20;
+static word_t instr_limit = 1000000000;
+static int reps = 1;
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-e engines] [-l m] [-m size] [-r n] [-o out] [-b base]\n"
+	   "       [-t pct] [kernel.yo|dir ...]\n", name);
+    printf("   -e l   Time engines l, comma-separated (default seq,threaded,\n"
+	   "          block,jit,pipe)\n");
+    printf("   -l m   Stop each kernel after m instructions (default %d)\n",
+	   instr_limit);
+    printf("   -m s   Give each kernel s bytes of memory (default 1M)\n");
+    printf("   -r n   Keep the fastest of n runs of each kernel (default 1)\n");
+    printf("   -o f   Write the results to f as well\n");
+    printf("   -b f   Compare with results written earlier with -o to f\n");
+    printf("   -t p   Fail if any run got more than p%% slower (default 10)\n");
+    printf("Kernels default to every .yo file in bench\n");
+    exit(0);
+}
+
+static void add_kernel(char *name)
+{
+    static int kernel_max = 0;
+    if (kernel_cnt == kernel_max) {
+	kernel_max = kernel_max ? 2*kernel_max : 16;
+	kernels = (char **) realloc(kernels, kernel_max * sizeof(char *));
+    }
+    kernels[kernel_cnt++] = strdup(name);
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/* Add the .yo files in directory src, or src itself if it's a file */
+static void add_kernels(char *src)
+{
+    char buf[MAXNAME];
+    struct dirent *ent;
+    DIR *dir;
+    int first = kernel_cnt;
+
+    if ((dir = opendir(src)) == NULL) {
+	add_kernel(src);
+	return;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+	int len = strlen(ent->d_name);
+	if (len > 3 && !strcmp(ent->d_name + len - 3, ".yo")) {
+	    snprintf(buf, MAXNAME, "%s/%s", src, ent->d_name);
+	    add_kernel(buf);
+	}
+    }
+    closedir(dir);
+    qsort(kernels + first, kernel_cnt - first, sizeof(char *), cmp_names);
+}
+
+/* Name of kernel k without its directory or .yo */
+static char *kernel_name(char *k)
+{
+    static char buf[MAXNAME];
+    char *p = strrchr(k, '/');
+    int len;
+
+    snprintf(buf, MAXNAME, "%s", p ? p + 1 : k);
+    len = strlen(buf);
+    if (len > 3 && !strcmp(buf + len - 3, ".yo"))
+	buf[len - 3] = '\0';
+    return buf;
+}
+
+/* FNV-1a hash of the final pc and registers of s */
+static unsigned long long hash_regs(sim_t s)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    word_t v;
+    int i, j;
+
+    for (i = 0; i <= REG_X31 + 1; i++) {
+	v = i <= REG_X31 ? sim_get_reg(s, (reg_id_t) i) : sim_get_pc(s);
+	for (j = 0; j < 4; j++) {
+	    h ^= (v >> (8*j)) & 0xff;
+	    h *= 0x100000001b3ULL;
+	}
+    }
+    return h;
+}
+
+/* Run kernel on engine in this process, writing the result to fd */
+static void run_child(char *kernel, char *engine, int fd)
+{
+    bench_result res;
+    struct timeval t0, t1;
+    byte_t status = STAT_AOK;
+    sim_t s = sim_create();
+    FILE *f;
+
+    memset(&res, 0, sizeof(res));
+    res.status = -1;
+    if (sim_set_engine(s, engine) && sim_set_mem_size(s, mem_size) &&
+	(f = fopen(kernel, "r")) != NULL) {
+	if (sim_load(s, f, 0) > 0) {
+	    gettimeofday(&t0, NULL);
+	    res.icount = sim_run(s, instr_limit, &status);
+	    gettimeofday(&t1, NULL);
+	    /* What a faulting instruction left pending differs by engine */
+	    if (status == STAT_AOK)
+		sim_commit(s);
+	    res.status = status;
+	    res.hash = hash_regs(s);
+	    res.secs = (t1.tv_sec - t0.tv_sec) +
+		(t1.tv_usec - t0.tv_usec) / 1e6;
+	}
+	fclose(f);
+    }
+    /* _exit, so the parent's buffered output isn't flushed twice */
+    _exit(write(fd, &res, sizeof(res)) != sizeof(res));
+}
+
+/* Run kernel on engine reps times, each in a child, into res */
+static void run_kernel(char *kernel, char *engine, bench_result *res)
+{
+    bench_result r;
+    struct rusage ru;
+    int fds[2], st, i;
+    pid_t pid;
+
+    for (i = 0; i < reps; i++) {
+	if (pipe(fds) < 0 || (pid = fork()) < 0) {
+	    perror("fork");
+	    exit(1);
+	}
+	if (pid == 0) {
+	    close(fds[0]);
+	    run_child(kernel, engine, fds[1]);
+	}
+	close(fds[1]);
+	if (read(fds[0], &r, sizeof(r)) != sizeof(r))
+	    r.status = -1;
+	close(fds[0]);
+	if (wait4(pid, &st, 0, &ru) < 0 || !WIFEXITED(st) ||
+	    WEXITSTATUS(st) != 0)
+	    r.status = -1;
+	if (i == 0 || r.status != res->status || r.secs < res->secs) {
+	    res->status = r.status;
+	    res->icount = r.icount;
+	    res->hash = r.hash;
+	    res->secs = r.secs;
+	}
+	if (i == 0 || ru.ru_maxrss > res->rss_kb)
+	    res->rss_kb = ru.ru_maxrss;
+	if (r.status < 0)
+	    return;
+    }
+}
+
+/*
+ * Look up the MIPS of kernel name on engine in baseline file base.
+ * Return a negative number if it isn't there.
+ */
+static double base_mips(FILE *base, char *name, char *engine)
+{
+    char buf[MAXNAME], k[MAXNAME], e[64];
+    double mips;
+
+    rewind(base);
+    while (fgets(buf, MAXNAME, base))
+	if (sscanf(buf, "%s %63s %*d %*s %*f %lf", k, e, &mips) == 3 &&
+	    !strcmp(k, name) && !strcmp(e, engine))
+	    return mips;
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    char *engine_list = "seq,threaded,block,jit,pipe";
+    char *out_name = NULL, *base_name = NULL;
+    FILE *out = NULL, *base = NULL;
+    double threshold = 10;
+    bench_result *res;
+    char *p;
+    int c, i, j, slower = 0, wrong = 0;
+
+    while ((c = getopt(argc, argv, "hb:e:l:m:o:r:t:")) != -1) {
+	switch (c) {
+	case 'b':
+	    base_name = optarg;
+	    break;
+	case 'e':
+	    engine_list = optarg;
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'm':
+	    mem_size = parse_mem_size(optarg);
+	    if (mem_size == 0) {
+		printf("Invalid memory size %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'o':
+	    out_name = optarg;
+	    break;
+	case 'r':
+	    reps = atoi(optarg);
+	    if (reps < 1) {
+		printf("Invalid number of runs %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 't':
+	    threshold = atof(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+
+    engine_list = strdup(engine_list);
+    for (p = strtok(engine_list, ","); p; p = strtok(NULL, ",")) {
+	sim_t s = sim_create();
+	if (engine_cnt == MAXENGINES || !sim_set_engine(s, p)) {
+	    printf("Invalid engine %s\n", p);
+	    usage(argv[0]);
+	}
+	sim_destroy(s);
+	engines[engine_cnt++] = p;
+    }
+    if (optind == argc)
+	add_kernels("bench");
+    for (i = optind; i < argc; i++)
+	add_kernels(argv[i]);
+    if (kernel_cnt == 0) {
+	fprintf(stderr, "No kernels found\n");
+	exit(1);
+    }
+
+    if (out_name && (out = fopen(out_name, "w")) == NULL) {
+	fprintf(stderr, "Couldn't open results file %s\n", out_name);
+	exit(1);
+    }
+    if (base_name && (base = fopen(base_name, "r")) == NULL) {
+	fprintf(stderr, "Couldn't open baseline file %s\n", base_name);
+	exit(1);
+    }
+
+    res = (bench_result *) calloc(engine_cnt, sizeof(bench_result));
+    printf("%-12s %-9s %12s %6s %8s %9s %8s\n", "kernel", "engine",
+	   "instructions", "status", "host s", "MIPS", "RSS MB");
+    if (out)
+	fprintf(out,
+		"# kernel engine instructions status host_s MIPS RSS_MB\n");
+    for (i = 0; i < kernel_cnt; i++) {
+	char *name = kernel_name(kernels[i]);
+	for (j = 0; j < engine_cnt; j++) {
+	    bench_result *r = &res[j];
+	    double mips, was;
+	    char line[MAXNAME];
+
+	    run_kernel(kernels[i], engines[j], r);
+	    mips = r->secs > 0 ? r->icount / r->secs / 1e6 : 0;
+	    snprintf(line, MAXNAME, "%-12s %-9s %12d %6s %8.3f %9.2f %8.1f",
+		     name, engines[j], r->icount,
+		     r->status < 0 ? "LOAD" : stat_name((stat_t) r->status),
+		     r->secs, mips, r->rss_kb / 1024.0);
+	    printf("%s\n", line);
+	    if (out)
+		fprintf(out, "%s\n", line);
+	    fflush(stdout);
+
+	    if (r->status < 0) {
+		wrong++;
+		continue;
+	    }
+	    if (j > 0 && (r->status != res[0].status ||
+			  r->icount != res[0].icount ||
+			  r->hash != res[0].hash)) {
+		printf("%s on %s ended differently from %s\n",
+		       name, engines[j], engines[0]);
+		wrong++;
+	    }
+	    if (base && (was = base_mips(base, name, engines[j])) > 0 &&
+		mips < was * (1 - threshold / 100)) {
+		printf("%s on %s got slower: %.2f MIPS, was %.2f (%+.1f%%)\n",
+		       name, engines[j], mips, was, (mips / was - 1) * 100);
+		slower++;
+	    }
+	}
+    }
+
+    if (out && fclose(out) != 0) {
+	fprintf(stderr, "Couldn't write results file %s\n", out_name);
+	exit(1);
+    }
+    if (base) {
+	fclose(base);
+	printf("%d of %d runs more than %g%% slower than %s\n",
+	       slower, kernel_cnt * engine_cnt, threshold, base_name);
+    }
+    return wrong || slower ? 1 : 0;
+}
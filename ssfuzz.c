@@ -0,0 +1,551 @@
+/***********************************************************************
+ *
+ * ssfuzz.c - Differential fuzzing of an engine against the ISA model
+ *
+ * Generates random programs from instruction_set[] and runs each on an
+ * engine (SEQ unless -e says otherwise) and on the ISA model, then
+ * compares the status, instructions run, registers and memory they end
+ * with.  Loads, stores and atomics go through s0, which points into a
+ * page of random data and is never written, and branches and jumps
+ * only go forward, so every program ends within its length.  Program
+ * k comes from seed k, and the seeds are shared out among threads, one
+ * per core.  The first seed whose runs differ is listed and replayed
+ * with sim_run_checked to find the instruction where they part, and
+ * can be saved as a snapshot to run with ssim -t.  Build with
+ *
+ *     gcc -O2 -o ssfuzz ssfuzz.c libssim.a -lpthread
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "isa.h"
+#include "libssim.h"
+
+#define FUZZ_MEM   0x2000	/* Code in the first page, data in the second */
+#define DATA_BASE  0x1000
+#define DATA_WORDS 512		/* Reachable from s0 with a 12-bit offset */
+#define BASE_REG   REG_X8	/* s0, holding DATA_BASE */
+#define MAXLEN     500		/* Keeps jalr targets in its 12-bit offset */
+
+/* A generated program and the state it starts in */
+typedef struct {
+    int len;
+    uword_t code[MAXLEN];
+    word_t regs[REG_X31 + 1];
+    word_t data[DATA_WORDS];
+} prog_rec, *prog_ptr;
+
+static instr_ptr choices[NUM_INSTR];	/* Instructions to generate from */
+static int choice_cnt = 0;
+
+static char *engine = "seq";
+static int prog_len = 200;
+static long long nprogs = 1000000;
+static unsigned long long first_seed = 1;
+
+/* Shared among the threads */
+static unsigned long long next_seed;
+static unsigned long long fail_seed = ~0ULL;	/* Lowest seed that differed */
+static long long total_instr = 0;
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-e engine] [-i len] [-j n] [-n progs] [-s seed]\n"
+	   "       [-x instrs] [-r seed] [-o snap]\n", name);
+    printf("   -e eng Compare engine eng with the ISA model (default seq)\n");
+    printf("   -i n   Generate programs of n instructions, up to %d\n"
+	   "          (default %d)\n", MAXLEN, prog_len);
+    printf("   -j n   Use n threads (default one per core)\n");
+    printf("   -n n   Run n programs, or 0 to run until one differs\n"
+	   "          (default %lld)\n", nprogs);
+    printf("   -s k   Start from seed k (default %llu)\n", first_seed);
+    printf("   -x l   Leave out instructions l, comma-separated\n");
+    printf("   -r k   Only list and check the program from seed k\n");
+    printf("   -o f   Write the program that differed to snapshot f\n");
+    exit(0);
+}
+
+/* xorshift64* */
+static unsigned long long rnd(unsigned long long *x)
+{
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+    return *x * 0x2545f4914f6cdd1dULL;
+}
+
+static int rnd_int(unsigned long long *x, int n)
+{
+    return (int) ((rnd(x) >> 32) % n);
+}
+
+/* A register value, often one near a boundary so compares can tie */
+static word_t rnd_val(unsigned long long *x)
+{
+    static const word_t edges[] =
+	{ 0, 1, -1, 2, 0x7fffffff, (word_t) 0x80000000, 31, 32 };
+    if (rnd_int(x, 4) == 0)
+	return edges[rnd_int(x, sizeof(edges) / sizeof(edges[0]))];
+    return (word_t) (rnd(x) >> 32);
+}
+
+/* Any register but s0 */
+static int rnd_rd(unsigned long long *x)
+{
+    int r = rnd_int(x, REG_X31);
+    return r >= BASE_REG ? r + 1 : r;
+}
+
+/* Encode instruction i at pc of a program len long */
+static uword_t gen_instr(unsigned long long *x, instr_ptr i, int pc, int len)
+{
+    uword_t rd = rnd_rd(x), rs1 = rnd_int(x, 32), rs2 = rnd_int(x, 32);
+    uword_t f3 = i->ifun1, op = i->code;
+    uword_t imm, target;
+
+    /* A target from the next instruction up to the halt at the end */
+    target = pc + 4 * (1 + rnd_int(x, len - pc / 4 < 16 ? len - pc / 4 : 16));
+
+    switch (op) {
+    case I_LUI:
+    case I_AUIPC:
+	return (uword_t) (rnd(x) >> 44) << 12 | rd << 7 | op;
+    case I_JAL:
+	imm = target - pc;
+	return (imm >> 20 & 1) << 31 | (imm >> 1 & 0x3ff) << 21 |
+	    (imm >> 11 & 1) << 20 | (imm >> 12 & 0xff) << 12 | rd << 7 | op;
+    case I_JALR:
+	return target << 20 | REG_X0 << 15 | rd << 7 | op;
+    case I_B:
+	imm = target - pc;
+	return (imm >> 12 & 1) << 31 | (imm >> 5 & 0x3f) << 25 | rs2 << 20 |
+	    rs1 << 15 | f3 << 12 | (imm >> 1 & 0xf) << 8 |
+	    (imm >> 11 & 1) << 7 | op;
+    case I_L:
+    case I_S:
+	/* Now and then an address anywhere, which most likely fails */
+	if (rnd_int(x, 32) == 0) {
+	    imm = rnd_int(x, 4096);
+	} else {
+	    rs1 = BASE_REG;
+	    imm = 4 * rnd_int(x, DATA_WORDS);
+	}
+	if (op == I_L)
+	    return imm << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+	return (imm >> 5) << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 |
+	    (imm & 0x1f) << 7 | op;
+    case I_OP:
+	if (f3 == 1 || f3 == 5)	/* Shifts */
+	    imm = i->ifun2 << 5 | rnd_int(x, 32);
+	else
+	    imm = rnd_int(x, 4096);
+	return imm << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+    case I_R:
+	return i->ifun2 << 25 | rs2 << 20 | rs1 << 15 | f3 << 12 | rd << 7 | op;
+    case I_AMO:
+	if (i->ifun2 == 0x08)	/* lr.w has no rs2 */
+	    rs2 = REG_X0;
+	return (i->ifun2 | rnd_int(x, 4)) << 25 | rs2 << 20 | BASE_REG << 15 |
+	    f3 << 12 | rd << 7 | op;
+    case I_FENCE:
+	if (f3 == 1)
+	    return f3 << 12 | op;
+	return rnd_int(x, 256) << 20 | f3 << 12 | op;
+    default:
+	return (uword_t) (rnd(x) >> 32);
+    }
+}
+
+/* Generate the program and starting state of seed */
+static void gen_prog(prog_ptr p, unsigned long long seed, int len)
+{
+    unsigned long long x = seed * 0x9e3779b97f4a7c15ULL | 1;
+    int i;
+
+    p->len = len;
+    for (i = 0; i < len; i++)
+	p->code[i] = gen_instr(&x, choices[rnd_int(&x, choice_cnt)],
+			       4 * i, len);
+    p->regs[REG_X0] = 0;
+    for (i = REG_X1; i <= REG_X31; i++)
+	p->regs[i] = rnd_val(&x);
+    p->regs[BASE_REG] = DATA_BASE;
+    for (i = 0; i < DATA_WORDS; i++)
+	p->data[i] = rnd_val(&x);
+}
+
+/* Set up memory m and registers r as p starts, halting after its end */
+static void load_prog(prog_ptr p, mem_t m, mem_t r)
+{
+    int i, j;
+
+    /* Instructions are fetched in the byte order of .yo files */
+    for (i = 0; i < p->len; i++)
+	for (j = 0; j < 4; j++)
+	    set_byte_val(m, 4 * i + j, p->code[i] >> (24 - 8 * j));
+    for (i = 0; i < DATA_WORDS; i++)
+	set_halfword_val(m, DATA_BASE + 4 * i, p->data[i]);
+    for (i = REG_X0; i <= REG_X31; i++)
+	set_reg_val(r, (reg_id_t) i, p->regs[i]);
+}
+
+/* Address of the first word a and b differ in, -1 if there is none */
+static word_t mem_diff(mem_t a, mem_t b)
+{
+    static byte_t zeros[PAGE_SIZE];
+    int i, j;
+
+    for (i = 0; i < a->npages; i++) {
+	byte_t *pa = a->pages[i] ? a->pages[i] : zeros;
+	byte_t *pb = b->pages[i] ? b->pages[i] : zeros;
+	if (pa == pb || !memcmp(pa, pb, PAGE_SIZE))
+	    continue;
+	for (j = 0; pa[j] == pb[j]; j++)
+	    ;
+	return i * PAGE_SIZE + (j & ~3);
+    }
+    return -1;
+}
+
+/* Start s and isa on p */
+static void start(sim_t s, state_ptr isa, prog_ptr p)
+{
+    sim_reset(s);
+    load_prog(p, sim_get_mem(s), sim_get_regs(s));
+    clear_mem(isa->m);
+    clear_mem(isa->r);
+    load_prog(p, isa->m, isa->r);
+    isa->pc = 0;
+    isa->resv = FALSE;
+}
+
+/*
+ * Run p on s and on isa.  Return TRUE if they end the same way, with
+ * the instructions s ran in *icountp.  If report is set, print how
+ * they differ.
+ */
+static bool_t run_prog(sim_t s, state_ptr isa, prog_ptr p, word_t *icountp,
+		       bool_t report)
+{
+    byte_t status;
+    stat_t isa_status = STAT_AOK;
+    word_t icount, n = 0, a, v1 = 0, v2 = 0;
+    bool_t same = TRUE;
+    int i;
+
+    start(s, isa, p);
+    icount = sim_run(s, p->len + 1, &status);
+    /* What a faulting instruction left pending differs between engines */
+    if (status == STAT_AOK)
+	sim_commit(s);
+    while (n < p->len + 1 && isa_status == STAT_AOK) {
+	isa_status = step_state(isa, NULL);
+	n++;
+    }
+    *icountp = icount;
+
+    if (icount != n || status != isa_status) {
+	if (!report)
+	    return FALSE;
+	printf("%s ran %d instructions to %s, the ISA model %d to %s\n",
+	       engine, icount, stat_name((stat_t) status), n,
+	       stat_name(isa_status));
+	same = FALSE;
+    }
+    for (i = REG_X1; i <= REG_X31; i++) {
+	v1 = sim_get_reg(s, (reg_id_t) i);
+	v2 = get_reg_val(isa->r, (reg_id_t) i);
+	if (v1 != v2) {
+	    if (!report)
+		return FALSE;
+	    printf("%s ends with %s = 0x%x, the ISA model 0x%x\n",
+		   engine, reg_name((reg_id_t) i), v1, v2);
+	    same = FALSE;
+	}
+    }
+    if ((a = mem_diff(sim_get_mem(s), isa->m)) >= 0) {
+	if (report) {
+	    get_halfword_val(sim_get_mem(s), a, &v1);
+	    get_halfword_val(isa->m, a, &v2);
+	    printf("%s ends with 0x%x at 0x%x, the ISA model 0x%x\n",
+		   engine, v1, a, v2);
+	}
+	same = FALSE;
+    }
+    return same;
+}
+
+/* Run programs from the shared seeds until they run out or one differs */
+static void *worker(void *arg)
+{
+    sim_t s = sim_create();
+    state_ptr isa = new_state(FUZZ_MEM);
+    prog_ptr p = (prog_ptr) malloc(sizeof(prog_rec));
+    unsigned long long seed, fail;
+    long long instr = 0;
+    word_t icount;
+
+    (void) arg;
+    sim_set_engine(s, engine);
+    sim_set_mem_size(s, FUZZ_MEM);
+    for (;;) {
+	seed = __atomic_fetch_add(&next_seed, 1, __ATOMIC_RELAXED);
+	fail = __atomic_load_n(&fail_seed, __ATOMIC_RELAXED);
+	if (seed > fail ||
+	    (nprogs && seed - first_seed >= (unsigned long long) nprogs))
+	    break;
+	gen_prog(p, seed, prog_len);
+	if (!run_prog(s, isa, p, &icount, FALSE)) {
+	    /* Keep the lowest, so the result doesn't depend on timing */
+	    while (seed < fail &&
+		   !__atomic_compare_exchange_n(&fail_seed, &fail, seed, FALSE,
+						__ATOMIC_RELAXED,
+						__ATOMIC_RELAXED))
+		;
+	}
+	instr += icount;
+    }
+    __atomic_fetch_add(&total_instr, instr, __ATOMIC_RELAXED);
+    free(p);
+    free_state(isa);
+    sim_destroy(s);
+    return NULL;
+}
+
+/* Print instruction w at pc as assembly */
+static void print_asm(uword_t w, int pc)
+{
+    uword_t op = w & 0x7f, f3 = w >> 12 & 7, f7 = w >> 25;
+    reg_id_t rd = (reg_id_t) (w >> 7 & 0x1f);
+    reg_id_t rs1 = (reg_id_t) (w >> 15 & 0x1f);
+    reg_id_t rs2 = (reg_id_t) (w >> 20 & 0x1f);
+    word_t imm = (word_t) w >> 20;
+    instr_ptr i;
+    char *name = "????";
+
+    for (i = instruction_set; i->name; i++)
+	if ((uword_t) i->code == op &&
+	    (op == I_LUI || op == I_AUIPC || op == I_JAL ||
+	     (uword_t) i->ifun1 == f3) &&
+	    (op != I_R || (uword_t) i->ifun2 == f7) &&
+	    (op != I_OP || f3 != 5 || (uword_t) i->ifun2 == (f7 & 0x20)) &&
+	    (op != I_AMO || (uword_t) i->ifun2 == (f7 & 0x7c))) {
+	    name = i->name;
+	    break;
+	}
+
+    printf("0x%.3x: %.8x    |   %s ", pc, w, name);
+    switch (op) {
+    case I_LUI:
+    case I_AUIPC:
+	printf("%s, 0x%x\n", reg_name(rd), w >> 12);
+	break;
+    case I_JAL:
+	printf("%s, 0x%x\n", reg_name(rd), pc +
+	       ((word_t) (w & 0x80000000) >> 11 | (w & 0xff000) |
+		(w >> 9 & 0x800) | (w >> 20 & 0x7fe)));
+	break;
+    case I_JALR:
+	printf("%s, %d(%s)\n", reg_name(rd), imm, reg_name(rs1));
+	break;
+    case I_B:
+	printf("%s, %s, 0x%x\n", reg_name(rs1), reg_name(rs2), pc +
+	       ((word_t) (w & 0x80000000) >> 19 | (w << 4 & 0x800) |
+		(w >> 20 & 0x7e0) | (w >> 7 & 0x1e)));
+	break;
+    case I_L:
+	printf("%s, %d(%s)\n", reg_name(rd), imm, reg_name(rs1));
+	break;
+    case I_S:
+	printf("%s, %d(%s)\n", reg_name(rs2),
+	       (word_t) (w & 0xfe000000) >> 20 | (w >> 7 & 0x1f),
+	       reg_name(rs1));
+	break;
+    case I_OP:
+	printf("%s, %s, %d\n", reg_name(rd), reg_name(rs1),
+	       f3 == 1 || f3 == 5 ? imm & 0x1f : imm);
+	break;
+    case I_R:
+	printf("%s, %s, %s\n", reg_name(rd), reg_name(rs1), reg_name(rs2));
+	break;
+    case I_AMO:
+	if ((f7 & 0x7c) == 0x08)
+	    printf("%s, (%s)\n", reg_name(rd), reg_name(rs1));
+	else
+	    printf("%s, %s, (%s)\n", reg_name(rd), reg_name(rs2),
+		   reg_name(rs1));
+	break;
+    default:
+	printf("\n");
+    }
+}
+
+/*
+ * List the program of seed and check it one instruction at a time,
+ * saving it to snapshot snap if that's nonNULL.  Return TRUE if the
+ * engine and the ISA model agree on it.
+ */
+static bool_t replay(unsigned long long seed, char *snap)
+{
+    sim_t s = sim_create();
+    state_ptr isa = new_state(FUZZ_MEM);
+    prog_ptr p = (prog_ptr) malloc(sizeof(prog_rec));
+    byte_t status;
+    word_t icount, checked;
+    bool_t ok, same;
+    int i;
+
+    sim_set_engine(s, engine);
+    sim_set_mem_size(s, FUZZ_MEM);
+    gen_prog(p, seed, prog_len);
+    printf("Seed %llu, s0 = 0x%x:\n", seed, DATA_BASE);
+    for (i = 0; i < p->len; i++)
+	print_asm(p->code[i], 4 * i);
+    printf("0x%.3x: %.8x    |   halt\n", 4 * p->len, 0);
+    printf("Registers:");
+    for (i = REG_X1; i <= REG_X31; i++)
+	printf("%s %s=0x%x", (i - 1) % 6 ? "" : "\n ", reg_name((reg_id_t) i),
+	       p->regs[i]);
+    printf("\n");
+
+    same = run_prog(s, isa, p, &icount, TRUE);
+    start(s, isa, p);
+    if (snap && !sim_save_snapshot(s, snap)) {
+	fprintf(stderr, "Couldn't write snapshot %s\n", snap);
+	exit(1);
+    }
+    /* sim_run_checked only runs the SEQ model */
+    sim_set_engine(s, "seq");
+    checked = sim_run_checked(s, p->len + 1, &status, isa, &ok);
+    if (!ok)
+	printf("Stepped together, seq and the ISA model part at "
+	       "instruction %d\n", checked);
+    else
+	printf("Stepped together, seq and the ISA model agree for all %d "
+	       "instructions\n", checked);
+    if (same)
+	printf("%s and the ISA model agree, %d instructions, status %s\n",
+	       engine, icount, stat_name((stat_t) status));
+
+    free(p);
+    free_state(isa);
+    sim_destroy(s);
+    return same;
+}
+
+/* Add the instructions to generate, leaving out those in list skip */
+static bool_t set_choices(char *skip)
+{
+    char *names = strdup(skip ? skip : ""), *p;
+    instr_ptr i;
+
+    for (p = strtok(names, ","); p; p = strtok(NULL, ","))
+	if (!find_instr(p))
+	    return FALSE;
+    for (i = instruction_set; i->name; i++) {
+	bool_t keep = i->code != I_HALT;
+	strcpy(names, skip ? skip : "");
+	for (p = strtok(names, ","); p && keep; p = strtok(NULL, ","))
+	    keep = strcmp(p, i->name) != 0;
+	if (keep)
+	    choices[choice_cnt++] = i;
+    }
+    free(names);
+    return choice_cnt > 0;
+}
+
+int main(int argc, char *argv[])
+{
+    char *skip = NULL, *snap = NULL;
+    int njobs = 0, c, i;
+    bool_t only = FALSE;
+    unsigned long long only_seed = 0;
+    struct timeval t0, t1;
+    double secs;
+    sim_t s;
+
+    while ((c = getopt(argc, argv, "he:i:j:n:o:r:s:x:")) != -1) {
+	switch (c) {
+	case 'e':
+	    engine = optarg;
+	    s = sim_create();
+	    if (!sim_set_engine(s, engine)) {
+		printf("Invalid engine %s\n", engine);
+		usage(argv[0]);
+	    }
+	    sim_destroy(s);
+	    break;
+	case 'i':
+	    prog_len = atoi(optarg);
+	    if (prog_len < 1 || prog_len > MAXLEN) {
+		printf("Invalid program length %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'j':
+	    njobs = atoi(optarg);
+	    break;
+	case 'n':
+	    nprogs = atoll(optarg);
+	    break;
+	case 'o':
+	    snap = optarg;
+	    break;
+	case 'r':
+	    only = TRUE;
+	    only_seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 's':
+	    first_seed = strtoull(optarg, NULL, 0);
+	    break;
+	case 'x':
+	    skip = optarg;
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind != argc)
+	usage(argv[0]);
+    if (!set_choices(skip)) {
+	printf("Invalid instructions to leave out %s\n", skip);
+	usage(argv[0]);
+    }
+    if (only)
+	return replay(only_seed, snap) ? 0 : 1;
+
+    if (njobs <= 0)
+	njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs <= 0)
+	njobs = 1;
+    next_seed = first_seed;
+
+    gettimeofday(&t0, NULL);
+    {
+	pthread_t tid[njobs];
+	for (i = 0; i < njobs; i++)
+	    if (pthread_create(&tid[i], NULL, worker, NULL) != 0) {
+		fprintf(stderr, "Couldn't start thread %d\n", i);
+		exit(1);
+	    }
+	for (i = 0; i < njobs; i++)
+	    pthread_join(tid[i], NULL);
+    }
+    gettimeofday(&t1, NULL);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+
+    if (fail_seed != ~0ULL) {
+	printf("%s and the ISA model differ on seed %llu\n", engine, fail_seed);
+	replay(fail_seed, snap);
+	return 1;
+    }
+    printf("%lld programs, %lld instructions, no differences, %.3f s, "
+	   "%.2f M instructions/s on %d threads\n", nprogs, total_instr,
+	   secs, secs > 0 ? total_instr / secs / 1e6 : 0.0, njobs);
+    return 0;
+}
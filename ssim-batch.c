@@ -0,0 +1,338 @@
+/***********************************************************************
+ *
+ * ssim-batch.c - Run many .yo programs in one go
+ *
+ * The programs named in a manifest, or found in a directory, are run
+ * by a pool of worker processes forked from ssim, so nothing is paid
+ * per program for starting a new simulator.  Each worker starts with
+ * an equal slice of the programs and, when it runs out, steals the
+ * back half of the slice of another worker, so long programs don't
+ * hold the rest of the run up.  Results go into memory shared with
+ * the parent, which writes them out in input order once all workers
+ * have finished: status, instructions executed and a hash of the
+ * final pc, registers and memory of each program.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "isa.h"
+#include "libssim.h"
+
+#define MAXNAME 4096
+
+/* Result of one program */
+typedef struct {
+    int status;			/* stat_t, or -1 if it couldn't be loaded */
+    word_t icount;
+    unsigned long long hash;
+} batch_result;
+
+/*
+ * Programs not yet started by one worker: the next one in the low 32
+ * bits, one past the last in the high 32 bits.  Only ever changed by
+ * compare-and-swap, by the owner from the front and by thieves from
+ * the back.  Padded to keep workers off each other's cache lines.
+ */
+typedef struct {
+    volatile unsigned long long range;
+    char pad[56];
+} batch_deque;
+
+#define RANGE(lo, hi) (((unsigned long long) (hi) << 32) | (lo))
+#define RANGE_LO(r) ((unsigned) ((r) & 0xffffffff))
+#define RANGE_HI(r) ((unsigned) ((r) >> 32))
+
+static char **names = NULL;	/* Programs to run */
+static int name_cnt = 0;
+
+static void add_name(char *name)
+{
+    static int name_max = 0;
+    if (name_cnt == name_max) {
+	name_max = name_max ? 2*name_max : 256;
+	names = (char **) realloc(names, name_max * sizeof(char *));
+    }
+    names[name_cnt++] = strdup(name);
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+    return strcmp(*(char **) a, *(char **) b);
+}
+
+/*
+ * read_names - collect the .yo files in directory src, or the file
+ * names listed one per line in manifest src.  Return FALSE if src
+ * can't be read.
+ */
+static bool_t read_names(char *src)
+{
+    char buf[MAXNAME];
+    DIR *dir;
+    FILE *f;
+
+    if ((dir = opendir(src)) != NULL) {
+	struct dirent *ent;
+	while ((ent = readdir(dir)) != NULL) {
+	    int len = strlen(ent->d_name);
+	    if (len > 3 && !strcmp(ent->d_name + len - 3, ".yo")) {
+		snprintf(buf, MAXNAME, "%s/%s", src, ent->d_name);
+		add_name(buf);
+	    }
+	}
+	closedir(dir);
+	qsort(names, name_cnt, sizeof(char *), cmp_names);
+	return TRUE;
+    }
+
+    if ((f = fopen(src, "r")) == NULL)
+	return FALSE;
+    while (fgets(buf, MAXNAME, f)) {
+	int len = strlen(buf);
+	while (len > 0 && (buf[len-1] == '\n' || buf[len-1] == '\r' ||
+			   buf[len-1] == ' ' || buf[len-1] == '\t'))
+	    buf[--len] = '\0';
+	if (len > 0 && buf[0] != '#')
+	    add_name(buf);
+    }
+    fclose(f);
+    return TRUE;
+}
+
+/* FNV-1a hash of len bytes, continuing from h */
+static unsigned long long hash_bytes(unsigned long long h, byte_t *p, int len)
+{
+    int i;
+    for (i = 0; i < len; i++) {
+	h ^= p[i];
+	h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/*
+ * Hash the pages of m holding something other than zeros, with their
+ * numbers, so the result doesn't depend on which pages happen to be
+ * allocated.
+ */
+static unsigned long long hash_pages(unsigned long long h, mem_t m)
+{
+    static byte_t zeros[PAGE_SIZE];
+    byte_t pnb[4];
+    int i, j;
+    for (i = 0; i < m->npages; i++) {
+	if (!m->pages[i] || !memcmp(m->pages[i], zeros, PAGE_SIZE))
+	    continue;
+	for (j = 0; j < 4; j++)
+	    pnb[j] = (i >> (8*j)) & 0xff;
+	h = hash_bytes(h, pnb, 4);
+	h = hash_bytes(h, m->pages[i], PAGE_SIZE);
+    }
+    return h;
+}
+
+/* Hash of the final pc, register file and memory of s */
+static unsigned long long hash_state(sim_t s)
+{
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    word_t pc = sim_get_pc(s);
+    byte_t pcb[4];
+    int i;
+    for (i = 0; i < 4; i++)
+	pcb[i] = (pc >> (8*i)) & 0xff;
+    h = hash_bytes(h, pcb, 4);
+    h = hash_pages(h, sim_get_regs(s));
+    return hash_pages(h, sim_get_mem(s));
+}
+
+/* Is name a .yo file, rather than an image or snapshot? */
+static bool_t is_yo_file(char *name)
+{
+    int len = strlen(name);
+    return len > 3 && !strcmp(name + len - 3, ".yo");
+}
+
+/* Load and run program i on s, leaving its result in res */
+static void run_one(sim_t s, int i, batch_result *res,
+		    long long mem_size, word_t max_instr)
+{
+    byte_t run_status = STAT_AOK;
+    bool_t snapshot = FALSE;
+    FILE *f;
+
+    res->status = -1;
+    res->icount = 0;
+    res->hash = 0;
+    sim_reset(s);
+    if (is_yo_file(names[i])) {
+	if ((f = fopen(names[i], "r")) == NULL)
+	    return;
+	if (sim_load(s, f, 0) == 0) {
+	    fclose(f);
+	    return;
+	}
+	fclose(f);
+    } else {
+	snapshot = is_snapshot(names[i]);
+	if (sim_load_image(s, names[i], 0) == 0)
+	    return;
+    }
+    res->icount = sim_run(s, max_instr, &run_status);
+    /* What a faulting instruction left pending differs between engines */
+    if (run_status == STAT_AOK)
+	sim_commit(s);
+    res->status = run_status;
+    res->hash = hash_state(s);
+
+    /* A snapshot brings its own memory, go back to the usual one */
+    if (snapshot)
+	sim_set_mem_size(s, mem_size);
+}
+
+/* Take the next program from q.  Return -1 if q is empty */
+static int take(batch_deque *q)
+{
+    for (;;) {
+	unsigned long long r = q->range;
+	unsigned lo = RANGE_LO(r), hi = RANGE_HI(r);
+	if (lo >= hi)
+	    return -1;
+	if (__sync_bool_compare_and_swap(&q->range, r, RANGE(lo+1, hi)))
+	    return lo;
+    }
+}
+
+/*
+ * steal - move the back half of some other worker's programs into
+ * deques[self].  Return FALSE once every worker has run out.
+ */
+static bool_t steal(batch_deque *deques, int nworkers, int self)
+{
+    int k;
+    for (k = 1; k < nworkers; k++) {
+	batch_deque *v = &deques[(self + k) % nworkers];
+	unsigned long long r = v->range;
+	unsigned lo = RANGE_LO(r), hi = RANGE_HI(r);
+	unsigned mid = lo + (hi - lo) / 2;
+	if (lo >= hi)
+	    continue;
+	if (__sync_bool_compare_and_swap(&v->range, r, RANGE(lo, mid))) {
+	    __sync_lock_test_and_set(&deques[self].range, RANGE(mid, hi));
+	    return TRUE;
+	}
+	/* Lost a race for it, look again */
+	k--;
+    }
+    return FALSE;
+}
+
+/* Body of worker process self */
+static void worker(int self, int nworkers, batch_deque *deques,
+		   batch_result *results, char *engine, long long mem_size,
+		   word_t max_instr)
+{
+    sim_t s = sim_create();
+    int i;
+    sim_set_engine(s, engine);
+    sim_set_mem_size(s, mem_size);
+    for (;;) {
+	while ((i = take(&deques[self])) >= 0)
+	    run_one(s, i, &results[i], mem_size, max_instr);
+	if (!steal(deques, nworkers, self))
+	    break;
+    }
+    sim_destroy(s);
+}
+
+/*
+ * sim_batch - run every program named by src (a directory of .yo files
+ * or a manifest listing them) on nworkers processes, with the given
+ * engine, memory size and instruction limit, and write one line per program to
+ * outname (stdout if NULL).  Return 0 on success.
+ */
+int sim_batch(char *src, int nworkers, char *outname,
+	      char *engine, long long mem_size, word_t max_instr)
+{
+    batch_result *results;
+    batch_deque *deques;
+    struct timeval t0, t1;
+    FILE *out = stdout;
+    int i, w, failed = 0, unloaded = 0;
+
+    if (!read_names(src)) {
+	fprintf(stderr, "Couldn't read batch list %s\n", src);
+	return 1;
+    }
+    if (nworkers <= 0)
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nworkers <= 0)
+	nworkers = 1;
+    if (nworkers > name_cnt && name_cnt > 0)
+	nworkers = name_cnt;
+
+    results = (batch_result *)
+	mmap(NULL, (name_cnt + 1) * sizeof(batch_result),
+	     PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    deques = (batch_deque *)
+	mmap(NULL, nworkers * sizeof(batch_deque),
+	     PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED || deques == MAP_FAILED) {
+	fprintf(stderr, "Couldn't allocate shared memory for batch\n");
+	return 1;
+    }
+    for (w = 0; w < nworkers; w++)
+	deques[w].range = RANGE((long long) name_cnt * w / nworkers,
+				(long long) name_cnt * (w+1) / nworkers);
+
+    gettimeofday(&t0, NULL);
+    fflush(stdout);
+    for (w = 0; w < nworkers; w++) {
+	pid_t pid = fork();
+	if (pid < 0) {
+	    /* Whatever was given to this worker gets stolen by the others */
+	    perror("fork");
+	    if (w == 0) {
+		worker(0, nworkers, deques, results, engine, mem_size,
+			   max_instr);
+		break;
+	    }
+	    continue;
+	}
+	if (pid == 0) {
+	    worker(w, nworkers, deques, results, engine, mem_size,
+		   max_instr);
+	    _exit(0);
+	}
+    }
+    while (wait(NULL) > 0)
+	;
+    gettimeofday(&t1, NULL);
+
+    if (outname && (out = fopen(outname, "w")) == NULL) {
+	fprintf(stderr, "Couldn't open batch output file %s\n", outname);
+	return 1;
+    }
+    for (i = 0; i < name_cnt; i++) {
+	batch_result *res = &results[i];
+	if (res->status < 0)
+	    unloaded++;
+	else if (res->status != STAT_HLT)
+	    failed++;
+	fprintf(out, "%s\t%s\t%d\t%016llx\n", names[i],
+		res->status < 0 ? "LOAD" : stat_name(res->status),
+		res->icount, res->hash);
+    }
+    if (out != stdout)
+	fclose(out);
+    fprintf(stderr, "%d programs, %d did not halt, %d could not be loaded, "
+	    "%d workers, %.3f s\n", name_cnt, failed, unloaded, nworkers,
+	    (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6);
+    return unloaded ? 1 : 0;
+}
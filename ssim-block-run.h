@@ -0,0 +1,274 @@
+/***********************************************************************
+ *
+ * ssim-block-run.h - Main loop of the basic-block engine
+ *
+ * Included by ssim-block.c once for each value of TRACED, to define
+ * the loop RUN_NAME.  Only the copy without tracing runs native code,
+ * as compiled blocks can't be traced.
+ *
+ ***********************************************************************/
+
+static word_t RUN_NAME(sim_t s, word_t max_instr, byte_t *statusp,
+		       bool_t jit)
+{
+#ifdef THREADED_GOTO
+    static void *labels[H_NUM+1] = {
+	&&L_H_BAD, &&L_H_HALT, &&L_H_AMO, &&L_H_FENCE, &&L_H_CSR,
+	&&L_H_LUI, &&L_H_AUIPC, &&L_H_JAL, &&L_H_JALR,
+	&&L_H_BEQ, &&L_H_BNE, &&L_H_BLT, &&L_H_BGE, &&L_H_BLTU,
+	&&L_H_BGEU, &&L_H_BNONE,
+	&&L_H_LW, &&L_H_LSTALE, &&L_H_SW,
+	&&L_H_ADDI, &&L_H_SLLI, &&L_H_SLTI, &&L_H_SLTIU, &&L_H_XORI,
+	&&L_H_SRLI, &&L_H_SRAI, &&L_H_ORI, &&L_H_ANDI,
+	&&L_H_ADD, &&L_H_SUB, &&L_H_SLL, &&L_H_SLT, &&L_H_SLTU,
+	&&L_H_XOR, &&L_H_SRL, &&L_H_SRA, &&L_H_OR, &&L_H_AND,
+	&&L_H_END
+    };
+#endif
+    word_t icount = 0;
+    word_t base = 0;	/* icount at entry to the current block */
+    word_t last;
+    byte_t run_status = STAT_AOK;
+    block_ptr b = NULL;
+    block_ptr prev = NULL;
+    int way = 0;
+    bool_t chained;
+    long long flushes;
+    decode_ptr d;
+    word_t pc;		/* Local copy of pc */
+    word_t e;		/* Local copy of vale */
+    mem_t reg = s->reg;
+    mem_t mem = s->mem;
+    struct block_cache_rec *c = s->blocks;
+    word_t addr, val;
+    jit_ctx_rec jctx;
+
+    if (max_instr <= 0)
+	goto done;
+    last = max_instr - 1;
+    jctx.regs = reg->pages[0];
+    jctx.mem = (byte_t *) mem->pages;
+    jctx.wmem = (byte_t *) mem->wpages;
+    jctx.limit = mem->last - 3;
+    jctx.sim = s;
+
+    sim_commit(s);
+    s->status = STAT_AOK;
+    e = s->vale;
+    pc = s->pc;
+
+ lookup:
+    /* Find the block at pc, following the link out of prev if we can */
+    chained = prev && (b = prev->link[way]) && b->valid && b->start == pc;
+    if (!chained) {
+	b = block_lookup(c, pc);
+	if (!b) {
+	    flushes = c->flushes;
+	    b = block_translate(s, pc);
+	    if (!b)
+		goto slow;
+	    if (flushes != c->flushes)
+		prev = NULL;
+	}
+	if (prev)
+	    prev->link[way] = b;
+    }
+    if (icount + b->n > last)
+	goto slow;
+    c->entries++;
+    c->chained += chained;
+    base = icount;
+    icount += b->n;
+    if (!TRACED && jit) {
+	if (!b->native && b->hot < JIT_THRESHOLD &&
+	    ++b->hot == JIT_THRESHOLD)
+	    b->native = jit_compile(s, b->rec, b->n);
+	if (b->native) {
+	    jctx.vale = e;
+	    c->jit_cur = b;
+	    c->jit_entries++;
+	    switch (b->native(&jctx)) {
+	    case JIT_FALL:
+		e = jctx.vale;
+		pc = jctx.pc;
+		EXIT(0);
+	    case JIT_TAKEN:
+		e = jctx.vale;
+		pc = jctx.pc;
+		EXIT(1);
+	    case JIT_STALE:
+		/* A store rewrote this block, pick up the new code */
+		e = jctx.vale;
+		pc = jctx.pc;
+		icount = base + jctx.done;
+		prev = NULL;
+		goto lookup;
+	    default:
+		c->jit_bails++;
+		e = jctx.vale;
+		pc = jctx.pc;
+		icount = base + jctx.done;
+		goto slow;
+	    }
+	}
+    }
+    d = b->rec;
+    DISPATCH();
+
+#ifndef THREADED_GOTO
+ dispatch:
+    switch (d->handler) {
+#endif
+
+    CASE(H_BAD):
+    CASE(H_HALT):
+    CASE(H_AMO):
+    CASE(H_FENCE):
+	BAIL();
+
+    CASE(H_END):
+	pc = d->tag;
+	EXIT(0);
+
+    CASE(H_CSR):
+	TRACE();
+	e = 0;
+	NEXT();
+
+    CASE(H_LUI):
+	ALU(d->valc);
+
+    CASE(H_AUIPC):
+	ALU(d->tag + d->valc);
+
+    CASE(H_JAL):
+	TRACE();
+	e = d->tag + 4;
+	TRACE_JUMP(TRUE, d->valc);
+	PROFILE_JUMP(d->valc);
+	PREDICT(TRUE, d->valc);
+	WB(e);
+	pc = d->valc;
+	EXIT(1);
+
+    CASE(H_JALR):
+	TRACE();
+	addr = RS1 + d->valc;
+	e = d->tag + 4;
+	TRACE_JUMP(TRUE, addr);
+	PROFILE_JUMP(addr);
+	PREDICT(TRUE, addr);
+	WB(e);
+	pc = addr;
+	EXIT(1);
+
+    CASE(H_BEQ):
+	BRANCH(RS1 == RS2);
+    CASE(H_BNE):
+	BRANCH(RS1 != RS2);
+    CASE(H_BLT):
+	BRANCH(RS1 < RS2);
+    CASE(H_BGE):
+	/* Same comparison as the bge case of sim_step */
+	BRANCH(RS1 > RS2);
+    CASE(H_BLTU):
+	BRANCH((uword_t) RS1 < (uword_t) RS2);
+    CASE(H_BGEU):
+	BRANCH((uword_t) RS1 >= (uword_t) RS2);
+    CASE(H_BNONE):
+	BRANCH(0);
+
+    CASE(H_LW):
+	e = RS1 + d->valc;
+	/* Fall through */
+    CASE(H_LSTALE):
+	if (!get_halfword_val(mem, e, &val))
+	    BAIL();
+	TRACE();
+	COUNT_LOAD(e);
+	WB(val);
+	NEXT();
+
+    CASE(H_SW):
+	addr = RS1 + d->valc;
+	val = RS2;
+	if (!set_halfword_val(mem, addr, val))
+	    BAIL();
+	TRACE();
+	e = addr;
+	predecode_invalidate(s, addr);
+	block_invalidate(s, addr);
+	TRACE_STORE(addr, val);
+	if (!b->valid) {
+	    /* The store rewrote this block, pick up the new code */
+	    icount = base + (d - b->rec) + 1;
+	    pc = d->tag + 4;
+	    prev = NULL;
+	    goto lookup;
+	}
+	NEXT();
+
+    CASE(H_ADDI):
+	ALU(RS1 + d->valc);
+    CASE(H_SLLI):
+	ALU(RS1 << (d->valc & 0x1f));
+    CASE(H_SLTI):
+	ALU(RS1 < d->valc);
+    CASE(H_SLTIU):
+	/* Same comparison as the sltiu case of sim_step */
+	ALU(RS1 > d->valc);
+    CASE(H_XORI):
+	ALU(RS1 ^ d->valc);
+    CASE(H_SRLI):
+	ALU((uword_t) RS1 >> (d->valc & 0x1f));
+    CASE(H_SRAI):
+	ALU(RS1 >> (d->valc & 0x1f));
+    CASE(H_ORI):
+	ALU(RS1 | d->valc);
+    CASE(H_ANDI):
+	ALU(RS1 & d->valc);
+
+    CASE(H_ADD):
+	ALU(RS1 + RS2);
+    CASE(H_SUB):
+	ALU(RS1 - RS2);
+    CASE(H_SLL):
+	ALU(RS1 << (RS2 & 0x1f));
+    CASE(H_SLT):
+	ALU(RS1 < RS2);
+    CASE(H_SLTU):
+	ALU((uword_t) RS1 < (uword_t) RS2);
+    CASE(H_XOR):
+	ALU(RS1 ^ RS2);
+    CASE(H_SRL):
+	ALU((uword_t) RS1 >> (RS2 & 0x1f));
+    CASE(H_SRA):
+	ALU(RS1 >> (RS2 & 0x1f));
+    CASE(H_OR):
+	ALU(RS1 | RS2);
+    CASE(H_AND):
+	ALU(RS1 & RS2);
+
+#ifndef THREADED_GOTO
+    }
+#endif
+
+ slow:
+    /* Let the SEQ model run this one, then carry on if it went fine */
+    s->vale = e;
+    s->pc_in = pc;
+    run_status = sim_step(s);
+    icount++;
+    if (run_status == STAT_AOK && icount < max_instr) {
+	sim_commit(s);
+	e = s->vale;
+	pc = s->pc;
+	prev = NULL;
+	goto lookup;
+    }
+
+ done:
+    if (statusp)
+	*statusp = run_status;
+    return icount;
+}
@@ -0,0 +1,472 @@
+/***********************************************************************
+ *
+ * ssim-block.c - Basic-block execution engine for the RISC-V simulator
+ *
+ * Straight-line runs of instructions ending in a branch or jump are
+ * translated once into blocks of predecoded handler records.  Running
+ * a block needs no fetch or bounds check per instruction, and each
+ * block keeps direct links to the blocks that followed it, so most
+ * transfers skip the block lookup altogether.  Stores that hit a word
+ * covered by a block (seen here and in update_state) drop that block.
+ * As with the threaded engine, halts, bad instructions, address errors
+ * and the tail of the run go through sim_step, so the results match
+ * sim_run exactly.
+ *
+ * In tiered mode (-e jit) blocks that have been entered JIT_THRESHOLD
+ * times are compiled to native code by ssim-jit.c and run from then on
+ * as a single call.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+#include "sstrace.h"
+
+#define BLOCK_MAX 32		/* Most instructions in one block */
+#define BLOCK_NUM 4096		/* Blocks held before the cache is flushed */
+#define BLOCK_HASH 4096		/* Buckets in the block lookup table */
+#define CODE_MAP_SIZE (1<<16)	/* Words tracked by the code map */
+#define REGION_WORDS BLOCK_MAX	/* So a block spans at most two regions */
+#define CODE_REGIONS (CODE_MAP_SIZE / REGION_WORDS)
+#define JIT_THRESHOLD 50	/* Entries before a block is compiled */
+
+/* Handler of the record closing a block that doesn't end in a jump */
+#define H_END H_NUM
+
+typedef struct block_rec {
+    word_t start;		/* Address of the first instruction */
+    word_t n;			/* Number of instructions */
+    bool_t valid;
+    struct block_rec *hnext;	/* Next block in the same hash bucket */
+    struct block_rec *rnext[2];	/* Next in the regions of its first and
+				   last words */
+    struct block_rec *link[2];	/* Successors: fall through, taken */
+    int hot;			/* Entries, counted up to JIT_THRESHOLD */
+    jit_fn native;		/* Compiled code, NULL if none */
+    decode_rec rec[BLOCK_MAX+1];
+} block_rec, *block_ptr;
+
+/* Block engine state of one simulator */
+struct block_cache_rec {
+    block_ptr blocks;
+    int cnt;
+    block_ptr hash[BLOCK_HASH];
+
+    /*
+     * Number of valid blocks covering each word, hashed on the word
+     * address.  A store only needs to look for blocks to drop when its
+     * words have a nonzero count.
+     */
+    unsigned short code_map[CODE_MAP_SIZE];
+
+    /*
+     * Valid blocks in each region of REGION_WORDS words, hashed the
+     * same way, so a store hitting the code map only looks at those.
+     */
+    block_ptr regions[CODE_REGIONS];
+
+    /* Block whose native code is running */
+    block_ptr jit_cur;
+
+    /* Block cache statistics */
+    long long translated;
+    long long translated_instrs;
+    long long entries;
+    long long chained;
+    long long invalidations;
+    long long flushes;
+    long long jit_entries;
+    long long jit_bails;
+};
+
+#define HASH(a) (((uword_t) (a) >> 2) & (BLOCK_HASH-1))
+#define CODE_MAP(c, w) (c)->code_map[(w) & (CODE_MAP_SIZE-1)]
+#define REGION(w) ((int) (((uword_t) (w) / REGION_WORDS) & (CODE_REGIONS-1)))
+#define FIRST_REGION(b) REGION((uword_t) (b)->start >> 2)
+#define LAST_REGION(b) REGION(((uword_t) (b)->start + 4*(b)->n - 1) >> 2)
+
+/* Add inc to the code map entries of the words covered by b */
+static void block_map(struct block_cache_rec *c, block_ptr b, int inc)
+{
+    uword_t w;
+    uword_t last = ((uword_t) b->start + 4*b->n - 1) >> 2;
+    for (w = (uword_t) b->start >> 2; w <= last; w++)
+	CODE_MAP(c, w) += inc;
+}
+
+/* The link to the block after b in the list of region r */
+static block_ptr *region_link(block_ptr b, int r)
+{
+    return &b->rnext[FIRST_REGION(b) == r ? 0 : 1];
+}
+
+/* Add b to the lists of the regions it covers */
+static void region_add(struct block_cache_rec *c, block_ptr b)
+{
+    int r0 = FIRST_REGION(b), r1 = LAST_REGION(b);
+    b->rnext[0] = c->regions[r0];
+    c->regions[r0] = b;
+    if (r1 != r0) {
+	b->rnext[1] = c->regions[r1];
+	c->regions[r1] = b;
+    }
+}
+
+/* Take b off the list of region r */
+static void region_del(struct block_cache_rec *c, block_ptr b, int r)
+{
+    block_ptr *bp = &c->regions[r];
+    while (*bp != b)
+	bp = region_link(*bp, r);
+    *bp = *region_link(b, r);
+}
+
+/* Throw away every block */
+void block_flush(sim_t s)
+{
+    struct block_cache_rec *c = s->blocks;
+    int i;
+    if (!c) {
+	c = s->blocks = (struct block_cache_rec *)
+	    calloc(1, sizeof(struct block_cache_rec));
+	c->blocks = (block_ptr) malloc(BLOCK_NUM * sizeof(block_rec));
+    } else
+	c->flushes++;
+    c->cnt = 0;
+    jit_flush(s);
+    for (i = 0; i < BLOCK_HASH; i++)
+	c->hash[i] = NULL;
+    for (i = 0; i < CODE_MAP_SIZE; i++)
+	c->code_map[i] = 0;
+    for (i = 0; i < CODE_REGIONS; i++)
+	c->regions[i] = NULL;
+}
+
+/* Free the block engine state */
+void block_free(sim_t s)
+{
+    if (s->blocks) {
+	free(s->blocks->blocks);
+	free(s->blocks);
+	s->blocks = NULL;
+    }
+}
+
+/* Drop block b, leaving it in place for any links still pointing at it */
+static void block_kill(struct block_cache_rec *c, block_ptr b)
+{
+    block_ptr *bp = &c->hash[HASH(b->start)];
+    while (*bp != b)
+	bp = &(*bp)->hnext;
+    *bp = b->hnext;
+    region_del(c, b, FIRST_REGION(b));
+    if (LAST_REGION(b) != FIRST_REGION(b))
+	region_del(c, b, LAST_REGION(b));
+    b->valid = FALSE;
+    block_map(c, b, -1);
+    c->invalidations++;
+}
+
+/* Drop any blocks containing the 4 bytes starting at a */
+void block_invalidate(sim_t s, word_t a)
+{
+    struct block_cache_rec *c = s->blocks;
+    uword_t w;
+    uword_t last = ((uword_t) a + 3) >> 2;
+    block_ptr b, next;
+    int r, done = -1;
+
+    for (w = (uword_t) a >> 2; w <= last; w++) {
+	if (!CODE_MAP(c, w) || REGION(w) == done)
+	    continue;
+	/* Only blocks in the region of w can cover it */
+	r = done = REGION(w);
+	for (b = c->regions[r]; b; b = next) {
+	    next = *region_link(b, r);
+	    if ((uword_t) (a - b->start) < (uword_t) (4*b->n) ||
+		(uword_t) (b->start - a) < 4)
+		block_kill(c, b);
+	}
+    }
+}
+
+/*
+ * jit_store - called by native code after each store to address a.
+ * Returns nonzero if the store rewrote the running block.
+ */
+int jit_store(jit_ctx_ptr ctx, word_t a)
+{
+    sim_t s = ctx->sim;
+    predecode_invalidate(s, a);
+    block_invalidate(s, a);
+    return !s->blocks->jit_cur->valid;
+}
+
+static block_ptr block_lookup(struct block_cache_rec *c, word_t a)
+{
+    block_ptr b;
+    for (b = c->hash[HASH(a)]; b; b = b->hnext)
+	if (b->start == a)
+	    return b;
+    return NULL;
+}
+
+/*
+ * block_translate - build the block starting at address a.  Returns
+ * NULL if the first instruction there can't go in a block.
+ */
+static block_ptr block_translate(sim_t s, word_t a)
+{
+    struct block_cache_rec *c = s->blocks;
+    block_ptr b;
+    decode_ptr d;
+    word_t n = 0;
+    word_t ia = a;
+
+    if (c->cnt == BLOCK_NUM)
+	block_flush(s);
+    b = &c->blocks[c->cnt];
+    while (n < BLOCK_MAX) {
+	d = fetch_decoded(s, ia);
+	/* Blocks end before anything only sim_step runs */
+	if (s->imem_error || d->handler <= H_FENCE)
+	    break;
+	b->rec[n] = *d;
+	b->rec[n].tag = ia;
+	n++;
+	ia += 4;
+	if (d->handler >= H_JAL && d->handler <= H_BNONE)
+	    break;
+    }
+    if (n == 0)
+	return NULL;
+    b->rec[n].tag = ia;
+    b->rec[n].handler = H_END;
+
+    b->start = a;
+    b->n = n;
+    b->valid = TRUE;
+    b->link[0] = b->link[1] = NULL;
+    b->hot = 0;
+    b->native = NULL;
+    b->hnext = c->hash[HASH(a)];
+    c->hash[HASH(a)] = b;
+    region_add(c, b);
+    block_map(c, b, 1);
+    c->cnt++;
+    c->translated++;
+    c->translated_instrs += n;
+    return b;
+}
+
+/* Use computed goto where the compiler has it, a switch otherwise */
+#ifdef __GNUC__
+#define THREADED_GOTO
+#endif
+
+#ifdef THREADED_GOTO
+#define CASE(h) L_##h
+#define DISPATCH() goto *labels[d->handler]
+#else
+#define CASE(h) case h
+#define DISPATCH() goto dispatch
+#endif
+
+/*
+ * TRACED is 0 in the copy of the loop without tracing, 1 in the one
+ * that writes the text trace and the binary one if there is one, and
+ * counts, profiles, predicts branches and simulates caches if asked
+ * to, 2 in the one that only writes the binary trace and 3 in the one
+ * that only profiles
+ */
+#define BTRACED (TRACED == 2 || (TRACED == 1 && s->btrace))
+#define PROFILED (TRACED == 3 || (TRACED == 1 && s->prof))
+
+/* Operands of the current instruction */
+#define RS1 get_reg_val(reg, d->rs1)
+#define RS2 get_reg_val(reg, d->rs2)
+#define WB(val) do {							\
+	set_reg_val(reg, d->rd, val);					\
+	if (TRACED && d->rd != REG_X0) {				\
+	    if (BTRACED)						\
+		trace_reg(s->btrace, d->rd, val);			\
+	    if (TRACED == 1 && TRACE_ON(s, TRACE_REGWRITE))		\
+		sim_log_reg(s, d->rd, val);				\
+	}								\
+    } while (0)
+
+/*
+ * Log and count the fetch, once the handler knows it will complete the
+ * instruction
+ */
+#define TRACE() do {							\
+	if (BTRACED)							\
+	    trace_instr(s->btrace, d->tag, d->valc, TRACE_FIELDS(d));	\
+	if (TRACED == 1 && TRACE_ON(s, TRACE_FETCH))			\
+	    sim_log_fetch(s, d, d->tag);				\
+	if (TRACED == 1 && s->counts)					\
+	    count_instr(s->counts, d, d->tag);				\
+	if (TRACED == 1 && s->cache)					\
+	    cache_fetch(s->cache, d->tag);				\
+	if (PROFILED)							\
+	    profile_instr(s->prof, d->tag);				\
+    } while (0)
+
+/* Log where the branch or jump of this record went */
+#define TRACE_JUMP(taken, target) do {					\
+	if (TRACED == 1 && TRACE_ON(s, TRACE_BRANCH))			\
+	    sim_log_branch(s, d->tag, taken, target);			\
+    } while (0)
+
+/* Follow a call or return of the jal or jalr of this record */
+#define PROFILE_JUMP(target) do {					\
+	if (PROFILED)							\
+	    profile_jump(s->prof, d, d->tag, target);			\
+    } while (0)
+
+/* Log and count a store, and pass it through the caches */
+#define TRACE_STORE(addr, val) do {					\
+	if (BTRACED)							\
+	    trace_mem(s->btrace, addr, val);				\
+	if (TRACED == 1 && TRACE_ON(s, TRACE_MEMWRITE))			\
+	    sim_log(s, "Wrote 0x%x to address 0x%x\n", val, addr);	\
+	if (TRACED == 1 && s->counts)					\
+	    count_data(s->counts, addr, TRUE);				\
+	if (TRACED == 1 && s->cache)					\
+	    cache_data(s->cache, addr, TRUE);				\
+    } while (0)
+
+/* Count a load, and pass it through the caches */
+#define COUNT_LOAD(addr) do {						\
+	if (TRACED == 1 && s->counts)					\
+	    count_data(s->counts, addr, FALSE);				\
+	if (TRACED == 1 && s->cache)					\
+	    cache_data(s->cache, addr, FALSE);				\
+    } while (0)
+
+/* Count a conditional branch */
+#define COUNT_BRANCH(taken) do {					\
+	if (TRACED == 1 && s->counts)					\
+	    count_branch(s->counts, taken);				\
+    } while (0)
+
+/* Show the branch predictors where the branch or jump went */
+#define PREDICT(taken, target) do {					\
+	if (TRACED == 1 && s->bpred)					\
+	    bpred_update(s->bpred, d, d->tag, taken, target);		\
+    } while (0)
+
+/* Go on with the next instruction of the block */
+#define NEXT() do { d++; DISPATCH(); } while (0)
+
+/* Leave the block for the one at pc, through link w of this block */
+#define EXIT(w) do { way = (w); prev = b; goto lookup; } while (0)
+
+/* Conditional branch, always the last instruction of a block */
+#define BRANCH(c) do {							\
+	TRACE();							\
+	if (c) {							\
+	    pc = d->tag + d->valc;					\
+	    TRACE_JUMP(TRUE, pc);					\
+	    COUNT_BRANCH(TRUE);						\
+	    PREDICT(TRUE, pc);						\
+	    EXIT(1);							\
+	}								\
+	pc = d->tag + 4;						\
+	TRACE_JUMP(FALSE, pc);						\
+	COUNT_BRANCH(FALSE);						\
+	PREDICT(FALSE, pc);						\
+	EXIT(0);							\
+    } while (0)
+
+/* Register-immediate and register-register ALU operations */
+#define ALU(val) do { TRACE(); e = (val); WB(e); NEXT(); } while (0)
+
+/* Hand the current instruction to sim_step */
+#define BAIL() do {							\
+	icount = base + (d - b->rec);					\
+	pc = d->tag;							\
+	goto slow;							\
+    } while (0)
+
+/*
+ * The loop is built four times: block_run_traced logs whatever trace
+ * categories are selected and keeps the counts and the profile,
+ * block_run_btraced only writes the binary trace, block_run_profiled
+ * only profiles and block_run has no trace code at all.
+ */
+#define TRACED 1
+#define RUN_NAME block_run_traced
+#include "ssim-block-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+#define TRACED 2
+#define RUN_NAME block_run_btraced
+#include "ssim-block-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+#define TRACED 3
+#define RUN_NAME block_run_profiled
+#include "ssim-block-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+#define TRACED 0
+#define RUN_NAME block_run
+#include "ssim-block-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+word_t sim_run_block(sim_t s, word_t max_instr, byte_t *statusp)
+{
+    if (TRACE_ON(s, TRACE_ALL) || s->counts || s->bpred || s->cache ||
+	(s->prof && s->btrace))
+	return block_run_traced(s, max_instr, statusp, FALSE);
+    if (s->btrace)
+	return block_run_btraced(s, max_instr, statusp, FALSE);
+    if (s->prof)
+	return block_run_profiled(s, max_instr, statusp, FALSE);
+    return block_run(s, max_instr, statusp, FALSE);
+}
+
+word_t sim_run_jit(sim_t s, word_t max_instr, byte_t *statusp)
+{
+    if (TRACE_ON(s, TRACE_ALL) || s->counts || s->bpred || s->cache ||
+	(s->prof && s->btrace))
+	return block_run_traced(s, max_instr, statusp, FALSE);
+    if (s->btrace)
+	return block_run_btraced(s, max_instr, statusp, FALSE);
+    if (s->prof)
+	return block_run_profiled(s, max_instr, statusp, FALSE);
+    return block_run(s, max_instr, statusp, TRUE);
+}
+
+/* Print block cache statistics */
+void block_report(sim_t s, FILE *outfile)
+{
+    struct block_cache_rec *c = s->blocks;
+    fprintf(outfile, "Block cache: %lld blocks, %.1f instructions per block, "
+	    "%lld/%lld entries chained (%.1f%%), %lld invalidations, "
+	    "%lld flushes\n",
+	    c->translated,
+	    c->translated ? (double) c->translated_instrs / c->translated : 0.0,
+	    c->chained, c->entries,
+	    c->entries ? 100.0 * c->chained / c->entries : 0.0,
+	    c->invalidations, c->flushes);
+}
+
+/* Print block cache and native code statistics */
+void jit_report(sim_t s, FILE *outfile)
+{
+    block_report(s, outfile);
+    fprintf(outfile, "JIT: %lld blocks compiled, %lld rejected, "
+	    "%lld native entries, %lld bails\n",
+	    s->jit_compiled, s->jit_rejected, s->blocks->jit_entries,
+	    s->blocks->jit_bails);
+}
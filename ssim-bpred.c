@@ -0,0 +1,449 @@
+/***********************************************************************
+ *
+ * ssim-bpred.c - Branch predictors
+ *
+ * Any number of direction predictors run side by side, each with its
+ * own tables, sharing one branch target buffer, return address stack
+ * and branch history.  The engines show them every branch and jump as
+ * it is resolved (bpred_update), and each predictor is scored on what
+ * it would have guessed before it is told the answer, so they are all
+ * scored on the same run whatever the engine.  The pipe engine also
+ * asks the first predictor where to fetch from next (bpred_predict),
+ * which is how its mispredictions come to cost cycles.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+
+/* Direction predictors */
+typedef enum {
+    BP_STATIC, BP_BIMODAL, BP_GSHARE, BP_TOURNAMENT
+} bpred_kind_t;
+
+static char *kind_names[] = {"static", "bimodal", "gshare", "tournament"};
+
+/* Largest table of counters */
+#define BP_MAX_SIZE (1<<24)
+
+/* Deepest return address stack */
+#define RAS_MAX 1024
+
+/*
+ * One direction predictor.  Counters are two bits, predicting taken
+ * from 2 up; the tournament's choice counters pick global from 2 up.
+ */
+struct predictor_rec {
+    int kind;			/* bpred_kind_t */
+    uword_t mask;		/* Counters in each table, less one */
+    byte_t *local;		/* Indexed by pc: bimodal and tournament */
+    byte_t *global;		/* By pc and history: gshare and tournament */
+    byte_t *choice;		/* By pc: tournament */
+};
+
+/* A branch target buffer entry */
+struct btb_entry_rec {
+    word_t pc;
+    word_t target;
+    unsigned long long used;	/* When last used, 0 if empty */
+};
+
+/* A conditional branch, and how often each predictor missed it */
+struct bpred_site_rec {
+    word_t pc;
+    long long runs;
+    long long taken;
+    long long misses[SIM_MAX_PREDICTORS];
+};
+
+struct bpred_rec {
+    struct predictor_rec pred[SIM_MAX_PREDICTORS];
+    uword_t history;		/* Latest branches, newest lowest, 1 taken */
+
+    struct btb_entry_rec *btb;
+    int btb_sets;
+    unsigned long long btb_clock;
+
+    word_t *ras;
+    int ras_top;
+    int ras_depth;
+
+    struct bpred_site_rec *sites;	/* Branches, in the order first seen */
+    int nsites;
+    int maxsites;
+    hash_index_rec index;		/* Sites by pc */
+
+    sim_bpred_stats_rec st;
+};
+typedef struct bpred_rec *bpred_ptr;
+
+/* Move the counter c towards taken or not */
+static inline void train(byte_t *c, bool_t taken)
+{
+    if (taken) {
+	if (*c < 3)
+	    (*c)++;
+    } else if (*c > 0)
+	(*c)--;
+}
+
+/* Which way p guesses the branch d at pc goes */
+static bool_t guess(bpred_ptr b, struct predictor_rec *p, decode_ptr d,
+		    word_t pc)
+{
+    uword_t i = (uword_t) pc >> 2;
+    switch (p->kind) {
+    case BP_STATIC:
+	return d->valc < 0;
+    case BP_BIMODAL:
+	return p->local[i & p->mask] >= 2;
+    case BP_GSHARE:
+	return p->global[(i ^ b->history) & p->mask] >= 2;
+    default:
+	if (p->choice[i & p->mask] >= 2)
+	    return p->global[(i ^ b->history) & p->mask] >= 2;
+	return p->local[i & p->mask] >= 2;
+    }
+}
+
+/* Teach p that the branch at pc went the way taken says */
+static void learn(bpred_ptr b, struct predictor_rec *p, word_t pc,
+		  bool_t taken)
+{
+    uword_t i = (uword_t) pc >> 2;
+    byte_t *l = p->local ? &p->local[i & p->mask] : NULL;
+    byte_t *g = p->global ? &p->global[(i ^ b->history) & p->mask] : NULL;
+
+    /* The choice moves towards whichever was right, if only one was */
+    if (p->choice && (*l >= 2) != (*g >= 2))
+	train(&p->choice[i & p->mask], (*g >= 2) == taken);
+    if (l)
+	train(l, taken);
+    if (g)
+	train(g, taken);
+}
+
+static bool_t is_return(decode_ptr d)
+{
+    return d->icode == I_JALR && d->rd == REG_X0 && d->rs1 == REG_X1;
+}
+
+/* The set of BTB entries pc can be in */
+static struct btb_entry_rec *btb_set(bpred_ptr b, word_t pc)
+{
+    uword_t i = ((uword_t) pc >> 2) & (b->btb_sets - 1);
+    return &b->btb[i * b->st.btb_ways];
+}
+
+/* Return the BTB entry for pc, NULL if it has none */
+static struct btb_entry_rec *btb_find(bpred_ptr b, word_t pc)
+{
+    struct btb_entry_rec *set;
+    int i;
+
+    if (!b->btb_sets)
+	return NULL;
+    set = btb_set(b, pc);
+    for (i = 0; i < b->st.btb_ways; i++)
+	if (set[i].used && set[i].pc == pc)
+	    return &set[i];
+    return NULL;
+}
+
+/* Make pc go to target in the BTB, replacing the least recently used */
+static void btb_enter(bpred_ptr b, struct btb_entry_rec *e, word_t pc,
+		      word_t target)
+{
+    struct btb_entry_rec *set;
+    int i;
+
+    if (!b->btb_sets)
+	return;
+    if (!e) {
+	set = btb_set(b, pc);
+	e = &set[0];
+	for (i = 1; i < b->st.btb_ways; i++)
+	    if (set[i].used < e->used)
+		e = &set[i];
+	e->pc = pc;
+    }
+    e->target = target;
+    e->used = ++b->btb_clock;
+}
+
+/* Return the site of the branch at pc, adding it if new */
+static struct bpred_site_rec *get_site(bpred_ptr b, word_t pc)
+{
+    unsigned hash = ((uword_t) pc >> 2) * 0x9e3779b1u;
+    struct bpred_site_rec *site;
+    hash_slot_ptr e;
+    int n;
+
+    for (e = hash_first(&b->index, hash); (n = e->n) >= 0;
+	 e = hash_next(&b->index, e))
+	if (b->sites[n].pc == pc)
+	    return &b->sites[n];
+
+    if (b->nsites == b->maxsites) {
+	b->maxsites *= 2;
+	b->sites = (struct bpred_site_rec *)
+	    realloc(b->sites, b->maxsites * sizeof(struct bpred_site_rec));
+    }
+    n = b->nsites++;
+    site = &b->sites[n];
+    memset(site, 0, sizeof(*site));
+    site->pc = pc;
+    hash_add(&b->index, e, n, hash);
+    return site;
+}
+
+void bpred_update(bpred_ptr b, decode_ptr d, word_t pc, bool_t taken,
+		  word_t next)
+{
+    struct btb_entry_rec *e;
+    int i;
+
+    if (d->icode == I_B) {
+	struct bpred_site_rec *site = get_site(b, pc);
+	site->runs++;
+	if (taken)
+	    site->taken++;
+	b->st.branches++;
+	for (i = 0; i < b->st.npred; i++) {
+	    if (guess(b, &b->pred[i], d, pc) != taken) {
+		b->st.misses[i]++;
+		site->misses[i]++;
+	    }
+	    learn(b, &b->pred[i], pc, taken);
+	}
+	b->history = b->history << 1 | (taken != 0);
+	if (!taken)
+	    return;
+    } else if (d->icode != I_JAL && d->icode != I_JALR)
+	return;
+
+    if (b->st.ras_entries && is_return(d)) {
+	b->st.returns++;
+	if (!b->ras_depth || b->ras[b->ras_top] != next)
+	    b->st.ras_misses++;
+	if (b->ras_depth) {
+	    b->ras_top = (b->ras_top ? b->ras_top : b->st.ras_entries) - 1;
+	    b->ras_depth--;
+	}
+	return;
+    }
+    if (b->st.ras_entries && d->icode != I_B && d->rd == REG_X1) {
+	/* A full stack loses its oldest entry */
+	b->ras_top = (b->ras_top + 1) % b->st.ras_entries;
+	b->ras[b->ras_top] = pc + 4;
+	if (b->ras_depth < b->st.ras_entries)
+	    b->ras_depth++;
+    }
+
+    b->st.btb_lookups++;
+    e = btb_find(b, pc);
+    if (!e || e->target != next)
+	b->st.btb_misses++;
+    btb_enter(b, e, pc, next);
+}
+
+word_t bpred_predict(bpred_ptr b, decode_ptr d, word_t pc)
+{
+    struct btb_entry_rec *e;
+
+    if (d->icode == I_B) {
+	if (!b->st.npred || !guess(b, &b->pred[0], d, pc))
+	    return pc + 4;
+    } else if (d->icode == I_JALR && b->st.ras_entries && is_return(d))
+	return b->ras_depth ? b->ras[b->ras_top] : pc + 4;
+    else if (d->icode != I_JAL && d->icode != I_JALR)
+	return pc + 4;
+    e = btb_find(b, pc);
+    return e ? e->target : pc + 4;
+}
+
+static void free_bpred(bpred_ptr b)
+{
+    int i;
+    for (i = 0; i < SIM_MAX_PREDICTORS; i++) {
+	free(b->pred[i].local);
+	free(b->pred[i].global);
+	free(b->pred[i].choice);
+    }
+    free(b->btb);
+    free(b->ras);
+    free(b->sites);
+    free(b->index.slots);
+    free(b);
+}
+
+bool_t sim_set_predictors(sim_t s, const char *spec)
+{
+    bpred_ptr b;
+    const char *p = spec;
+    long long btb = 512, ways = 4, ras = 16;
+
+    if (s->bpred) {
+	free_bpred(s->bpred);
+	s->bpred = NULL;
+    }
+    if (!spec)
+	return TRUE;
+
+    b = (bpred_ptr) calloc(1, sizeof(struct bpred_rec));
+    while (*p) {
+	int len = strcspn(p, ",:=");
+	int k;
+
+	if (len == 3 && !strncmp(p, "btb", 3) && p[3] == '=') {
+	    p += 4;
+	    if (!parse_number(&p, &btb) || btb > BP_MAX_SIZE ||
+		(btb && !power_of_two(btb)))
+		goto bad;
+	    ways = btb < 4 ? btb : 4;
+	    if (*p == ':') {
+		p++;
+		if (!parse_number(&p, &ways) || ways > btb ||
+		    !power_of_two(ways))
+		    goto bad;
+	    }
+	} else if (len == 3 && !strncmp(p, "ras", 3) && p[3] == '=') {
+	    p += 4;
+	    if (!parse_number(&p, &ras) || ras > RAS_MAX)
+		goto bad;
+	} else {
+	    struct predictor_rec *pr = &b->pred[b->st.npred];
+	    long long size = 4096;
+
+	    for (k = 0; k <= BP_TOURNAMENT; k++)
+		if ((int) strlen(kind_names[k]) == len &&
+		    !strncmp(p, kind_names[k], len))
+		    break;
+	    if (k > BP_TOURNAMENT || b->st.npred == SIM_MAX_PREDICTORS)
+		goto bad;
+	    p += len;
+	    if (*p == ':') {
+		p++;
+		if (!parse_number(&p, &size) || size > BP_MAX_SIZE ||
+		    !power_of_two(size))
+		    goto bad;
+	    }
+	    pr->kind = k;
+	    pr->mask = size - 1;
+	    if (k == BP_BIMODAL || k == BP_TOURNAMENT) {
+		pr->local = (byte_t *) malloc(size);
+		memset(pr->local, 1, size);
+	    }
+	    if (k == BP_GSHARE || k == BP_TOURNAMENT) {
+		pr->global = (byte_t *) malloc(size);
+		memset(pr->global, 1, size);
+	    }
+	    if (k == BP_TOURNAMENT) {
+		pr->choice = (byte_t *) malloc(size);
+		memset(pr->choice, 1, size);
+	    }
+	    if (k == BP_STATIC)
+		strcpy(b->st.names[b->st.npred], kind_names[k]);
+	    else
+		sprintf(b->st.names[b->st.npred], "%s:%lld", kind_names[k],
+			size);
+	    b->st.npred++;
+	}
+	if (*p == ',')
+	    p++;
+	else if (*p)
+	    goto bad;
+    }
+
+    b->st.btb_entries = btb;
+    b->st.btb_ways = ways;
+    b->btb_sets = btb ? btb / ways : 0;
+    b->btb = (struct btb_entry_rec *)
+	calloc(btb ? btb : 1, sizeof(struct btb_entry_rec));
+    b->st.ras_entries = ras;
+    b->ras = (word_t *) calloc(ras ? ras : 1, sizeof(word_t));
+    b->maxsites = 64;
+    b->sites = (struct bpred_site_rec *)
+	malloc(b->maxsites * sizeof(struct bpred_site_rec));
+    hash_init(&b->index, 2 * b->maxsites);
+    s->bpred = b;
+    return TRUE;
+
+ bad:
+    free_bpred(b);
+    return FALSE;
+}
+
+bool_t sim_get_bpred_stats(sim_t s, sim_bpred_stats_ptr p)
+{
+    if (!s->bpred)
+	return FALSE;
+    *p = s->bpred->st;
+    return TRUE;
+}
+
+void bpred_report(sim_t s, FILE *outfile)
+{
+    sim_bpred_stats_rec st;
+    int i;
+
+    if (!sim_get_bpred_stats(s, &st))
+	return;
+    for (i = 0; i < st.npred; i++)
+	fprintf(outfile, "Predictor %s: %lld of %lld branches mispredicted "
+		"(%.2f%% correct)\n", st.names[i], st.misses[i], st.branches,
+		st.branches ? 100.0 * (st.branches - st.misses[i]) / st.branches
+		: 100.0);
+    fprintf(outfile, "BTB (%d entries, %d ways): %lld of %lld targets missed; "
+	    "RAS (%d entries): %lld of %lld returns missed\n",
+	    st.btb_entries, st.btb_ways, st.btb_misses, st.btb_lookups,
+	    st.ras_entries, st.ras_misses, st.returns);
+}
+
+static int site_cmp(const void *a, const void *b)
+{
+    uword_t x = ((const struct bpred_site_rec *) a)->pc;
+    uword_t y = ((const struct bpred_site_rec *) b)->pc;
+    return x < y ? -1 : x > y;
+}
+
+bool_t sim_write_branches(sim_t s, FILE *out)
+{
+    bpred_ptr b = s->bpred;
+    struct bpred_site_rec *sites;
+    int i, j;
+
+    if (!b)
+	return FALSE;
+    sites = (struct bpred_site_rec *)
+	malloc((b->nsites ? b->nsites : 1) * sizeof(struct bpred_site_rec));
+    memcpy(sites, b->sites, b->nsites * sizeof(struct bpred_site_rec));
+    qsort(sites, b->nsites, sizeof(struct bpred_site_rec), site_cmp);
+
+    fprintf(out, "%12s %7s", "runs", "taken");
+    for (j = 0; j < b->st.npred; j++)
+	fprintf(out, " %*s", (int) strlen(b->st.names[j]) > 12 ?
+		(int) strlen(b->st.names[j]) : 12, b->st.names[j]);
+    fprintf(out, "  %-10s  %s\n", "pc", "instruction");
+    for (i = 0; i < b->nsites; i++) {
+	struct bpred_site_rec *site = &sites[i];
+	word_t off;
+	char *name = find_label(s->syms, site->pc, &off);
+	if (name && off == 0)
+	    fprintf(out, "%s:\n", name);
+	fprintf(out, "%12lld %6.2f%%", site->runs,
+		100.0 * site->taken / site->runs);
+	for (j = 0; j < b->st.npred; j++)
+	    fprintf(out, " %*lld", (int) strlen(b->st.names[j]) > 12 ?
+		    (int) strlen(b->st.names[j]) : 12, site->misses[j]);
+	fprintf(out, "  0x%08x  ", site->pc);
+	print_instr(out, peek_decoded(s, site->pc), site->pc);
+	fputc('\n', out);
+    }
+    free(sites);
+    return TRUE;
+}
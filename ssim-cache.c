@@ -0,0 +1,378 @@
+/***********************************************************************
+ *
+ * ssim-cache.c - Cache hierarchy
+ *
+ * Split L1 instruction and data caches, optionally in front of a
+ * unified L2.  The engines fetch every instruction through the
+ * instruction cache (cache_fetch in sim.h) and load and store through
+ * the data cache in program order, so every engine sees the same hits
+ * and misses; the pipe engine adds the cycles they took to its own.
+ * Only tags are kept, the data stays in the simulator's memory.
+ *
+ * A fetch from the line fetched last is a hit without looking, since
+ * nothing else can have evicted it, which keeps the cost of fetching
+ * down to a compare for most instructions.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+
+/* Flags of a way */
+#define CL_VALID 0x1
+#define CL_DIRTY 0x2
+
+/* Most ways a set can have, one bit of the PLRU tree each */
+#define CACHE_MAX_WAYS 64
+
+/* Largest cache */
+#define CACHE_MAX_SIZE (64<<20)
+
+static char *repl_names[] = {"lru", "plru", "random"};
+
+/* Remember way w of cache l as the most recently used */
+static void touch(cache_level_ptr l, uword_t set, int w)
+{
+    if (l->repl == CACHE_LRU)
+	l->used[set * l->ways + w] = ++l->clock;
+    else if (l->repl == CACHE_PLRU) {
+	/* Point every node on the way down to w away from it */
+	unsigned long long *t = &l->tree[set];
+	int node = w + l->ways;
+	while (node > 1) {
+	    if (node & 1)
+		*t &= ~(1ULL << (node >> 1));
+	    else
+		*t |= 1ULL << (node >> 1);
+	    node >>= 1;
+	}
+    }
+}
+
+/* Return the way of set to replace */
+static int victim(cache_level_ptr l, uword_t set)
+{
+    int base = set * l->ways;
+    int w, node;
+
+    for (w = 0; w < l->ways; w++)
+	if (!(l->flags[base + w] & CL_VALID))
+	    return w;
+    switch (l->repl) {
+    case CACHE_LRU:
+	for (w = 0, node = 1; node < l->ways; node++)
+	    if (l->used[base + node] < l->used[base + w])
+		w = node;
+	return w;
+    case CACHE_PLRU:
+	for (node = 1; node < l->ways; )
+	    node = 2 * node + ((l->tree[set] >> node) & 1);
+	return node - l->ways;
+    default:
+	l->seed = l->seed * 1103515245 + 12345;
+	return (l->seed >> 16) % l->ways;
+    }
+}
+
+/*
+ * Read or write the line holding a in l, filling it from below on a
+ * miss if need be.  Return the cycles it took.
+ */
+static int access_line(cache_level_ptr l, uword_t a, bool_t write)
+{
+    uword_t line = a >> l->line_bits;
+    uword_t set = line & l->set_mask;
+    int base = set * l->ways;
+    int w, lat = l->latency;
+
+    l->st.accesses++;
+    if (line == l->last && (!write || l->write_back)) {
+	if (write)
+	    l->flags[l->last_way] |= CL_DIRTY;
+	return lat;
+    }
+
+    for (w = 0; w < l->ways; w++)
+	if ((l->flags[base + w] & CL_VALID) && l->tags[base + w] == line)
+	    break;
+    if (w == l->ways) {
+	l->st.misses++;
+	if (write && !l->write_back) {
+	    /* Straight through to the next level, without allocating */
+	    if (l->next)
+		access_line(l->next, a, TRUE);
+	    return lat;
+	}
+	w = victim(l, set);
+	if ((l->flags[base + w] & (CL_VALID | CL_DIRTY)) ==
+	    (CL_VALID | CL_DIRTY)) {
+	    l->st.writebacks++;
+	    if (l->next)
+		access_line(l->next, l->tags[base + w] << l->line_bits,
+			    TRUE);
+	}
+	lat += l->next ? access_line(l->next, a, FALSE) : l->miss_latency;
+	l->st.miss_cycles += lat - l->latency;
+	l->tags[base + w] = line;
+	l->flags[base + w] = CL_VALID;
+    }
+    if (write) {
+	if (l->write_back)
+	    l->flags[base + w] |= CL_DIRTY;
+	else if (l->next)
+	    access_line(l->next, a, TRUE);
+    }
+    touch(l, set, w);
+    l->last = line;
+    l->last_way = base + w;
+    return lat;
+}
+
+void cache_access(cache_level_ptr l, word_t a, bool_t write)
+{
+    access_line(l, a, write);
+}
+
+void cache_data(cache_ptr c, word_t a, bool_t write)
+{
+    cache_level_ptr l = &c->l1d;
+    access_line(l, a, write);
+
+    /* A word across two lines needs both */
+    if (((uword_t) a ^ ((uword_t) a + 3)) >> l->line_bits)
+	access_line(l, a + 3, write);
+}
+
+long long cache_stall(cache_ptr c)
+{
+    return c->l1i.st.accesses * (c->l1i.latency - 1) +
+	c->l1i.st.miss_cycles +
+	c->l1d.st.accesses * (c->l1d.latency - 1) +
+	c->l1d.st.miss_cycles;
+}
+
+/* Set up l as a cache with the layout and policies in l->st */
+static void init_level(cache_level_ptr l, char *name)
+{
+    int n = l->st.size / l->st.line;
+
+    strcpy(l->st.name, name);
+    l->ways = l->st.ways;
+    l->line_bits = 0;
+    while (1 << l->line_bits < l->st.line)
+	l->line_bits++;
+    l->set_mask = n / l->ways - 1;
+    l->repl = l->st.repl;
+    l->write_back = l->st.write_back;
+    l->latency = l->st.latency;
+    l->tags = (uword_t *) calloc(n, sizeof(uword_t));
+    l->flags = (byte_t *) calloc(n, sizeof(byte_t));
+    if (l->repl == CACHE_LRU)
+	l->used = (unsigned long long *)
+	    calloc(n, sizeof(unsigned long long));
+    else if (l->repl == CACHE_PLRU)
+	l->tree = (unsigned long long *)
+	    calloc(n / l->ways, sizeof(unsigned long long));
+    l->last = ~0u;
+    l->seed = 1;
+}
+
+static void free_level(cache_level_ptr l)
+{
+    free(l->tags);
+    free(l->flags);
+    free(l->used);
+    free(l->tree);
+}
+
+bool_t parse_number(const char **p, long long *n)
+{
+    char *end;
+    if (**p < '0' || **p > '9')
+	return FALSE;
+    *n = strtoll(*p, &end, 10);
+    if (*n > 1LL << 32)
+	return FALSE;
+    if (*end == 'K' || *end == 'k') {
+	*n <<= 10;
+	end++;
+    } else if (*end == 'M' || *end == 'm') {
+	*n <<= 20;
+	end++;
+    }
+    *p = end;
+    return TRUE;
+}
+
+/*
+ * Parse the settings after the name of one cache from *p into st:
+ * numbers for its size, ways, line and latency in that order, and the
+ * names of policies.  Return FALSE if they aren't understood.
+ */
+static bool_t parse_level(const char **p, sim_cache_level_rec *st)
+{
+    long long v[4];
+    int nnum = 0, k;
+
+    v[0] = st->size;
+    v[1] = st->ways;
+    v[2] = st->line;
+    v[3] = st->latency;
+    if (**p == '=') {
+	(*p)++;
+	if (!parse_number(p, &v[nnum++]))
+	    return FALSE;
+    }
+    while (**p == ':') {
+	int len = strcspn(++*p, ":,");
+	if (**p >= '0' && **p <= '9') {
+	    if (nnum == 0 || nnum == 4 || !parse_number(p, &v[nnum++]))
+		return FALSE;
+	    continue;
+	}
+	for (k = 0; k <= CACHE_RANDOM; k++)
+	    if ((int) strlen(repl_names[k]) == len &&
+		!strncmp(*p, repl_names[k], len))
+		break;
+	if (k <= CACHE_RANDOM)
+	    st->repl = k;
+	else if (len == 2 && !strncmp(*p, "wb", 2))
+	    st->write_back = TRUE;
+	else if (len == 2 && !strncmp(*p, "wt", 2))
+	    st->write_back = FALSE;
+	else
+	    return FALSE;
+	*p += len;
+    }
+    if (!power_of_two(v[0]) || v[0] > CACHE_MAX_SIZE ||
+	!power_of_two(v[1]) || v[1] > CACHE_MAX_WAYS ||
+	!power_of_two(v[2]) || v[2] < 4 || v[1] * v[2] > v[0] ||
+	v[3] < 1 || v[3] > 100000)
+	return FALSE;
+    st->size = v[0];
+    st->ways = v[1];
+    st->line = v[2];
+    st->latency = v[3];
+    return TRUE;
+}
+
+bool_t sim_set_caches(sim_t s, const char *spec)
+{
+    cache_ptr c;
+    const char *p = spec;
+    sim_cache_level_rec l1i = { .size = 16384, .ways = 2, .line = 32,
+				.repl = CACHE_LRU, .write_back = TRUE,
+				.latency = 1 };
+    sim_cache_level_rec l1d = { .size = 16384, .ways = 4, .line = 32,
+				.repl = CACHE_LRU, .write_back = TRUE,
+				.latency = 1 };
+    sim_cache_level_rec l2 = { .size = 262144, .ways = 8, .line = 64,
+			       .repl = CACHE_LRU, .write_back = TRUE,
+			       .latency = 10 };
+    long long mem = 100;
+    bool_t have_l2 = FALSE;
+
+    if (s->cache) {
+	free_level(&s->cache->l1i);
+	free_level(&s->cache->l1d);
+	free_level(&s->cache->l2);
+	free(s->cache);
+	s->cache = NULL;
+    }
+    if (!spec)
+	return TRUE;
+
+    while (*p) {
+	int len = strcspn(p, ",:=");
+	bool_t ok;
+	if (len == 3 && !strncmp(p, "l1i", 3)) {
+	    p += len;
+	    ok = parse_level(&p, &l1i);
+	} else if (len == 3 && !strncmp(p, "l1d", 3)) {
+	    p += len;
+	    ok = parse_level(&p, &l1d);
+	} else if (len == 2 && !strncmp(p, "l2", 2)) {
+	    p += len;
+	    ok = parse_level(&p, &l2);
+	    have_l2 = TRUE;
+	} else if (len == 3 && !strncmp(p, "mem", 3) && p[3] == '=') {
+	    p += 4;
+	    ok = parse_number(&p, &mem) && mem >= 1 && mem <= 100000;
+	} else
+	    ok = FALSE;
+	if (!ok)
+	    return FALSE;
+	if (*p == ',')
+	    p++;
+	else if (*p)
+	    return FALSE;
+    }
+
+    c = (cache_ptr) calloc(1, sizeof(cache_rec));
+    c->l1i.st = l1i;
+    c->l1d.st = l1d;
+    c->l2.st = l2;
+    init_level(&c->l1i, "L1I");
+    init_level(&c->l1d, "L1D");
+    if (have_l2) {
+	init_level(&c->l2, "L2");
+	c->l1i.next = c->l1d.next = &c->l2;
+	c->l2.miss_latency = mem;
+    } else
+	c->l1i.miss_latency = c->l1d.miss_latency = mem;
+    s->cache = c;
+    return TRUE;
+}
+
+bool_t sim_get_cache_stats(sim_t s, sim_cache_stats_ptr p)
+{
+    cache_ptr c = s->cache;
+    if (!c)
+	return FALSE;
+    p->c[0] = c->l1i.st;
+    p->c[1] = c->l1d.st;
+    p->c[2] = c->l2.st;
+    p->ncaches = c->l1i.next ? 3 : 2;
+    p->mem_latency = c->l1i.next ? c->l2.miss_latency : c->l1i.miss_latency;
+    return TRUE;
+}
+
+/* Average cycles an access to l took */
+static double amat(sim_cache_level_rec *l)
+{
+    return l->latency +
+	(l->accesses ? (double) l->miss_cycles / l->accesses : 0.0);
+}
+
+void cache_report(sim_t s, FILE *outfile)
+{
+    sim_cache_stats_rec st;
+    long long instrs;
+    int i;
+
+    if (!sim_get_cache_stats(s, &st))
+	return;
+    instrs = st.c[0].accesses;
+    for (i = 0; i < st.ncaches; i++) {
+	sim_cache_level_rec *l = &st.c[i];
+	char *policy = i == 0 ? "" :
+	    l->write_back ? ", write-back" : ", write-through";
+	fprintf(outfile, "%s (%lld%s, %d ways, %d-byte lines, %s%s): "
+		"%lld accesses, %lld misses (%.2f%%), %.2f MPKI",
+		l->name, l->size >= 1024 ? l->size / 1024 : l->size,
+		l->size >= 1024 ? "K" : " bytes", l->ways, l->line,
+		repl_names[l->repl], policy, l->accesses, l->misses,
+		l->accesses ? 100.0 * l->misses / l->accesses : 0.0,
+		instrs ? 1000.0 * l->misses / instrs : 0.0);
+	if (i > 0 && l->write_back)
+	    fprintf(outfile, ", %lld writebacks", l->writebacks);
+	fputc('\n', outfile);
+    }
+    fprintf(outfile, "Average memory access time: %.2f cycles fetching, "
+	    "%.2f loading and storing (memory %d cycles)\n",
+	    amat(&st.c[0]), amat(&st.c[1]), st.mem_latency);
+}
@@ -0,0 +1,439 @@
+/***********************************************************************
+ *
+ * ssim-jit.c - x86-64 code generator for hot blocks
+ *
+ * The block engine hands blocks that have run often enough to
+ * jit_compile, which turns them into a native function.  The guest
+ * register file stays in the reg memory, addressed from a fixed host
+ * register.  Loads and stores look the address up in the page table
+ * of the memory (the write one for stores) and only go ahead inline
+ * for a word inside one page that is there; anything else, including
+ * the first write to a page since a checkpoint, bails to the
+ * interpreter.
+ * Anything the generator doesn't cover makes it give up on the block,
+ * which then stays interpreted.
+ *
+ * Host register use inside generated code:
+ *   rbp  jit_ctx_rec of the call
+ *   rbx  register file contents
+ *   r13  memory page table
+ *   r14  highest address a word can be accessed at
+ *   r15  vale
+ *   eax, ecx, edx, edi  scratch
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+
+#if defined(__x86_64__) && defined(__unix__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (1<<22)	/* Bytes of native code held */
+#define JIT_INSTR_MAX 128	/* Most bytes generated for one instruction */
+
+/* Native code buffer of one simulator */
+typedef struct jit_buf_rec {
+    byte_t *code;	/* Start of the code buffer */
+    byte_t *p;		/* Where the next byte goes */
+    bool_t broken;	/* Couldn't get executable memory */
+} jit_buf_rec, *jit_buf_ptr;
+
+/* Host register numbers */
+#define EAX 0
+#define ECX 1
+#define EDX 2
+#define EBX 3
+#define EDI 7
+
+/* Condition codes for jcc/setcc */
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_BE 0x6
+#define CC_A  0x7
+#define CC_L  0xc
+#define CC_GE 0xd
+#define CC_LE 0xe
+#define CC_G  0xf
+
+static void emit1(jit_buf_ptr j, int b)
+{
+    *j->p++ = (byte_t) b;
+}
+
+static void emit4(jit_buf_ptr j, word_t w)
+{
+    int i;
+    for (i = 0; i < 4; i++) {
+	emit1(j, w & 0xff);
+	w >>= 8;
+    }
+}
+
+static void emit8(jit_buf_ptr j, unsigned long long w)
+{
+    int i;
+    for (i = 0; i < 8; i++) {
+	emit1(j, (int) (w & 0xff));
+	w >>= 8;
+    }
+}
+
+/* mov r, guest register id */
+static void emit_load_reg(jit_buf_ptr j, int r, byte_t id)
+{
+    emit1(j, 0x8b);
+    emit1(j, 0x40 | (r << 3) | EBX);
+    emit1(j, id * 4);
+}
+
+/* mov guest register id, r.  Writes to x0 are dropped */
+static void emit_store_reg(jit_buf_ptr j, byte_t id, int r)
+{
+    if (id == REG_X0)
+	return;
+    emit1(j, 0x89);
+    emit1(j, 0x40 | (r << 3) | EBX);
+    emit1(j, id * 4);
+}
+
+/* mov r, imm */
+static void emit_mov_imm(jit_buf_ptr j, int r, word_t imm)
+{
+    emit1(j, 0xb8 + r);
+    emit4(j, imm);
+}
+
+/* mov r15d, eax */
+static void emit_set_vale(jit_buf_ptr j)
+{
+    emit1(j, 0x41); emit1(j, 0x89); emit1(j, 0xc7);
+}
+
+/* Write back vale, restore the callee-saved registers and return eax */
+static void emit_epilogue(jit_buf_ptr j)
+{
+    emit1(j, 0x44); emit1(j, 0x89); emit1(j, 0x7d);
+    emit1(j, offsetof(jit_ctx_rec, vale));
+    emit1(j, 0x41); emit1(j, 0x5f);	/* pop r15 */
+    emit1(j, 0x41); emit1(j, 0x5e);	/* pop r14 */
+    emit1(j, 0x41); emit1(j, 0x5d);	/* pop r13 */
+    emit1(j, 0x5b);		/* pop rbx */
+    emit1(j, 0x5d);		/* pop rbp */
+    emit1(j, 0xc3);		/* ret */
+}
+
+/* Leave with ctx->done = done, ctx->pc = pc (unless pc_set) and code */
+static void emit_exit(jit_buf_ptr j, int code, word_t pc, bool_t pc_set,
+		      word_t done)
+{
+    if (!pc_set) {
+	emit1(j, 0xc7); emit1(j, 0x45);
+	emit1(j, offsetof(jit_ctx_rec, pc));
+	emit4(j, pc);
+    }
+    emit1(j, 0xc7); emit1(j, 0x45);
+    emit1(j, offsetof(jit_ctx_rec, done));
+    emit4(j, done);
+    emit_mov_imm(j, EAX, code);
+    emit_epilogue(j);
+}
+
+/* Short forward jcc over code emitted later, returns the byte to patch */
+static byte_t *emit_jcc_short(jit_buf_ptr j, int cc)
+{
+    emit1(j, 0x70 | cc);
+    emit1(j, 0);
+    return j->p - 1;
+}
+
+static void patch_short(jit_buf_ptr j, byte_t *at)
+{
+    *at = (byte_t) (j->p - at - 1);
+}
+
+/* eax = eax op ecx for the register-register handlers */
+static void emit_alu_rr(jit_buf_ptr j, byte_t handler)
+{
+    switch (handler) {
+    case H_ADD: emit1(j, 0x01); emit1(j, 0xc8); break;
+    case H_SUB: emit1(j, 0x29); emit1(j, 0xc8); break;
+    case H_AND: emit1(j, 0x21); emit1(j, 0xc8); break;
+    case H_OR:  emit1(j, 0x09); emit1(j, 0xc8); break;
+    case H_XOR: emit1(j, 0x31); emit1(j, 0xc8); break;
+    case H_SLL: emit1(j, 0xd3); emit1(j, 0xe0); break;
+    case H_SRL: emit1(j, 0xd3); emit1(j, 0xe8); break;
+    case H_SRA: emit1(j, 0xd3); emit1(j, 0xf8); break;
+    case H_SLT:
+    case H_SLTU:
+	emit1(j, 0x39); emit1(j, 0xc8);		/* cmp eax, ecx */
+	emit1(j, 0x0f); emit1(j, 0x90 | (handler == H_SLT ? CC_L : CC_B));
+	emit1(j, 0xc0);				/* setcc al */
+	emit1(j, 0x0f); emit1(j, 0xb6); emit1(j, 0xc0);	/* movzx eax, al */
+	break;
+    }
+}
+
+/* eax = eax op imm for the register-immediate handlers */
+static void emit_alu_ri(jit_buf_ptr j, byte_t handler, word_t imm)
+{
+    switch (handler) {
+    case H_ADDI: emit1(j, 0x05); emit4(j, imm); break;
+    case H_ANDI: emit1(j, 0x25); emit4(j, imm); break;
+    case H_ORI:  emit1(j, 0x0d); emit4(j, imm); break;
+    case H_XORI: emit1(j, 0x35); emit4(j, imm); break;
+    case H_SLLI: emit1(j, 0xc1); emit1(j, 0xe0); emit1(j, imm & 0x1f); break;
+    case H_SRLI: emit1(j, 0xc1); emit1(j, 0xe8); emit1(j, imm & 0x1f); break;
+    case H_SRAI: emit1(j, 0xc1); emit1(j, 0xf8); emit1(j, imm & 0x1f); break;
+    case H_SLTI:
+    case H_SLTIU:
+	emit1(j, 0x3d); emit4(j, imm);		/* cmp eax, imm */
+	/* sltiu compares the same way as the sltiu case of sim_step */
+	emit1(j, 0x0f); emit1(j, 0x90 | (handler == H_SLTI ? CC_L : CC_G));
+	emit1(j, 0xc0);
+	emit1(j, 0x0f); emit1(j, 0xb6); emit1(j, 0xc0);
+	break;
+    }
+}
+
+/*
+ * Look up the word at address eax, for writing if write is set,
+ * leaving its page in rdx and offset in edi.  Bail out to the
+ * interpreter at instruction i if the address is out of range, its
+ * page isn't there or the word spans pages.
+ */
+static void emit_mem_addr(jit_buf_ptr j, word_t pc, word_t i, bool_t write)
+{
+    byte_t *bail[3];
+    byte_t *ok;
+    int k;
+    emit1(j, 0x44); emit1(j, 0x39); emit1(j, 0xf0);	/* cmp eax, r14d */
+    bail[0] = emit_jcc_short(j, CC_A);
+    emit1(j, 0x89); emit1(j, 0xc2);			/* mov edx, eax */
+    emit1(j, 0xc1); emit1(j, 0xea); emit1(j, PAGE_BITS);	/* shr edx, bits */
+    if (write) {
+	emit1(j, 0x48); emit1(j, 0x8b); emit1(j, 0x7d);
+	emit1(j, offsetof(jit_ctx_rec, wmem));		/* mov rdi, wmem */
+	emit1(j, 0x48); emit1(j, 0x8b);
+	emit1(j, 0x14); emit1(j, 0xd7);			/* mov rdx, [rdi+rdx*8] */
+    } else {
+	emit1(j, 0x49); emit1(j, 0x8b); emit1(j, 0x54);
+	emit1(j, 0xd5); emit1(j, 0x00);			/* mov rdx, [r13+rdx*8] */
+    }
+    emit1(j, 0x48); emit1(j, 0x85); emit1(j, 0xd2);	/* test rdx, rdx */
+    bail[1] = emit_jcc_short(j, CC_E);
+    emit1(j, 0x89); emit1(j, 0xc7);			/* mov edi, eax */
+    emit1(j, 0x81); emit1(j, 0xe7); emit4(j, PAGE_MASK);	/* and edi, mask */
+    emit1(j, 0x81); emit1(j, 0xff); emit4(j, PAGE_SIZE - 4);	/* cmp edi, imm */
+    bail[2] = emit_jcc_short(j, CC_A);
+    emit1(j, 0xeb);					/* jmp ok */
+    emit1(j, 0);
+    ok = j->p - 1;
+    for (k = 0; k < 3; k++)
+	patch_short(j, bail[k]);
+    emit_exit(j, JIT_BAIL, pc, FALSE, i);
+    patch_short(j, ok);
+}
+
+/* Can the generator handle every instruction of the block? */
+static bool_t jit_covers(decode_ptr rec, int n)
+{
+    int i;
+    for (i = 0; i < n; i++)
+	if (rec[i].handler == H_CSR || rec[i].handler == H_LSTALE)
+	    return FALSE;
+    return TRUE;
+}
+
+/*
+ * jit_compile - generate native code for the n instructions in rec,
+ * followed by the block's closing record.  Returns NULL if the block
+ * can't be compiled.
+ */
+jit_fn jit_compile(sim_t s, decode_ptr rec, int n)
+{
+    static const byte_t branch_cc[] = {
+	/* H_BEQ */ CC_E, /* H_BNE */ CC_NE, /* H_BLT */ CC_L,
+	/* Same comparison as the bge case of sim_step */
+	/* H_BGE */ CC_G, /* H_BLTU */ CC_B, /* H_BGEU */ CC_AE
+    };
+    jit_buf_ptr j = s->jit;
+    byte_t *start;
+    decode_ptr d;
+    byte_t *skip;
+    int i;
+
+    if (!j) {
+	void *p = mmap(NULL, JIT_CODE_SIZE, PROT_READ|PROT_WRITE|PROT_EXEC,
+		       MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	j = s->jit = (jit_buf_ptr) calloc(1, sizeof(jit_buf_rec));
+	if (p == MAP_FAILED)
+	    j->broken = TRUE;
+	else
+	    j->code = j->p = (byte_t *) p;
+    }
+    if (j->broken)
+	return NULL;
+    if (!jit_covers(rec, n) ||
+	j->p + (n+2) * JIT_INSTR_MAX > j->code + JIT_CODE_SIZE) {
+	s->jit_rejected++;
+	return NULL;
+    }
+
+    start = j->p;
+    /* Prologue */
+    emit1(j, 0x55);			/* push rbp */
+    emit1(j, 0x53);			/* push rbx */
+    emit1(j, 0x41); emit1(j, 0x55);		/* push r13 */
+    emit1(j, 0x41); emit1(j, 0x56);		/* push r14 */
+    emit1(j, 0x41); emit1(j, 0x57);		/* push r15 */
+    emit1(j, 0x48); emit1(j, 0x89); emit1(j, 0xfd);	/* mov rbp, rdi */
+    emit1(j, 0x48); emit1(j, 0x8b); emit1(j, 0x5d);
+    emit1(j, offsetof(jit_ctx_rec, regs));	/* mov rbx, regs */
+    emit1(j, 0x4c); emit1(j, 0x8b); emit1(j, 0x6d);
+    emit1(j, offsetof(jit_ctx_rec, mem));	/* mov r13, mem */
+    emit1(j, 0x44); emit1(j, 0x8b); emit1(j, 0x75);
+    emit1(j, offsetof(jit_ctx_rec, limit));	/* mov r14d, limit */
+    emit1(j, 0x44); emit1(j, 0x8b); emit1(j, 0x7d);
+    emit1(j, offsetof(jit_ctx_rec, vale));	/* mov r15d, vale */
+
+    for (i = 0; i <= n; i++) {
+	d = &rec[i];
+	switch (d->handler) {
+	case H_LUI:
+	    emit_mov_imm(j, EAX, d->valc);
+	    emit_set_vale(j);
+	    emit_store_reg(j, d->rd, EAX);
+	    break;
+	case H_AUIPC:
+	    emit_mov_imm(j, EAX, d->tag + d->valc);
+	    emit_set_vale(j);
+	    emit_store_reg(j, d->rd, EAX);
+	    break;
+	case H_JAL:
+	    emit_mov_imm(j, EAX, d->tag + 4);
+	    emit_set_vale(j);
+	    emit_store_reg(j, d->rd, EAX);
+	    emit_exit(j, JIT_TAKEN, d->valc, FALSE, n);
+	    break;
+	case H_JALR:
+	    emit_load_reg(j, ECX, d->rs1);
+	    emit1(j, 0x81); emit1(j, 0xc1); emit4(j, d->valc);	/* add ecx, imm */
+	    emit_mov_imm(j, EAX, d->tag + 4);
+	    emit_set_vale(j);
+	    emit_store_reg(j, d->rd, EAX);
+	    emit1(j, 0x89); emit1(j, 0x4d);
+	    emit1(j, offsetof(jit_ctx_rec, pc));		/* mov pc, ecx */
+	    emit_exit(j, JIT_TAKEN, 0, TRUE, n);
+	    break;
+	case H_BEQ: case H_BNE: case H_BLT:
+	case H_BGE: case H_BLTU: case H_BGEU:
+	    emit_load_reg(j, EAX, d->rs1);
+	    emit_load_reg(j, ECX, d->rs2);
+	    emit1(j, 0x39); emit1(j, 0xc8);			/* cmp eax, ecx */
+	    skip = emit_jcc_short(j, branch_cc[d->handler - H_BEQ] ^ 1);
+	    emit_exit(j, JIT_TAKEN, d->tag + d->valc, FALSE, n);
+	    patch_short(j, skip);
+	    emit_exit(j, JIT_FALL, d->tag + 4, FALSE, n);
+	    break;
+	case H_BNONE:
+	    emit_exit(j, JIT_FALL, d->tag + 4, FALSE, n);
+	    break;
+	case H_LW:
+	    emit_load_reg(j, EAX, d->rs1);
+	    emit_alu_ri(j, H_ADDI, d->valc);
+	    emit_set_vale(j);
+	    emit_mem_addr(j, d->tag, i, FALSE);
+	    /* mov eax, [rdx+rdi] */
+	    emit1(j, 0x8b); emit1(j, 0x04); emit1(j, 0x3a);
+	    emit_store_reg(j, d->rd, EAX);
+	    break;
+	case H_SW:
+	    emit_load_reg(j, EAX, d->rs1);
+	    emit_alu_ri(j, H_ADDI, d->valc);
+	    emit_mem_addr(j, d->tag, i, TRUE);
+	    emit_set_vale(j);
+	    emit_load_reg(j, ECX, d->rs2);
+	    /* mov [rdx+rdi], ecx */
+	    emit1(j, 0x89); emit1(j, 0x0c); emit1(j, 0x3a);
+	    /* Tell the block engine, and leave if this block was rewritten */
+	    emit1(j, 0x89); emit1(j, 0xc6);			/* mov esi, eax */
+	    emit1(j, 0x48); emit1(j, 0x89); emit1(j, 0xef);	/* mov rdi, rbp */
+	    emit1(j, 0x48); emit1(j, 0xb8);
+	    emit8(j, (unsigned long long) jit_store);	/* mov rax, jit_store */
+	    emit1(j, 0xff); emit1(j, 0xd0);			/* call rax */
+	    emit1(j, 0x85); emit1(j, 0xc0);			/* test eax, eax */
+	    skip = emit_jcc_short(j, CC_E);
+	    emit_exit(j, JIT_STALE, d->tag + 4, FALSE, i + 1);
+	    patch_short(j, skip);
+	    break;
+	case H_ADDI: case H_SLLI: case H_SLTI: case H_SLTIU: case H_XORI:
+	case H_SRLI: case H_SRAI: case H_ORI: case H_ANDI:
+	    emit_load_reg(j, EAX, d->rs1);
+	    emit_alu_ri(j, d->handler, d->valc);
+	    emit_set_vale(j);
+	    emit_store_reg(j, d->rd, EAX);
+	    break;
+	case H_ADD: case H_SUB: case H_SLL: case H_SLT: case H_SLTU:
+	case H_XOR: case H_SRL: case H_SRA: case H_OR: case H_AND:
+	    emit_load_reg(j, EAX, d->rs1);
+	    emit_load_reg(j, ECX, d->rs2);
+	    emit_alu_rr(j, d->handler);
+	    emit_set_vale(j);
+	    emit_store_reg(j, d->rd, EAX);
+	    break;
+	default:
+	    /* The record closing a block that doesn't end in a jump */
+	    emit_exit(j, JIT_FALL, d->tag, FALSE, n);
+	    break;
+	}
+	if (i < n && d->handler >= H_JAL && d->handler <= H_BNONE)
+	    break;
+    }
+    s->jit_compiled++;
+    return (jit_fn) start;
+}
+
+/* Throw away all generated code */
+void jit_flush(sim_t s)
+{
+    if (s->jit)
+	s->jit->p = s->jit->code;
+}
+
+/* Free the native code buffer */
+void jit_free(sim_t s)
+{
+    if (s->jit) {
+	if (s->jit->code)
+	    munmap(s->jit->code, JIT_CODE_SIZE);
+	free(s->jit);
+	s->jit = NULL;
+    }
+}
+
+#else /* !(__x86_64__ && __unix__) */
+
+/* No code generator for this host, every block stays interpreted */
+jit_fn jit_compile(sim_t s, decode_ptr rec, int n)
+{
+    s->jit_rejected++;
+    return NULL;
+}
+
+void jit_flush(sim_t s)
+{
+}
+
+void jit_free(sim_t s)
+{
+}
+
+#endif
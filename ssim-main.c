@@ -0,0 +1,746 @@
+/***********************************************************************
+ *
+ * ssim-main.c - Command line interface to the RISC-V simulator
+ *
+ * Everything here goes through the library interface in libssim.h.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/time.h>
+#include "isa.h"
+#include "libssim.h"
+
+#define MAXARGS 128
+#define MAXBUF 1024
+
+/***************
+ * Begin Globals
+ ***************/
+
+/* Simulator name defined and initialized by the compiled HCL file */
+/* according to the -n argument supplied to hcl2c */
+extern char simname[];
+
+/* Parameters modifed by the command line */
+char *object_filename;   /* The input object file name. */
+FILE *object_file;       /* Input file handle */
+bool_t object_image = FALSE; /* Object file is an ELF or raw binary image */
+bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */
+word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
+bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
+char *engine = "seq";    /* Execution engine (-e) */
+bool_t do_cross = FALSE; /* Check engine against SEQ model? (-c) */
+char *batch_src = NULL;  /* Manifest or directory to run in batch (-b) */
+int batch_workers = 0;   /* Batch worker processes, 0 for one per core (-j) */
+char *batch_out = NULL;  /* Batch results file, stdout if NULL (-o) */
+long long mem_size = MEM_SIZE; /* Bytes of simulated memory (-m) */
+char *snap_out = NULL;   /* Snapshot of the loaded program to write (-s) */
+int trace_mask = TRACE_DEFAULT; /* Trace categories at verbosity 2 (-T) */
+char *btrace_out = NULL; /* Binary trace file to write (-B) */
+char *json_out = NULL;   /* Run summary to write as JSON, - for stdout (-J) */
+char *profile_out = NULL; /* Annotated listing to write (-P) */
+char *folded_out = NULL; /* Folded call stacks to write (-F) */
+char *bpred_spec = NULL; /* Branch predictors to run (-p) */
+char *branches_out = NULL; /* Mispredictions of each branch to write (-r) */
+char *cache_spec = NULL; /* Caches to simulate (-C) */
+int nharts = 1;          /* Harts sharing memory, a thread each (-H) */
+word_t quantum = 1000;   /* Instructions per turn of a hart, 0 for none (-q) */
+
+/*************
+ * End Globals
+ *************/
+
+
+/***************************
+ * Begin function prototypes
+ ***************************/
+
+static void usage(char *name);           /* Print helpful usage message */
+static void run_tty_sim(sim_t s);        /* Run simulator in TTY mode */
+static void run_harts(sim_t s, int ckpt0);
+static bool_t cross_check(sim_t s, mem_t mem0, mem_t reg0, word_t pc0,
+			  word_t icount, byte_t run_status);
+static bool_t is_yo_file(char *name);
+static bool_t is_stdout(char *name);
+static int parse_trace(char *list);
+static void write_summary(sim_t s, word_t icount, byte_t status,
+			  double secs);
+static void write_profile(sim_t s, char *name,
+			  bool_t (*write)(sim_t s, FILE *out));
+
+
+/*************************
+ * End function prototypes
+ *************************/
+
+
+/*******************************************************************
+ * This is the initial entry point that handles general
+ * initialization. It parses the command line and does any necessary
+ * setup to run in either TTY or GUI mode, and then starts the
+ * simulation.
+ *******************************************************************/
+
+int main(int argc, char **argv)
+{
+    int i;
+    int c;
+    sim_t s;
+
+    /* Parse the command line arguments */
+    while ((c = getopt(argc, argv, "htcgb:e:j:l:m:o:p:q:r:s:v:B:C:F:H:J:P:T:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'e':
+	    engine = optarg;
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'v':
+	    verbosity = atoi(optarg);
+	    if (verbosity < 0 || verbosity > 2) {
+		printf("Invalid verbosity %d\n", verbosity);
+		usage(argv[0]);
+	    }
+	    break;
+	case 't':
+	    do_check = TRUE;
+	    break;
+	case 'c':
+	    do_cross = TRUE;
+	    break;
+	case 'b':
+	    batch_src = optarg;
+	    break;
+	case 'j':
+	    batch_workers = atoi(optarg);
+	    break;
+	case 'o':
+	    batch_out = optarg;
+	    break;
+	case 'p':
+	    bpred_spec = optarg;
+	    break;
+	case 'r':
+	    branches_out = optarg;
+	    break;
+	case 's':
+	    snap_out = optarg;
+	    break;
+	case 'B':
+	    btrace_out = optarg;
+	    break;
+	case 'C':
+	    cache_spec = optarg;
+	    break;
+	case 'H':
+	    nharts = atoi(optarg);
+	    if (nharts < 1 || nharts > SIM_MAX_HARTS) {
+		printf("Invalid number of harts %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'q':
+	    quantum = atoi(optarg);
+	    if (quantum < 0) {
+		printf("Invalid quantum %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'J':
+	    json_out = optarg;
+	    break;
+	case 'P':
+	    profile_out = optarg;
+	    break;
+	case 'F':
+	    folded_out = optarg;
+	    break;
+	case 'T':
+	    trace_mask = parse_trace(optarg);
+	    if (trace_mask < 0) {
+		printf("Invalid trace categories %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'm':
+	    mem_size = parse_mem_size(optarg);
+	    if (mem_size == 0) {
+		printf("Invalid memory size %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	default:
+	    printf("Invalid option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+
+    /* Only hart 0 could be checked, traced or measured */
+    if (nharts > 1 && (do_check || do_cross || batch_src || btrace_out ||
+		       json_out || profile_out || folded_out || bpred_spec ||
+		       branches_out || cache_spec)) {
+	printf("-H only goes with -e, -l, -m, -q, -s and -v\n");
+	usage(argv[0]);
+    }
+
+    /* The ISA model is stepped alongside SEQ, whatever -e says */
+    if (do_check && strcmp(engine, "seq")) {
+	printf("-t only runs the seq engine\n");
+	usage(argv[0]);
+    }
+
+    /* With -J -, stdout carries the summary and nothing else */
+    if (is_stdout(json_out)) {
+	if (do_check || do_cross || is_stdout(profile_out) ||
+	    is_stdout(folded_out) || is_stdout(branches_out)) {
+	    printf("-J - doesn't go with -t, -c or another output to -\n");
+	    usage(argv[0]);
+	}
+	verbosity = 0;
+    }
+
+    s = sim_create();
+    if (!sim_set_engine(s, engine)) {
+	printf("Invalid engine %s\n", engine);
+	usage(argv[0]);
+    }
+    sim_set_mem_size(s, mem_size);
+    sim_set_trace(s, trace_mask);
+    if (branches_out && !bpred_spec)
+	bpred_spec = "tournament,gshare,bimodal,static";
+    if (bpred_spec && !sim_set_predictors(s, bpred_spec)) {
+	printf("Invalid branch predictors %s\n", bpred_spec);
+	usage(argv[0]);
+    }
+    if (cache_spec && !sim_set_caches(s, cache_spec)) {
+	printf("Invalid caches %s\n", cache_spec);
+	usage(argv[0]);
+    }
+
+    /* Batch mode runs its own programs */
+    if (batch_src) {
+	if (optind < argc) {
+	    printf("No object file allowed with -b\n");
+	    usage(argv[0]);
+	}
+	sim_destroy(s);
+	exit(sim_batch(batch_src, batch_workers, batch_out,
+		       engine, mem_size, instr_limit));
+    }
+
+    /* Do we have too many arguments? */
+    if (optind < argc - 1) {
+	printf("Too many command line arguments:");
+	for (i = optind; i < argc; i++)
+	    printf(" %s", argv[i]);
+	printf("\n");
+	usage(argv[0]);
+    }
+
+
+    /* The single unflagged argument should be the object file name */
+    object_filename = NULL;
+    object_file = NULL;
+    if (optind < argc && !is_yo_file(argv[optind])) {
+	/* Anything but a .yo file is loaded as an image */
+	object_filename = argv[optind];
+	object_image = TRUE;
+    } else if (optind < argc) {
+	object_filename = argv[optind];
+	object_file = fopen(object_filename, "r");
+	if (!object_file) {
+	    fprintf(stderr, "Couldn't open object file %s\n", object_filename);
+	    exit(1);
+	}
+    }
+
+    /* Otherwise, run the simulator in TTY mode (no -g flag) */
+    run_tty_sim(s);
+
+    sim_destroy(s);
+    exit(0);
+}
+
+/*
+ * run_tty_sim - Run the simulator in TTY mode
+ */
+static void run_tty_sim(sim_t s)
+{
+    word_t icount = 0;//the number of instruction
+    byte_t status = STAT_AOK;
+    long long byte_cnt = 0;//the number of byte
+    mem_t mem0 = NULL, reg0 = NULL;//initial value
+    int ckpt0 = 0;//checkpoint of the initial memory
+    word_t pc0;
+    state_ptr isa_state = NULL;//
+    bool_t check_ok = TRUE;
+    FILE *btrace_file = NULL;
+    struct timeval t0, t1;
+
+
+    /* In TTY mode, the default object file comes from stdin */
+    if (!object_file && !object_image) {
+	object_file = stdin;
+    }
+
+    /* Initializations */
+    if (verbosity >= 2)
+	sim_set_dumpfile(s, stdout);
+
+    /* Emit simulator name */
+    if (!is_stdout(json_out))
+	printf("%s\n", simname);
+
+    if (object_image) {
+	byte_cnt = sim_load_image(s, object_filename, 1);
+	if (byte_cnt == 0) {
+	    fprintf(stderr, "No code loaded from %s\n", object_filename);
+	    exit(1);
+	} else if (verbosity >= 2) {
+	    printf("%lld bytes of code loaded\n", byte_cnt);
+	}
+    } else {
+	byte_cnt = sim_load(s, object_file, 1);
+	if (byte_cnt == 0) {
+	    fprintf(stderr, "No lines of code found\n");
+	    exit(1);
+	} else if (verbosity >= 2) {
+	    printf("%lld bytes of code read\n", byte_cnt);
+	}
+	fclose(object_file);
+    }
+    pc0 = sim_get_pc(s);
+
+    if (snap_out && !sim_save_snapshot(s, snap_out)) {
+	fprintf(stderr, "Couldn't write snapshot %s\n", snap_out);
+	exit(1);
+    }
+
+    if (do_check) {
+	isa_state = new_state(0);
+	free_mem(isa_state->r);
+	free_mem(isa_state->m);
+	isa_state->m = copy_mem(sim_get_mem(s));
+	isa_state->r = copy_mem(sim_get_regs(s));
+	isa_state->pc = pc0;
+    }
+
+    /* The initial state is only needed to print changes, and for -c */
+    if (verbosity > 0)
+	ckpt0 = sim_checkpoint(s);	/* Only the pages written get copied */
+    if (nharts > 1) {
+	run_harts(s, ckpt0);
+	return;
+    }
+    if (verbosity > 0 || do_cross)
+	reg0 = copy_mem(sim_get_regs(s));
+    if (do_cross)
+	mem0 = copy_mem(sim_get_mem(s));
+
+
+    if (btrace_out) {
+	if ((btrace_file = fopen(btrace_out, "wb")) == NULL) {
+	    fprintf(stderr, "Couldn't open trace file %s\n", btrace_out);
+	    exit(1);
+	}
+	sim_set_trace_file(s, btrace_file);
+    }
+
+    if (json_out)
+	sim_set_counting(s, TRUE);
+    if (profile_out || folded_out)
+	sim_set_profiling(s, TRUE);
+
+    gettimeofday(&t0, NULL);
+    if (do_check)
+	icount = sim_run_checked(s, instr_limit, &status, isa_state, &check_ok);
+    else
+	icount = sim_run(s, instr_limit, &status);
+    gettimeofday(&t1, NULL);
+
+    if (json_out)
+	write_summary(s, icount, status, (t1.tv_sec - t0.tv_sec) +
+		      (t1.tv_usec - t0.tv_usec) / 1e6);
+    if (profile_out)
+	write_profile(s, profile_out, sim_write_profile);
+    if (folded_out)
+	write_profile(s, folded_out, sim_write_folded);
+    if (branches_out)
+	write_profile(s, branches_out, sim_write_branches);
+
+    if (btrace_file) {
+	if (!sim_set_trace_file(s, NULL) || fclose(btrace_file) != 0) {
+	    fprintf(stderr, "Couldn't write trace file %s\n", btrace_out);
+	    exit(1);
+	}
+    }
+
+    if (verbosity > 0) {
+	printf("%d instructions executed\n", icount);
+	printf("Status = %s\n", stat_name(status));
+	printf("Changed Register State:\n");
+	diff_reg(reg0, sim_get_regs(s), stdout);
+	printf("Changed Memory State:\n");
+	sim_diff_mem(s, ckpt0, stdout);
+	sim_report(s, stdout);
+    }
+
+    if (do_check) {
+	printf("%s\n", check_ok ? "ISA Check Succeeds" : "ISA Check Fails");
+	if (!check_ok)
+	    exit(1);
+    }
+
+    if (do_cross && !cross_check(s, mem0, reg0, pc0, icount, status))
+	exit(1);
+}
+
+/*
+ * run_harts - run nharts harts of the program loaded into s, and show
+ * what each did.  ckpt0 holds the initial memory if verbosity > 0.
+ */
+static void run_harts(sim_t s, int ckpt0)
+{
+    word_t *icounts = (word_t *) calloc(nharts, sizeof(word_t));
+    byte_t *statuses = (byte_t *) calloc(nharts, sizeof(byte_t));
+    mem_t *regs0 = (mem_t *) calloc(nharts, sizeof(mem_t));
+    long long total;
+    struct timeval t0, t1;
+    double secs;
+    int i;
+
+    /* Traces from harts on different threads would interleave */
+    sim_set_dumpfile(s, NULL);
+    sim_set_harts(s, nharts);
+    for (i = 0; i < nharts; i++)
+	regs0[i] = copy_reg(sim_get_regs(sim_get_hart(s, i)));
+
+    gettimeofday(&t0, NULL);
+    total = sim_run_harts(s, quantum, instr_limit, icounts, statuses);
+    gettimeofday(&t1, NULL);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+
+    if (verbosity > 0) {
+	for (i = 0; i < nharts; i++) {
+	    sim_t h = sim_get_hart(s, i);
+	    printf("Hart %d: %d instructions executed, pc = 0x%x\n",
+		   i, icounts[i], sim_get_pc(h));
+	    printf("Status = %s\n", stat_name(statuses[i]));
+	    printf("Changed Register State:\n");
+	    diff_reg(regs0[i], sim_get_regs(h), stdout);
+	}
+	printf("%lld instructions executed by %d harts\n", total, nharts);
+	printf("Changed Memory State:\n");
+	sim_diff_mem(s, ckpt0, stdout);
+    }
+    /* Timings differ from run to run, so they stay out of the results */
+    fprintf(stderr, "%d harts, %s, %.3f s, %.2f MIPS\n", nharts,
+	    quantum ? "taking turns" : "free-running", secs,
+	    secs > 0 ? total / secs / 1e6 : 0.0);
+
+    for (i = 0; i < nharts; i++)
+	free_reg(regs0[i]);
+    free(regs0);
+    free(icounts);
+    free(statuses);
+}
+
+/*
+ * cross_check - rerun the program from its initial state on the SEQ
+ * model and compare the final state with the one the selected engine
+ * left behind in s.  Return TRUE if they are the same.
+ */
+static bool_t cross_check(sim_t s, mem_t mem0, mem_t reg0, word_t pc0,
+			  word_t icount, byte_t run_status)
+{
+    sim_t seq = sim_create();
+    word_t icount0;
+    byte_t status0;
+    bool_t ok = TRUE;
+
+    /*
+     * Only a run stopped by the limit has writes left to make.  Those
+     * pending after a fault, such as a load's stale valm, aren't part
+     * of the state, and the engines leave different ones.
+     */
+    sim_set_dumpfile(s, NULL);
+    if (run_status == STAT_AOK)
+	sim_commit(s);
+
+    sim_load_state(seq, mem0, reg0);
+    sim_set_pc(seq, pc0);
+    icount0 = sim_run(seq, instr_limit, &status0);
+    if (status0 == STAT_AOK)
+	sim_commit(seq);
+
+    printf("Cross-check of %s against seq:\n", engine);
+    if (icount0 != icount || status0 != run_status) {
+	ok = FALSE;
+	printf("instructions:\t%d %s\t%d %s\n",
+	       icount0, stat_name(status0), icount, stat_name(run_status));
+    }
+    if (sim_get_pc(seq) != sim_get_pc(s)) {
+	ok = FALSE;
+	printf("pc:\t0x%.8x\t0x%.8x\n", sim_get_pc(seq), sim_get_pc(s));
+    }
+    if (diff_reg(sim_get_regs(seq), sim_get_regs(s), stdout))
+	ok = FALSE;
+    if (diff_mem(sim_get_mem(seq), sim_get_mem(s), stdout))
+	ok = FALSE;
+    printf("%s\n", ok ? "Final state matches" : "Final state differs");
+    sim_destroy(seq);
+    return ok;
+}
+
+
+/* Print str as a JSON string */
+static void json_string(FILE *out, char *str)
+{
+    fputc('"', out);
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    fprintf(out, "\\%c", *str);
+	else if ((unsigned char) *str < 0x20)
+	    fprintf(out, "\\u%04x", *str);
+	else
+	    fputc(*str, out);
+    }
+    fputc('"', out);
+}
+
+/*
+ * write_summary - write what the run did to json_out, as one JSON
+ * object.  secs is the host time the run took.
+ */
+static void write_summary(sim_t s, word_t icount, byte_t status,
+			  double secs)
+{
+    sim_counters_rec c;
+    sim_pipe_stats_rec p;
+    sim_bpred_stats_rec b;
+    sim_cache_stats_rec cs;
+    static char *repl_names[] = {"lru", "plru", "random"};
+    FILE *out = is_stdout(json_out) ? stdout : fopen(json_out, "w");
+    char *sep = "";
+    int i;
+
+    if (!out) {
+	fprintf(stderr, "Couldn't open summary file %s\n", json_out);
+	exit(1);
+    }
+    sim_get_counters(s, &c);
+    fprintf(out, "{\n  \"program\": ");
+    if (object_filename)
+	json_string(out, object_filename);
+    else
+	fprintf(out, "null");
+    fprintf(out, ",\n  \"engine\": ");
+    json_string(out, engine);
+    fprintf(out, ",\n  \"status\": ");
+    json_string(out, stat_name(status));
+    fprintf(out, ",\n  \"instructions\": %d,\n", icount);
+    fprintf(out, "  \"wall_seconds\": %.6f,\n", secs);
+    fprintf(out, "  \"mips\": %.3f,\n",
+	    secs > 0 ? icount / secs / 1e6 : 0.0);
+    fprintf(out, "  \"loads\": %lld,\n", c.loads);
+    fprintf(out, "  \"stores\": %lld,\n", c.stores);
+    fprintf(out, "  \"branches_taken\": %lld,\n", c.taken);
+    fprintf(out, "  \"branches_not_taken\": %lld,\n", c.not_taken);
+    fprintf(out, "  \"jal\": %lld,\n", c.jal);
+    fprintf(out, "  \"jalr\": %lld,\n", c.jalr);
+    fprintf(out, "  \"code_pages\": %lld,\n", c.code_pages);
+    fprintf(out, "  \"data_pages\": %lld,\n", c.data_pages);
+    fprintf(out, "  \"mnemonics\": {");
+    for (i = 0; i <= NUM_INSTR; i++) {
+	if (!c.ops[i])
+	    continue;
+	fprintf(out, "%s\n    ", sep);
+	json_string(out, i < NUM_INSTR ? instruction_set[i].name : "other");
+	fprintf(out, ": %lld", c.ops[i]);
+	sep = ",";
+    }
+    fprintf(out, "%s}", *sep ? "\n  " : "");
+    if (sim_get_pipe_stats(s, &p)) {
+	fprintf(out, ",\n  \"pipeline\": {\n");
+	fprintf(out, "    \"cycles\": %lld,\n", p.cycles);
+	fprintf(out, "    \"cpi\": %.4f,\n",
+		p.instrs ? (double) p.cycles / p.instrs : 0.0);
+	fprintf(out, "    \"mispredicts\": %lld,\n", p.mispredicts);
+	fprintf(out, "    \"cache_stall\": %lld,\n", p.cache_stall);
+	fprintf(out, "    \"bubbles\": {\"fill\": %lld, \"load_use\": %lld, "
+		"\"mispredict\": %lld, \"refetch\": %lld}\n  }",
+		p.fill, p.load_use, p.mispredict, p.refetch);
+    }
+    if (sim_get_bpred_stats(s, &b)) {
+	fprintf(out, ",\n  \"branch_prediction\": {\n");
+	fprintf(out, "    \"branches\": %lld,\n", b.branches);
+	fprintf(out, "    \"predictors\": {");
+	for (i = 0; i < b.npred; i++) {
+	    fprintf(out, "%s\n      ", i ? "," : "");
+	    json_string(out, b.names[i]);
+	    fprintf(out, ": {\"mispredicts\": %lld, \"accuracy\": %.4f}",
+		    b.misses[i], b.branches ?
+		    (double) (b.branches - b.misses[i]) / b.branches : 1.0);
+	}
+	fprintf(out, "%s},\n", b.npred ? "\n    " : "");
+	fprintf(out, "    \"btb\": {\"entries\": %d, \"ways\": %d, "
+		"\"lookups\": %lld, \"misses\": %lld},\n",
+		b.btb_entries, b.btb_ways, b.btb_lookups, b.btb_misses);
+	fprintf(out, "    \"ras\": {\"entries\": %d, \"returns\": %lld, "
+		"\"misses\": %lld}\n  }", b.ras_entries, b.returns, b.ras_misses);
+    }
+    if (sim_get_cache_stats(s, &cs)) {
+	fprintf(out, ",\n  \"caches\": {\n");
+	fprintf(out, "    \"memory_latency\": %d", cs.mem_latency);
+	for (i = 0; i < cs.ncaches; i++) {
+	    sim_cache_level_rec *l = &cs.c[i];
+	    fprintf(out, ",\n    ");
+	    json_string(out, l->name);
+	    fprintf(out, ": {\"size\": %lld, \"ways\": %d, \"line\": %d, "
+		    "\"latency\": %d,\n      \"replacement\": \"%s\", "
+		    "\"write_back\": %s, ", l->size, l->ways, l->line,
+		    l->latency, repl_names[l->repl],
+		    l->write_back ? "true" : "false");
+	    fprintf(out, "\"accesses\": %lld, \"misses\": %lld,\n      "
+		    "\"writebacks\": %lld, \"miss_rate\": %.4f, "
+		    "\"mpki\": %.4f, \"amat\": %.4f}",
+		    l->accesses, l->misses, l->writebacks,
+		    l->accesses ? (double) l->misses / l->accesses : 0.0,
+		    cs.c[0].accesses ?
+		    1000.0 * l->misses / cs.c[0].accesses : 0.0,
+		    l->latency + (l->accesses ?
+				  (double) l->miss_cycles / l->accesses : 0.0));
+	}
+	fprintf(out, "\n  }");
+    }
+    fprintf(out, "\n}\n");
+    if (out != stdout && fclose(out) != 0) {
+	fprintf(stderr, "Couldn't write summary file %s\n", json_out);
+	exit(1);
+    }
+}
+
+/*
+ * write_profile - write the profile of the run to file name (- for
+ * stdout) with write
+ */
+static void write_profile(sim_t s, char *name,
+			  bool_t (*write)(sim_t s, FILE *out))
+{
+    FILE *out = is_stdout(name) ? stdout : fopen(name, "w");
+    if (!out) {
+	fprintf(stderr, "Couldn't open profile file %s\n", name);
+	exit(1);
+    }
+    write(s, out);
+    if (out == stdout ? fflush(out) != 0 : fclose(out) != 0) {
+	fprintf(stderr, "Couldn't write profile file %s\n", name);
+	exit(1);
+    }
+}
+
+/* Is name a .yo file, rather than an image? */
+static bool_t is_yo_file(char *name)
+{
+    int len = strlen(name);
+    return len > 3 && !strcmp(name + len - 3, ".yo");
+}
+
+/* Is output file name - for stdout? */
+static bool_t is_stdout(char *name)
+{
+    return name && !strcmp(name, "-");
+}
+
+/* Trace categories selectable with -T */
+static struct {
+    char *name;
+    int mask;
+} trace_table[] =
+{
+    {"fetch",    TRACE_FETCH},
+    {"regwrite", TRACE_REGWRITE},
+    {"memwrite", TRACE_MEMWRITE},
+    {"branch",   TRACE_BRANCH},
+    {"all",      TRACE_ALL},
+    {"none",     0},
+    {NULL,       0}
+};
+
+/*
+ * parse_trace - turn a comma-separated list of trace category names
+ * into a mask.  Return -1 if any of them is unknown.
+ */
+static int parse_trace(char *list)
+{
+    int mask = 0;
+    char *p = list;
+    while (*p) {
+	int len = strcspn(p, ",");
+	int i;
+	for (i = 0; trace_table[i].name; i++)
+	    if ((int) strlen(trace_table[i].name) == len &&
+		!strncmp(p, trace_table[i].name, len))
+		break;
+	if (!trace_table[i].name)
+	    return -1;
+	mask |= trace_table[i].mask;
+	p += len;
+	if (*p == ',')
+	    p++;
+    }
+    return mask;
+}
+
+/*
+ * usage - print helpful diagnostic information
+ */
+static void usage(char *name)
+{
+    printf("Usage: %s [-htcg] [-e engine] [-l m] [-m size] [-s snap] [-B trace] [-J json] [-P prof] [-F folded] [-p preds] [-r branches] [-C caches] [-H harts] [-q quantum] [-T cats] [-v n] file.yo\n", name);
+    printf("       %s -b list [-e engine] [-l m] [-m size] [-j n] [-o out]\n", name);
+    printf("file.yo required in GUI mode, optional in TTY mode (default stdin)\n");
+    printf("Any other file is loaded as a snapshot, an ELF32 executable or a raw binary\n");
+    printf("   -h     Print this message\n");
+    printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");
+    printf("   -e eng Set execution engine: seq, threaded, block, jit, pipe\n"
+	   "          (default seq)\n");
+    printf("   -l m   Set instruction limit to m [TTY mode only] (default %d)\n", instr_limit);
+    printf("   -m s   Set memory size to s bytes, with K, M or G suffix, up to 4G\n"
+	   "          (default %dK)\n", MEM_SIZE / 1024);
+    printf("   -s f   Write a snapshot of the loaded program to f\n");
+    printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
+    printf("   -B f   Write a binary trace of the run to f, for sstrace to decode\n");
+    printf("   -J f   Count what the run does and write it to f as JSON (- for stdout,\n"
+	   "          which then holds nothing else)\n");
+    printf("   -P f   Profile the run and write a listing annotated with counts to f\n");
+    printf("   -F f   Profile the run and write its call stacks to f, folded\n");
+    printf("   -p l   Predict branches with predictors l, comma-separated from static,\n"
+	   "          bimodal, gshare, tournament, each optionally :size, with\n"
+	   "          btb=n[:ways] and ras=n; the first one steers fetch for pipe\n");
+    printf("   -r f   Predict branches and write how often each was mispredicted to f\n"
+	   "          (default predictors tournament,gshare,bimodal,static)\n");
+    printf("   -C l   Simulate caches l, comma-separated from l1i, l1d, l2, each\n"
+	   "          optionally =size[:ways[:line[:latency]]] and :lru, :plru or\n"
+	   "          :random and :wb or :wt, with mem=n cycles to memory\n");
+    printf("   -H n   Run n harts sharing memory, on threads, with a0 its number\n");
+    printf("   -q n   Let each hart run n instructions a turn, so runs repeat exactly,\n"
+	   "          or 0 to run them all at once (default %d)\n", quantum);
+    printf("   -T c   Trace categories c at verbosity 2, comma-separated from fetch,\n"
+	   "          regwrite, memwrite, branch, all, none (default fetch,memwrite)\n");
+    printf("   -t     Check each instruction of seq against the ISA model [TTY mode only]\n");
+    printf("   -c     Check final state of the engine against the SEQ model\n");
+    printf("   -b l   Run every .yo file in directory l, or listed in file l\n");
+    printf("   -j n   Use n batch worker processes (default one per core)\n");
+    printf("   -o f   Write batch results to f (default stdout)\n");
+    exit(0);
+}
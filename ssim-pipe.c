@@ -0,0 +1,484 @@
+/***********************************************************************
+ *
+ * ssim-pipe.c - Five-stage pipeline model of the RISC-V simulator
+ *
+ * Runs instructions through fetch, decode, execute, memory and
+ * writeback a stage per cycle, with the pipeline registers, forwarding
+ * and hazard control of a classic five-stage design.  The stall,
+ * bubble and forwarding decisions are control logic in hcl.c.  Fetch
+ * goes where the branch predictors say (ssim-bpred.c) if there are
+ * any, else follows jal to its target and otherwise assumes the next
+ * word; branches and jalr are resolved in execute, where the
+ * predictors learn from them, and the two instructions fetched behind
+ * them are squashed if fetch went the wrong way.  A
+ * load followed by an instruction using its result stalls decode for
+ * a cycle.
+ *
+ * Results are the same as sim_run: instructions are traced, counted,
+ * profiled and passed through the caches in order as they retire, and
+ * anything unusual (halt, bad instruction, address error) and the last
+ * instruction of the run travel down the pipeline without doing
+ * anything, to be handed to sim_step once everything before them has
+ * retired.  Cycles the caches take beyond a hit are added to the count
+ * as stalls.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+#include "sstrace.h"
+
+/* Make r a bubble */
+static void bubble(pipe_reg_ptr r, byte_t cause)
+{
+    r->stat = STAT_BUB;
+    r->cause = cause;
+    r->handoff = FALSE;
+    r->srcA = r->srcB = REG_NONE;
+    r->dstE = r->dstM = REG_NONE;
+}
+
+/* Start the pipeline empty at s->pc, with n instructions left to run */
+static void pipe_start(sim_t s, word_t n)
+{
+    pipe_ptr p = s->pipe;
+    p->F_predPC = s->pc;
+    bubble(&p->D, BUB_FILL);
+    bubble(&p->E, BUB_FILL);
+    bubble(&p->M, BUB_FILL);
+    bubble(&p->W, BUB_FILL);
+    p->vale = s->vale;
+    p->issued = 0;
+    p->last = n - 1;
+    p->stopped = FALSE;
+}
+
+/* Does the store of a word at addr overlap the instruction in r? */
+static bool_t overwrites(pipe_reg_ptr r, word_t addr)
+{
+    return r->stat != STAT_BUB && (uword_t) (r->pc - addr + 3) <= 6;
+}
+
+/*
+ * Retire the instruction in w: write its registers, and log, trace,
+ * count and profile it the way sim_step would have
+ */
+static void retire(sim_t s, pipe_reg_ptr w)
+{
+    decode_ptr d = &w->d;
+
+    if (TRACE_ON(s, TRACE_FETCH))
+	sim_log_fetch(s, d, w->pc);
+    if (s->btrace)
+	trace_instr(s->btrace, w->pc, d->valc, TRACE_FIELDS(d));
+    if (s->counts) {
+	count_instr(s->counts, d, w->pc);
+	if (d->icode == I_L)
+	    count_data(s->counts, w->vale, FALSE);
+	else if (d->icode == I_B)
+	    count_branch(s->counts, w->cond);
+    }
+    if (s->cache) {
+	cache_fetch(s->cache, w->pc);
+	if (d->icode == I_L)
+	    cache_data(s->cache, w->vale, FALSE);
+    }
+    if (s->prof)
+	profile_instr(s->prof, w->pc);
+    if (d->icode == I_B || d->icode == I_JAL || d->icode == I_JALR) {
+	if (TRACE_ON(s, TRACE_BRANCH))
+	    sim_log_branch(s, w->pc, d->icode != I_B || w->cond, w->newpc);
+	if (s->prof && d->icode != I_B)
+	    profile_jump(s->prof, d, w->pc, w->newpc);
+    }
+
+    /* Loads write rd twice, only the value loaded is traced */
+    if (w->dstE != REG_NONE && w->dstE != REG_X0) {
+	set_reg_val(s->reg, w->dstE, w->vale);
+	if (TRACE_ON(s, TRACE_REGWRITE) && w->dstE != w->dstM)
+	    sim_log_reg(s, w->dstE, w->vale);
+	if (s->btrace && w->dstE != w->dstM)
+	    trace_reg(s->btrace, w->dstE, w->vale);
+    }
+    if (w->dstM != REG_NONE && w->dstM != REG_X0) {
+	set_reg_val(s->reg, w->dstM, w->valm);
+	if (TRACE_ON(s, TRACE_REGWRITE))
+	    sim_log_reg(s, w->dstM, w->valm);
+	if (s->btrace)
+	    trace_reg(s->btrace, w->dstM, w->valm);
+    }
+
+    /* The store itself was done in the memory stage */
+    if (d->icode == I_S) {
+	if (TRACE_ON(s, TRACE_MEMWRITE))
+	    sim_log(s, "Wrote 0x%x to address 0x%x\n", w->valb, w->vale);
+	if (s->btrace)
+	    trace_mem(s->btrace, w->vale, w->valb);
+	if (s->counts)
+	    count_data(s->counts, w->vale, TRUE);
+	if (s->cache)
+	    cache_data(s->cache, w->vale, TRUE);
+    }
+}
+
+/*
+ * Execute the instruction in e, the same way as the handlers of the
+ * other engines, setting vale, cond and newpc
+ */
+static void execute(pipe_ptr p, pipe_reg_ptr e)
+{
+    word_t a = e->vala, b = e->valb, c = e->d.valc;
+
+    e->vale = p->vale;
+    e->cond = FALSE;
+    e->newpc = e->pc + 4;
+    switch (e->d.handler) {
+    case H_CSR:
+	e->vale = 0;
+	break;
+    case H_LUI:
+	e->vale = c;
+	break;
+    case H_AUIPC:
+	e->vale = e->pc + c;
+	break;
+    case H_JAL:
+	e->vale = e->pc + 4;
+	e->newpc = c;
+	break;
+    case H_JALR:
+	e->vale = e->pc + 4;
+	e->newpc = a + c;
+	break;
+    case H_BEQ:
+	e->cond = a == b;
+	break;
+    case H_BNE:
+	e->cond = a != b;
+	break;
+    case H_BLT:
+	e->cond = a < b;
+	break;
+    case H_BGE:
+	/* Same comparison as the bge case of sim_step */
+	e->cond = a > b;
+	break;
+    case H_BLTU:
+	e->cond = (uword_t) a < (uword_t) b;
+	break;
+    case H_BGEU:
+	e->cond = (uword_t) a >= (uword_t) b;
+	break;
+    case H_LW:
+    case H_SW:
+	e->vale = a + c;
+	break;
+    case H_ADDI:
+	e->vale = a + c;
+	break;
+    case H_SLLI:
+	e->vale = a << (c & 0x1f);
+	break;
+    case H_SLTI:
+	e->vale = a < c;
+	break;
+    case H_SLTIU:
+	/* Same comparison as the sltiu case of sim_step */
+	e->vale = a > c;
+	break;
+    case H_XORI:
+	e->vale = a ^ c;
+	break;
+    case H_SRLI:
+	e->vale = (uword_t) a >> (c & 0x1f);
+	break;
+    case H_SRAI:
+	e->vale = a >> (c & 0x1f);
+	break;
+    case H_ORI:
+	e->vale = a | c;
+	break;
+    case H_ANDI:
+	e->vale = a & c;
+	break;
+    case H_ADD:
+	e->vale = a + b;
+	break;
+    case H_SUB:
+	e->vale = a - b;
+	break;
+    case H_SLL:
+	e->vale = a << (b & 0x1f);
+	break;
+    case H_SLT:
+	e->vale = a < b;
+	break;
+    case H_SLTU:
+	e->vale = (uword_t) a < (uword_t) b;
+	break;
+    case H_XOR:
+	e->vale = a ^ b;
+	break;
+    case H_SRL:
+	e->vale = (uword_t) a >> (b & 0x1f);
+	break;
+    case H_SRA:
+	e->vale = a >> (b & 0x1f);
+	break;
+    case H_OR:
+	e->vale = a | b;
+	break;
+    case H_AND:
+	e->vale = a & b;
+	break;
+    default:
+	/* H_LSTALE loads from the old vale, branches leave it */
+	break;
+    }
+    if (e->cond)
+	e->newpc = e->pc + c;
+    p->vale = e->vale;
+}
+
+/*
+ * sim_run_pipe - run the pipeline a cycle at a time until max_instr
+ * instructions have retired or one of them stops the run
+ */
+word_t sim_run_pipe(sim_t s, word_t max_instr, byte_t *statusp)
+{
+    word_t icount = 0;
+    byte_t run_status = STAT_AOK;
+    long long hits_before, misses_before;
+    long long stall = s->cache ? cache_stall(s->cache) : 0;
+    pipe_ptr p;
+
+    if (!s->pipe)
+	s->pipe = (pipe_ptr) calloc(1, sizeof(pipe_rec));
+    p = s->pipe;
+    if (max_instr <= 0)
+	goto done;
+
+    sim_commit(s);
+    s->status = STAT_AOK;
+    pipe_start(s, max_instr);
+
+    for (;;) {
+	pipe_reg_rec W, M, E, D;
+	bool_t fault = FALSE, executed = FALSE;
+	pipe_reg_ptr refetch = NULL;
+	bool_t mispredict, handoff, D_stall, D_bubble, E_bubble;
+
+	p->st.cycles++;
+
+	/* Writeback, first so that decode reads what it writes */
+	if (p->W.handoff) {
+	    s->pc_in = p->W.pc;
+	    s->vale = p->vale;
+	    hits_before = s->predecode_hits;
+	    misses_before = s->predecode_misses;
+	    run_status = sim_step(s);
+	    s->predecode_hits = hits_before;
+	    s->predecode_misses = misses_before;
+	    icount++;
+	    p->st.instrs++;
+	    if (run_status != STAT_AOK || icount >= max_instr)
+		break;
+	    sim_commit(s);
+	    pipe_start(s, max_instr - icount);
+	    continue;
+	}
+	if (p->W.stat == STAT_BUB) {
+	    switch (p->W.cause) {
+	    case BUB_FILL:
+		p->st.fill++;
+		break;
+	    case BUB_LOAD:
+		p->st.load_use++;
+		break;
+	    case BUB_MISPREDICT:
+		p->st.mispredict++;
+		break;
+	    case BUB_REFETCH:
+		p->st.refetch++;
+		break;
+	    }
+	} else {
+	    retire(s, &p->W);
+	    icount++;
+	    p->st.instrs++;
+	}
+
+	/* Memory */
+	p->m_valM = 0;
+	if (p->M.stat != STAT_BUB && !p->M.handoff) {
+	    s->icode = p->M.d.icode;
+	    if (gen_mem_read(s)) {
+		fault = !get_halfword_val(s->mem, p->M.vale, &p->M.valm);
+		p->m_valM = p->M.valm;
+	    } else if (gen_mem_write(s)) {
+		fault = !set_halfword_val(s->mem, p->M.vale, p->M.valb);
+		if (!fault) {
+		    predecode_invalidate(s, p->M.vale);
+		    block_invalidate(s, p->M.vale);
+		    /* Anything fetched since from what it wrote is stale */
+		    if (overwrites(&p->E, p->M.vale))
+			refetch = &p->E;
+		    else if (overwrites(&p->D, p->M.vale))
+			refetch = &p->D;
+		}
+	    }
+	}
+	if (fault) {
+	    /* sim_step will find the fault again, with nothing after it */
+	    p->W = p->M;
+	    p->W.handoff = TRUE;
+	    p->stopped = TRUE;
+	    bubble(&p->M, BUB_FILL);
+	    bubble(&p->E, BUB_FILL);
+	    bubble(&p->D, BUB_FILL);
+	    continue;
+	}
+	if (refetch == &p->E) {
+	    /* Nothing after the store has run yet, start again from it */
+	    p->F_predPC = p->E.pc;
+	    p->issued--;
+	    p->stopped = FALSE;
+	    p->W = p->M;
+	    bubble(&p->M, BUB_REFETCH);
+	    bubble(&p->E, BUB_REFETCH);
+	    bubble(&p->D, BUB_REFETCH);
+	    continue;
+	}
+
+	/* Execute */
+	p->e_dstE = REG_NONE;
+	p->e_target = p->E.predpc;
+	if (p->E.stat != STAT_BUB && !p->E.handoff) {
+	    execute(p, &p->E);
+	    if (s->bpred)
+		bpred_update(s->bpred, &p->E.d, p->E.pc,
+			     p->E.d.icode != I_B || p->E.cond, p->E.newpc);
+	    p->e_dstE = p->E.dstE;
+	    p->e_valE = p->E.vale;
+	    p->e_target = p->E.newpc;
+	    executed = TRUE;
+	}
+
+	/* Decode, with the fields where the control logic looks for them */
+	p->d_srcA = p->d_srcB = REG_NONE;
+	D = p->D;
+	if (D.stat != STAT_BUB) {
+	    s->icode = D.d.icode;
+	    s->rs1 = D.d.rs1;
+	    s->rs2 = D.d.rs2;
+	    s->rd = D.d.rd;
+	    p->d_srcA = D.srcA = gen_srcA(s);
+	    p->d_srcB = D.srcB = gen_srcB(s);
+	    D.dstE = gen_dstE(s);
+	    D.dstM = gen_dstM(s);
+	    D.vala = gen_d_valA(s);
+	    D.valb = gen_d_valB(s);
+	}
+
+	mispredict = gen_e_mispredict(s);
+	handoff = gen_d_handoff(s);
+	D_stall = gen_D_stall(s);
+	D_bubble = gen_D_bubble(s);
+	E_bubble = gen_E_bubble(s);
+	if (mispredict && executed)
+	    p->st.mispredicts++;
+
+	/* Clock the pipeline registers */
+	W = p->M;
+	M = p->E;
+	if (refetch == &p->D && !mispredict) {
+	    /* Drop what decode has, and fetch it again */
+	    p->F_predPC = p->D.pc;
+	    bubble(&E, BUB_REFETCH);
+	    bubble(&D, BUB_REFETCH);
+	} else {
+	    if (E_bubble)
+		bubble(&E, mispredict ? BUB_MISPREDICT : BUB_LOAD);
+	    else {
+		E = D;
+		if (E.stat != STAT_BUB) {
+		    p->issued++;
+		    if (handoff) {
+			E.handoff = TRUE;
+			E.dstE = E.dstM = REG_NONE;
+			p->stopped = TRUE;
+		    }
+		}
+	    }
+	    if (D_stall)
+		D = p->D;
+	    else if (D_bubble)
+		bubble(&D, mispredict ? BUB_MISPREDICT : BUB_FILL);
+	    else {
+		/* Fetch, as decode takes what it gets */
+		decode_ptr f;
+		p->f_pc = p->F_predPC;
+		f = fetch_decoded(s, p->f_pc);
+		p->f = *f;
+		D.stat = s->imem_error ? STAT_ADR :
+		    f->handler == H_BAD ? STAT_INS :
+		    f->handler == H_HALT ? STAT_HLT : STAT_AOK;
+		D.handoff = FALSE;
+		D.pc = p->f_pc;
+		D.d = *f;
+		if (s->bpred)
+		    p->f_bpredPC = bpred_predict(s->bpred, f, p->f_pc);
+		D.predpc = p->F_predPC = gen_f_predPC(s);
+	    }
+	}
+	if (mispredict)
+	    p->F_predPC = p->e_target;
+	p->W = W;
+	p->M = M;
+	p->E = E;
+	p->D = D;
+    }
+
+ done:
+    /* Everything waits while the caches do */
+    if (s->cache) {
+	stall = cache_stall(s->cache) - stall;
+	p->st.cache_stall += stall;
+	p->st.cycles += stall;
+    }
+    if (statusp)
+	*statusp = run_status;
+    return icount;
+}
+
+bool_t sim_get_pipe_stats(sim_t s, sim_pipe_stats_ptr p)
+{
+    if (!s->pipe)
+	return FALSE;
+    *p = s->pipe->st;
+    return TRUE;
+}
+
+void pipe_report(sim_t s, FILE *outfile)
+{
+    sim_pipe_stats_rec st;
+    if (!sim_get_pipe_stats(s, &st))
+	return;
+    fprintf(outfile, "Pipeline: %lld cycles, %lld instructions, CPI %.3f\n",
+	    st.cycles, st.instrs, st.instrs ? (double) st.cycles / st.instrs : 0.0);
+    fprintf(outfile, "Bubbles: %lld filling, %lld load/use, "
+	    "%lld mispredicted (%lld mispredicts), %lld refetching\n",
+	    st.fill, st.load_use, st.mispredict, st.mispredicts, st.refetch);
+    if (s->cache)
+	fprintf(outfile, "Cache stalls: %lld cycles\n", st.cache_stall);
+}
+
+void pipe_free(sim_t s)
+{
+    free(s->pipe);
+    s->pipe = NULL;
+}
@@ -0,0 +1,295 @@
+/***********************************************************************
+ *
+ * ssim-profile.c - Per-pc profile with call stacks
+ *
+ * The engines count each instruction run with profile_instr (sim.h),
+ * which adds to a counter for its pc and one for the call stack it ran
+ * in.  Calls and returns move between call stacks, kept as a tree with
+ * one node per function called from each stack, so what a function
+ * ran can be told apart by where it was called from.  The stack of
+ * calls not yet returned from is a shadow of the program's own: a
+ * return goes back to the innermost call whose return address it
+ * matches, and one that matches none is taken as a plain jump.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+
+/* Deepest call stack followed; calls deeper than this are jumps */
+#define PROF_DEPTH 1024
+
+/* A call stack: the one it was called from and the function called */
+struct prof_node_rec {
+    int parent;		/* -1 for the outermost */
+    word_t func;
+    long long self;	/* Instructions run in this stack */
+};
+
+/* A call not yet returned from */
+struct prof_frame_rec {
+    int node;		/* Stack it was made from */
+    word_t ret;		/* Where it returns to */
+};
+
+void hash_init(hash_index_ptr h, int size)
+{
+    int i;
+    h->slots = (hash_slot_ptr) malloc(size * sizeof(hash_slot_rec));
+    for (i = 0; i < size; i++)
+	h->slots[i].n = -1;
+    h->mask = size - 1;
+    h->count = 0;
+}
+
+void hash_add(hash_index_ptr h, hash_slot_ptr e, int n, unsigned hash)
+{
+    hash_slot_ptr old = h->slots;
+    unsigned i, size = h->mask + 1;
+    int count;
+
+    e->n = n;
+    e->hash = hash;
+    count = ++h->count;
+
+    /* Keep the table no more than half full */
+    if (2 * (unsigned) count <= size)
+	return;
+    hash_init(h, 2 * size);
+    h->count = count;
+    for (i = 0; i < size; i++)
+	if (old[i].n >= 0) {
+	    for (e = hash_first(h, old[i].hash); e->n >= 0;
+		 e = hash_next(h, e))
+		;
+	    *e = old[i];
+	}
+    free(old);
+}
+
+static unsigned node_hash(int parent, word_t func)
+{
+    return ((unsigned) parent * 0x9e3779b1u) ^ ((uword_t) func * 0x85ebca6bu);
+}
+
+/* Make node the current stack */
+static void set_cur(prof_ptr p, int node)
+{
+    p->cur = node;
+    p->self = &p->nodes[node].self;
+}
+
+/* Return the node for func called from stack parent, adding it if new */
+static int get_node(prof_ptr p, int parent, word_t func)
+{
+    unsigned hash = node_hash(parent, func);
+    hash_slot_ptr e;
+    int n;
+
+    for (e = hash_first(&p->index, hash); (n = e->n) >= 0;
+	 e = hash_next(&p->index, e))
+	if (e->hash == hash && p->nodes[n].parent == parent &&
+	    p->nodes[n].func == func)
+	    return n;
+
+    if (p->nnodes == p->maxnodes) {
+	p->maxnodes *= 2;
+	p->nodes = (struct prof_node_rec *)
+	    realloc(p->nodes, p->maxnodes * sizeof(struct prof_node_rec));
+	p->self = &p->nodes[p->cur].self;
+    }
+    n = p->nnodes++;
+    p->nodes[n].parent = parent;
+    p->nodes[n].func = func;
+    p->nodes[n].self = 0;
+    hash_add(&p->index, e, n, hash);
+    return n;
+}
+
+long long *profile_page(prof_ptr p, word_t pc)
+{
+    long long **c = &p->pcs[(uword_t) pc >> PAGE_BITS];
+    *c = (long long *) calloc(PAGE_SIZE / 4, sizeof(long long));
+    return *c;
+}
+
+void profile_call(prof_ptr p, word_t target, word_t ret)
+{
+    if (p->depth == PROF_DEPTH)
+	return;
+    p->stack[p->depth].node = p->cur;
+    p->stack[p->depth].ret = ret;
+    p->depth++;
+    set_cur(p, get_node(p, p->cur, target));
+}
+
+void profile_return(prof_ptr p, word_t target)
+{
+    int i;
+    for (i = p->depth - 1; i >= 0; i--)
+	if (p->stack[i].ret == target) {
+	    set_cur(p, p->stack[i].node);
+	    p->depth = i;
+	    return;
+	}
+}
+
+void sim_set_profiling(sim_t s, bool_t on)
+{
+    prof_ptr p = s->prof;
+    int i;
+
+    if (p) {
+	for (i = 0; i < 1 << (32 - PAGE_BITS); i++)
+	    free(p->pcs[i]);
+	free(p->pcs);
+	free(p->nodes);
+	free(p->index.slots);
+	free(p->stack);
+	free(p);
+	s->prof = NULL;
+    }
+    if (!on)
+	return;
+
+    p = (prof_ptr) calloc(1, sizeof(prof_rec));
+    p->pcs = (long long **) calloc(1 << (32 - PAGE_BITS), sizeof(long long *));
+    p->maxnodes = 64;
+    p->nodes = (struct prof_node_rec *)
+	malloc(p->maxnodes * sizeof(struct prof_node_rec));
+    hash_init(&p->index, 2 * p->maxnodes);
+    p->stack = (struct prof_frame_rec *)
+	malloc(PROF_DEPTH * sizeof(struct prof_frame_rec));
+
+    /* The outermost stack is whatever runs next */
+    p->nnodes = 1;
+    p->nodes[0].parent = -1;
+    p->nodes[0].func = s->pc_in;
+    p->nodes[0].self = 0;
+    set_cur(p, 0);
+    s->prof = p;
+}
+
+/* Print the name of address a: its label, or one below it plus an offset */
+static void print_addr(sim_t s, FILE *out, word_t a)
+{
+    word_t off;
+    char *name = find_label(s->syms, a, &off);
+    if (!name)
+	fprintf(out, "0x%x", a);
+    else if (off == 0)
+	fputs(name, out);
+    else
+	fprintf(out, "%s+0x%x", name, off);
+}
+
+bool_t sim_write_folded(sim_t s, FILE *out)
+{
+    prof_ptr p = s->prof;
+    int *chain;
+    int i;
+
+    if (!p)
+	return FALSE;
+    chain = (int *) malloc((PROF_DEPTH + 1) * sizeof(int));
+    for (i = 0; i < p->nnodes; i++) {
+	int n, len = 0;
+	if (!p->nodes[i].self)
+	    continue;
+	for (n = i; n >= 0; n = p->nodes[n].parent)
+	    chain[len++] = n;
+	while (len-- > 0) {
+	    print_addr(s, out, p->nodes[chain[len]].func);
+	    fputc(len ? ';' : ' ', out);
+	}
+	fprintf(out, "%lld\n", p->nodes[i].self);
+    }
+    free(chain);
+    return TRUE;
+}
+
+void print_instr(FILE *out, decode_ptr d, word_t pc)
+{
+    char *name = iname(d->icode, d->ifun1, d->ifun2);
+    switch (d->icode) {
+    case I_LUI:
+    case I_AUIPC:
+	fprintf(out, "%s %s, 0x%x", name, reg_name(d->rd), d->valc);
+	break;
+    case I_JAL:
+	fprintf(out, "%s %s, 0x%x", name, reg_name(d->rd), d->valc);
+	break;
+    case I_JALR:
+    case I_L:
+	fprintf(out, "%s %s, %d(%s)", name, reg_name(d->rd), d->valc,
+		reg_name(d->rs1));
+	break;
+    case I_S:
+	fprintf(out, "%s %s, %d(%s)", name, reg_name(d->rs2), d->valc,
+		reg_name(d->rs1));
+	break;
+    case I_B:
+	fprintf(out, "%s %s, %s, 0x%x", name, reg_name(d->rs1),
+		reg_name(d->rs2), pc + d->valc);
+	break;
+    case I_OP:
+	fprintf(out, "%s %s, %s, %d", name, reg_name(d->rd),
+		reg_name(d->rs1), d->valc);
+	break;
+    case I_R:
+	fprintf(out, "%s %s, %s, %s", name, reg_name(d->rd),
+		reg_name(d->rs1), reg_name(d->rs2));
+	break;
+    case I_AMO:
+	if (d->ifun2 == 0x08)	/* lr.w */
+	    fprintf(out, "%s %s, (%s)", name, reg_name(d->rd),
+		    reg_name(d->rs1));
+	else
+	    fprintf(out, "%s %s, %s, (%s)", name, reg_name(d->rd),
+		    reg_name(d->rs2), reg_name(d->rs1));
+	break;
+    default:
+	fputs(name, out);
+    }
+}
+
+bool_t sim_write_profile(sim_t s, FILE *out)
+{
+    prof_ptr p = s->prof;
+    long long total = 0;
+    uword_t i, j;
+
+    if (!p)
+	return FALSE;
+    for (i = 0; i < 1u << (32 - PAGE_BITS); i++)
+	if (p->pcs[i])
+	    for (j = 0; j < PAGE_SIZE / 4; j++)
+		total += p->pcs[i][j];
+
+    fprintf(out, "%12s %7s  %-10s  %s\n", "runs", "%", "pc", "instruction");
+    for (i = 0; i < 1u << (32 - PAGE_BITS); i++) {
+	if (!p->pcs[i])
+	    continue;
+	for (j = 0; j < PAGE_SIZE / 4; j++) {
+	    word_t pc = (i << PAGE_BITS) + 4 * j;
+	    long long runs = p->pcs[i][j];
+	    word_t off;
+	    char *name;
+	    if (!runs)
+		continue;
+	    name = find_label(s->syms, pc, &off);
+	    if (name && off == 0)
+		fprintf(out, "%s:\n", name);
+	    fprintf(out, "%12lld %6.2f%%  0x%08x  ", runs,
+		    100.0 * runs / total, pc);
+	    print_instr(out, peek_decoded(s, pc), pc);
+	    fputc('\n', out);
+	}
+    }
+
+    return TRUE;
+}
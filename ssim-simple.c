@@ -2,527 +2,699 @@
  *
  * ssim.c - Sequential RISC-V simulator
  *
+ * The core of libssim: the SEQ model, the predecode cache and the
+ * library interface declared in libssim.h.  Every routine works on the
+ * simulator it is given, so separate simulators don't share anything.
+ *
  ***********************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
-#include <unistd.h>
 #include <string.h>
 #include "isa.h"
+#include "libssim.h"
 #include "sim.h"
+#include "sstrace.h"
+
+/* Execution engines selectable with sim_set_engine */
+static struct {
+    char *name;
+    word_t (*run)(sim_t s, word_t max_instr, byte_t *statusp);
+    void (*report)(sim_t s, FILE *outfile);  /* Engine statistics, may be NULL */
+} engine_table[] =
+{
+    {"seq",      sim_run_seq,      NULL},
+    {"threaded", sim_run_threaded, NULL},
+    {"block",    sim_run_block,    block_report},
+    {"jit",      sim_run_jit,      jit_report},
+    {"pipe",     sim_run_pipe,     pipe_report},
+    {NULL,       NULL,             NULL}
+};
 
-#define MAXARGS 128
-#define MAXBUF 1024
-
-/***************
- * Begin Globals
- ***************/
-
-/* Simulator name defined and initialized by the compiled HCL file */
-/* according to the -n argument supplied to hcl2c */
-extern char simname[];
-
-/* Parameters modifed by the command line */
-char *object_filename;   /* The input object file name. */
-FILE *object_file;       /* Input file handle */
-bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */
-word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
-bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
-
-/*************
- * End Globals
- *************/
-
-
-/***************************
- * Begin function prototypes
- ***************************/
-
-static void usage(char *name);           /* Print helpful usage message */
-static void run_tty_sim();               /* Run simulator in TTY mode */
-
-
-/*************************
- * End function prototypes
- *************************/
+static void update_state(sim_t s);
+static void predecode_flush(sim_t s);
+static void drop_checkpoints(sim_t s);
 
 
-/*******************************************************************
- * Part 1: This part is the initial entry point that handles general
- * initialization. It parses the command line and does any necessary
- * setup to run in either TTY or GUI mode, and then starts the
- * simulation.
- *******************************************************************/
+/***********************************
+ * Part 1: Creating and loading a simulator
+ ***********************************/
 
-/*
- * sim_main - main simulator routine. This function is called from the
- * main() routine in the HCL file.
- */
-int sim_main(int argc, char **argv)
+sim_t sim_create()
 {
-    int i;
-    int c;
-
-    /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
-	switch(c) {
-	case 'h':
-	    usage(argv[0]);
-	    break;
-	case 'l':
-	    instr_limit = atoll(optarg);
-	    break;
-	case 'v':
-	    verbosity = atoi(optarg);
-	    if (verbosity < 0 || verbosity > 2) {
-		printf("Invalid verbosity %d\n", verbosity);
-		usage(argv[0]);
-	    }
-	    break;
-	case 't':
-	    do_check = TRUE;
-	    break;
-	default:
-	    printf("Invalid option '%c'\n", c);
-	    usage(argv[0]);
-	    break;
-	}
-    }
-
-
-    /* Do we have too many arguments? */
-    if (optind < argc - 1) {
-	printf("Too many command line arguments:");
-	for (i = optind; i < argc; i++)
-	    printf(" %s", argv[i]);
-	printf("\n");
-	usage(argv[0]);
-    }
+    sim_t s = (sim_t) calloc(1, sizeof(struct sim_rec));
 
+    /* Create memory and register files */
+    s->mem = init_mem(MEM_SIZE);
+    s->reg = init_reg();
+    s->syms = new_symtab();
+    s->status = STAT_AOK;
+    s->trace = TRACE_DEFAULT;
+    sim_reset(s);
+    return s;
+}
 
-    /* The single unflagged argument should be the object file name */
-    object_filename = NULL;
-    object_file = NULL;
-    if (optind < argc) {
-	object_filename = argv[optind];
-	object_file = fopen(object_filename, "r");
-	if (!object_file) {
-	    fprintf(stderr, "Couldn't open object file %s\n", object_filename);
-	    exit(1);
-	}
+void sim_destroy(sim_t s)
+{
+    sim_set_harts(s, 1);
+    if (s->btrace)
+	trace_close(s->btrace);
+    sim_set_counting(s, FALSE);
+    sim_set_profiling(s, FALSE);
+    sim_set_predictors(s, NULL);
+    sim_set_caches(s, NULL);
+    block_free(s);
+    jit_free(s);
+    pipe_free(s);
+    free(s->predecode);
+    /* The other harts only borrow the memory of hart 0 */
+    if (!s->hartid) {
+	drop_checkpoints(s);
+	free_mem(s->mem);
     }
+    free_reg(s->reg);
+    free_symtab(s->syms);
+    free(s);
+}
 
-    /* Otherwise, run the simulator in TTY mode (no -g flag) */
-    run_tty_sim();
+void sim_reset(sim_t s)
+{
+    sim_set_harts(s, 1);
+    drop_checkpoints(s);
+    clear_mem(s->mem);
+    clear_mem(s->reg);
+    clear_symtab(s->syms);
+    predecode_flush(s);
+    block_flush(s);
+
+    set_reg_val(s->reg, REG_X0, 0);
+    s->pc = 0;
+    s->pc_in = 0;
+
+    s->destE = REG_NONE;
+    s->destM = REG_NONE;
+    s->mem_write = FALSE;
+    s->mem_addr = 0;
+    s->mem_data = 0;
 
-    exit(0);
+    /* Reset intermediate values to clear display */
+    s->icode = I_NOP;
+    s->ifun1 = 0;
+    s->ifun2 = 0;
+    s->instr = 0;
+    s->rs1 = REG_NONE;
+    s->rs2 = REG_NONE;
+    s->rd = REG_NONE;
+    s->valc = 0;
+    s->valp = 0;
+
+    s->srcA = REG_NONE;
+    s->srcB = REG_NONE;
+    s->vala = 0;
+    s->valb = 0;
+    s->vale = 0;
+
+    s->cond = FALSE;
+    s->valm = 0;
+    s->status = STAT_AOK;
+    s->resv = FALSE;
 }
 
-/*
- * run_tty_sim - Run the simulator in TTY mode
- */
-static void run_tty_sim()
+long long sim_load(sim_t s, FILE *infile, int report_error)
 {
-    word_t icount = 0;//the number of instruction
-    status = STAT_AOK;
-    word_t byte_cnt = 0;//the number of byte
-    mem_t mem0, reg0;//initial value
-    state_ptr isa_state = NULL;//
+    return load_mem(s->mem, infile, report_error, s->syms);
+}
 
+long long sim_load_image(sim_t s, char *fname, int report_error)
+{
+    word_t entry;
+    long long cnt;
+    sim_set_harts(s, 1);
+    drop_checkpoints(s);
+    clear_symtab(s->syms);
+    if (is_snapshot(fname)) {
+	mem_t m = load_snapshot(fname, s->reg, &entry, report_error);
+	if (!m)
+	    return 0;
+	free_mem(s->mem);
+	s->mem = m;
+	cnt = (long long) m->resident * PAGE_SIZE;
+    } else
+	cnt = load_image(s->mem, fname, &entry, report_error);
+    predecode_flush(s);
+    block_flush(s);
+    if (cnt > 0)
+	s->pc = s->pc_in = entry;
+    return cnt;
+}
 
-    /* In TTY mode, the default object file comes from stdin */
-    if (!object_file) {
-	object_file = stdin;
-    }
+bool_t sim_save_snapshot(sim_t s, char *fname)
+{
+    return save_snapshot(s->mem, s->reg, s->pc, fname);
+}
 
-    /* Initializations */
-    if (verbosity >= 2)
-	sim_set_dumpfile(stdout);
-    sim_init();
+void sim_load_state(sim_t s, mem_t m, mem_t r)
+{
+    sim_set_harts(s, 1);
+    drop_checkpoints(s);
+    free_mem(s->mem);
+    free_reg(s->reg);
+    s->mem = copy_mem(m);
+    s->reg = copy_reg(r);
+    predecode_flush(s);
+    block_flush(s);
+}
 
-    /* Emit simulator name */
-    printf("%s\n", simname);
+bool_t sim_set_mem_size(sim_t s, long long len)
+{
+    if (len <= 0 || len > (1LL << 32))
+	return FALSE;
+    sim_set_harts(s, 1);
+    drop_checkpoints(s);
+    free_mem(s->mem);
+    s->mem = init_mem(len);
+    predecode_flush(s);
+    block_flush(s);
+    return TRUE;
+}
 
-    byte_cnt = load_mem(mem, object_file, 1);
-    if (byte_cnt == 0) {
-	fprintf(stderr, "No lines of code found\n");
-	exit(1);
-    } else if (verbosity >= 2) {
-	printf("%d bytes of code read\n", byte_cnt);
-    }
-    fclose(object_file);
+/* State at a checkpoint that isn't in memory */
+struct sim_ckpt_rec {
+    mem_t reg;
+    word_t pc;
+    byte_t status;
+};
 
-    if (do_check) {
-	isa_state = new_state(0);
-	free_mem(isa_state->r);
-	free_mem(isa_state->m);
-	isa_state->m = copy_mem(mem);
-	isa_state->r = copy_mem(reg);
+int sim_checkpoint(sim_t s)
+{
+    int n;
+    sim_commit(s);
+    n = mem_checkpoint(s->mem);
+    /* Those after the last one restored have been replaced */
+    while (s->nckpts > n)
+	free_reg(s->ckpts[--s->nckpts].reg);
+    if (n == s->maxckpts) {
+	s->maxckpts = s->maxckpts ? 2*s->maxckpts : 16;
+	s->ckpts = (struct sim_ckpt_rec *)
+	    realloc(s->ckpts, s->maxckpts * sizeof(struct sim_ckpt_rec));
     }
+    s->ckpts[n].reg = copy_reg(s->reg);
+    s->ckpts[n].pc = s->pc;
+    s->ckpts[n].status = s->status;
+    s->nckpts = n + 1;
+    return n;
+}
 
-    mem0 = copy_mem(mem);
-    reg0 = copy_mem(reg);
-
-
-    icount = sim_run(instr_limit, &status);
-
-    if (verbosity > 0) {
-	printf("%d instructions executed\n", icount);
-	printf("Status = %s\n", stat_name(status));
-	printf("Changed Register State:\n");
-	diff_reg(reg0, reg, stdout);
-	printf("Changed Memory State:\n");
-	diff_mem(mem0, mem, stdout);
+bool_t sim_restore(sim_t s, int n)
+{
+    struct sim_ckpt_rec *c;
+    int i;
+    if (n < 0 || n >= s->nckpts || !mem_restore(s->mem, n))
+	return FALSE;
+    c = &s->ckpts[n];
+    for (i = 0; i <= (int) s->reg->last; i += 4) {
+	word_t val = 0;
+	get_halfword_val(c->reg, i, &val);
+	set_halfword_val(s->reg, i, val);
     }
+    s->pc = s->pc_in = c->pc;
+    s->status = c->status;
+    s->destE = REG_NONE;
+    s->destM = REG_NONE;
+    s->mem_write = FALSE;
+    /* The code may be different */
+    predecode_flush(s);
+    block_flush(s);
+    return TRUE;
 }
 
+bool_t sim_diff_mem(sim_t s, int n, FILE *outfile)
+{
+    return diff_mem_checkpoint(s->mem, n, outfile);
+}
 
-
-/*
- * usage - print helpful diagnostic information
- */
-static void usage(char *name)
+/* Forget all checkpoints */
+static void drop_checkpoints(sim_t s)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
-    printf("file.yo required in GUI mode, optional in TTY mode (default stdin)\n");
-    printf("   -h     Print this message\n");
-    printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");
-    printf("   -l m   Set instruction limit to m [TTY mode only] (default %d)\n", instr_limit);
-    printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
-    printf("   -t     Test result against ISA simulator (yis) [TTY mode only]\n");
-    exit(0);
+    mem_drop_checkpoints(s->mem);
+    while (s->nckpts > 0)
+	free_reg(s->ckpts[--s->nckpts].reg);
+    free(s->ckpts);
+    s->ckpts = NULL;
+    s->maxckpts = 0;
 }
 
+bool_t sim_set_engine(sim_t s, char *name)
+{
+    int i;
+    for (i = 0; engine_table[i].name; i++)
+	if (!strcmp(name, engine_table[i].name)) {
+	    s->engine = i;
+	    return TRUE;
+	}
+    return FALSE;
+}
 
+word_t sim_run(sim_t s, word_t max_instr, byte_t *statusp)
+{
+    return engine_table[s->engine].run(s, max_instr, statusp);
+}
 
-/*********************************************************
- * Part 2: This part contains the core simulator routines.
- *********************************************************/
+word_t sim_get_pc(sim_t s)
+{
+    return s->pc;
+}
 
-/**********************
- * Begin Part 2 Globals
- **********************/
-
-mem_t mem;  /* Instruction and data memory */
-
-mem_t reg;               /* Register file */
-
-/* Program Counter */
-word_t pc = 0; /* Program counter value */
-word_t pc_in = 0;/* Input to program counter */
-
-/* Intermediate values */
-byte_t icode = I_NOP;
-word_t ifun1 = 0;
-word_t ifun2 = 0;
-word_t instr = 0;
-word_t rs1 = REG_NONE;
-word_t rs2 = REG_NONE;
-word_t rd = REG_NONE;
-word_t valc = 0;
-word_t valp = 0;
-bool_t imem_error;
-bool_t instr_valid;
-
-word_t srcA = REG_NONE;
-word_t srcB = REG_NONE;
-word_t destE = REG_NONE;
-word_t destM = REG_NONE;
-word_t vala = 0;
-word_t valb = 0;
-word_t vale = 0;
-
-bool_t cond = FALSE;
-word_t valm = 0;
-bool_t dmem_error;
-
-bool_t mem_write = FALSE;
-word_t mem_addr = 0;
-word_t mem_data = 0;
-byte_t status = STAT_AOK;
-
-
-/* Values computed by control logic */
-word_t gen_need_ifun1();
-word_t gen_need_ifun2();
-word_t gen_need_rs1();
-word_t gen_need_rs2();
-word_t gen_need_rd();
-word_t gen_need_valC();
-word_t gen_instr_valid();
-word_t gen_srcA();
-word_t gen_srcB();
-word_t gen_dstE();
-word_t gen_dstM();
-word_t gen_aluA();
-word_t gen_aluB();
-word_t gen_mem_addr();
-word_t gen_mem_data();
-word_t gen_mem_read();
-word_t gen_mem_write();
-word_t gen_Stat();
-word_t gen_new_pc();
-
-/* Log file */
-FILE *dumpfile = NULL;
-
-/********************
- * End Part 2 Globals
- ********************/
-
-static int initialized = 0;
-void sim_init()
+void sim_set_pc(sim_t s, word_t pc)
 {
+    s->pc = s->pc_in = pc;
+}
 
-    /* Create memory and register files */
-    initialized = 1;
-    mem = init_mem(MEM_SIZE);
-    reg = init_reg();
-    sim_reset();
-    clear_mem(mem);
+word_t sim_get_reg(sim_t s, reg_id_t id)
+{
+    return get_reg_val(s->reg, id);
 }
 
-void sim_reset()
+mem_t sim_get_mem(sim_t s)
 {
-    if (!initialized)
-	sim_init();
-    clear_mem(reg);
+    return s->mem;
+}
 
-    set_reg_val(reg, REG_X0, 0);
-    pc_in = 0;
+mem_t sim_get_regs(sim_t s)
+{
+    return s->reg;
+}
 
-    destE = REG_NONE;
-    destM = REG_NONE;
-    mem_write = FALSE;
-    mem_addr = 0;
-    mem_data = 0;
+byte_t sim_get_status(sim_t s)
+{
+    return s->status;
+}
 
-    /* Reset intermediate values to clear display */
-    icode = I_NOP;
-    ifun1 = 0;
-    ifun2 = 0;
-    instr = 0;
-    rs1 = REG_NONE;
-    rs2 = REG_NONE;
-    rd = REG_NONE;
-    valc = 0;
-    valp = 0;
+void sim_report(sim_t s, FILE *outfile)
+{
+    fprintf(outfile, "Memory: %d of %d pages resident (%d KiB)\n",
+	    s->mem->resident, s->mem->npages, s->mem->resident * PAGE_SIZE / 1024);
+    fprintf(outfile, "Predecode cache: %lld hits, %lld misses, "
+	    "%lld invalidations\n", s->predecode_hits, s->predecode_misses,
+	    s->predecode_invalidations);
+    if (engine_table[s->engine].report)
+	engine_table[s->engine].report(s, outfile);
+    bpred_report(s, outfile);
+    cache_report(s, outfile);
+}
 
-    srcA = REG_NONE;
-    srcB = REG_NONE;
-    destE = REG_NONE;
-    destM = REG_NONE;
-    vala = 0;
-    valb = 0;
-    vale = 0;
 
-    cond = FALSE;
-    valm = 0;
+/*********************************************************
+ * Part 2: This part contains the core simulator routines.
+ *********************************************************/
 
+/*
+ * sim_commit - apply the writes left pending by the last sim_step, so
+ * that the architectural state is complete and nothing is outstanding
+ */
+void sim_commit(sim_t s)
+{
+    update_state(s);
+    s->destE = REG_NONE;
+    s->destM = REG_NONE;
+    s->mem_write = FALSE;
 }
 
 /* Update the processor state */
-static void update_state()
+static void update_state(sim_t s)
 {
 
-    pc = pc_in;
+    s->pc = s->pc_in;
 
     /* Writeback */
     //writeback vale to destE
     //REG_X0 can not change
     // vale 是经过alu计算出来的存入到dstE
-    if (destE != REG_NONE && destE != REG_X0 ){
-	set_reg_val(reg, destE, vale);
-
+    if (s->destE != REG_NONE && s->destE != REG_X0 ){
+	set_reg_val(s->reg, s->destE, s->vale);
+	/* Loads write rd twice, only the value loaded is traced */
+	if (TRACE_ON(s, TRACE_REGWRITE) && s->destE != s->destM)
+	    sim_log_reg(s, s->destE, s->vale);
+	if (s->btrace && s->destE != s->destM)
+	    trace_reg(s->btrace, s->destE, s->vale);
     }
 ////////////////////////////////////
     //PART C: writeback valm to destM
     // 从内存取出来的值放入 dstM
-    if (destM != REG_NONE && destM != REG_X0) {
-    set_reg_val(reg, destM, valm);
-
+    if (s->destM != REG_NONE && s->destM != REG_X0) {
+    set_reg_val(s->reg, s->destM, s->valm);
+    if (TRACE_ON(s, TRACE_REGWRITE))
+	sim_log_reg(s, s->destM, s->valm);
+    if (s->btrace)
+	trace_reg(s->btrace, s->destM, s->valm);
     }
 
 ////////////////////////////////////
-    if (mem_write) {
+    if (s->mem_write) {
       /* Should have already tested this address */
-      set_halfword_val(mem, mem_addr, mem_data);
-	sim_log("Wrote 0x%x to address 0x%x\n", mem_data, mem_addr);
+      set_halfword_val(s->mem, s->mem_addr, s->mem_data);
+      predecode_invalidate(s, s->mem_addr);
+      block_invalidate(s, s->mem_addr);
+      if (TRACE_ON(s, TRACE_MEMWRITE))
+	sim_log(s, "Wrote 0x%x to address 0x%x\n", s->mem_data, s->mem_addr);
+      if (s->btrace)
+	trace_mem(s->btrace, s->mem_addr, s->mem_data);
     }
 }
 
-/* Execute one instruction */
-/* Return resulting status */
-static byte_t sim_step()
+/*
+ * decode_handler - pick the handler that performs the same computation
+ * as the execute stage of sim_step for this icode/ifun1/ifun2
+ */
+static byte_t decode_handler(byte_t ic, word_t f1, word_t f2)
 {
-//int
-    word_t aluA;
-    word_t aluB;
-//unsigned int
-    uword_t aluA1;
-    uword_t aluB1;
-
-    cond = FALSE;
-
-    status = STAT_AOK;
-    imem_error = dmem_error = FALSE;
-
-    update_state(); /* Update state from last cycle */
-
-    valp = pc;
-
-    instr = 0;
-    imem_error = !get_riscv4byte_val(mem, valp, &instr);
-    if (imem_error) {
-	sim_log("Couldn't fetch at address 0x%x\n", valp);
+    static const byte_t b_handler[8] =
+	{ H_BEQ, H_BNE, H_BNONE, H_BNONE, H_BLT, H_BGE, H_BLTU, H_BGEU };
+    static const byte_t op_handler[8] =
+	{ H_ADDI, H_SLLI, H_SLTI, H_SLTIU, H_XORI, H_SRLI, H_ORI, H_ANDI };
+    static const byte_t r_handler[8] =
+	{ H_ADD, H_SLL, H_SLT, H_SLTU, H_XOR, H_SRL, H_OR, H_AND };
+
+    switch (ic) {
+    case I_HALT:
+	return H_HALT;
+    case I_CSR:
+	return H_CSR;
+    case I_LUI:
+	return H_LUI;
+    case I_AUIPC:
+	return H_AUIPC;
+    case I_JAL:
+	return H_JAL;
+    case I_JALR:
+	return H_JALR;
+    case I_B:
+	return b_handler[f1 & 0x7];
+    case I_L:
+	/* Only lw computes an address, the others reuse the old vale */
+	return f1 == 2 ? H_LW : H_LSTALE;
+    case I_S:
+	return H_SW;
+    case I_AMO:
+	/* Bit n of the mask is set if n is a valid funct5 */
+	return f1 == 2 && ((0x1111111f >> (f2 >> 2)) & 1) ? H_AMO : H_BAD;
+    case I_FENCE:
+	return f1 <= 1 ? H_FENCE : H_BAD;
+    case I_OP:
+	if (f1 == 5 && f2 == 0x20)
+	    return H_SRAI;
+	return op_handler[f1 & 0x7];
+    case I_R:
+	if (f1 == 0 && f2 != 0)
+	    return H_SUB;
+	if (f1 == 5 && f2 != 0)
+	    return H_SRA;
+	return r_handler[f1 & 0x7];
+    default:
+	return H_BAD;
     }
+}
 
+/* Decode instruction word into d, using the control logic */
+static void decode_instr(sim_t s, word_t instr, decode_ptr d)
+{
     //get icode
-    if(imem_error){
-	icode = 0;
-    }
-    else{
-	icode = instr&0x7f;
-    }
+    s->icode = instr&0x7f;
 
     //get ifun1,ifun2 if have
-    if(gen_need_ifun1()){
-	ifun1 = (instr >> 12)&0x7;
+    if(gen_need_ifun1(s)){
+	s->ifun1 = (instr >> 12)&0x7;
     }
-    else ifun1=0;
+    else s->ifun1=0;
 
-    if(gen_need_ifun2()){
-	ifun2 = (instr >> 25)&0x7f;
+    if(gen_need_ifun2(s)){
+	s->ifun2 = (instr >> 25)&0x7f;
+	/* Every atomic is sequentially consistent, so aq and rl don't matter */
+	if (s->icode == I_AMO)
+	    s->ifun2 &= 0x7c;
     }
     else {
-		ifun2 = 0; // original
+		s->ifun2 = 0; // original
     }
 
-    instr_valid = gen_instr_valid();
+    s->instr_valid = gen_instr_valid(s);
 
     //get rs1,rs2,rd if have
-    if(gen_need_rs1()){
-	rs1 = (instr >> 15)&0x1f;
+    if(gen_need_rs1(s)){
+	s->rs1 = (instr >> 15)&0x1f;
     }
     else{
-	rs1 = REG_NONE;
+	s->rs1 = REG_NONE;
     }
 
-    if(gen_need_rs2()){
-	rs2 = (instr >> 20)&0x1f;
+    if(gen_need_rs2(s)){
+	s->rs2 = (instr >> 20)&0x1f;
     }
     else{
-	rs2 = REG_NONE;
+	s->rs2 = REG_NONE;
     }
 
-    if(gen_need_rd()){
-	rd = (instr >> 7)&0x1f;
+    if(gen_need_rd(s)){
+	s->rd = (instr >> 7)&0x1f;
     }
     else{
-	rd = REG_NONE;
+	s->rd = REG_NONE;
     }
 
-    valc = 0;
+    s->valc = 0;
 //get the immediate data
-    if (gen_need_valC()) {
-	if((icode)==(I_LUI) || (icode)==(I_AUIPC) ){
-		valc = ((instr >> 12)&0xfffff) << 12;
+    if (gen_need_valC(s)) {
+	if((s->icode)==(I_LUI) || (s->icode)==(I_AUIPC) ){
+		s->valc = ((instr >> 12)&0xfffff) << 12;
 	}
-	if((icode)==(I_JAL) ){
-		valc = valc | (((instr>>31)&0x1)<<20) | (((instr>>21)&0x3ff)<<1) | (((instr>>20)&0x1)<<11) | (((instr>>12)&0xff)<<12);
-		valc = (valc << 11) >> 11;
+	if((s->icode)==(I_JAL) ){
+		s->valc = s->valc | (((instr>>31)&0x1)<<20) | (((instr>>21)&0x3ff)<<1) | (((instr>>20)&0x1)<<11) | (((instr>>12)&0xff)<<12);
+		s->valc = (s->valc << 11) >> 11;
 	}
-	if((icode)==(I_JALR)){
-		valc = (instr >> 20)&0xfff;
-		valc = (valc << 20) >> 20; // 先保留符号位
+	if((s->icode)==(I_JALR)){
+		s->valc = (instr >> 20)&0xfff;
+		s->valc = (s->valc << 20) >> 20; // 先保留符号位
 
 	}
 /////////////////////////////////////////////
 	//PART B: get the immediate data of addi/slti/sltiu/xori/ori/andi/slli/srli/srai
 	// for addi
-	if((icode)==(I_OP)){
-		if((ifun1 == 1) || (ifun1 == 5)){
-			valc = ((instr >> 20)&0x3f);
+	if((s->icode)==(I_OP)){
+		if((s->ifun1 == 1) || (s->ifun1 == 5)){
+			s->valc = ((instr >> 20)&0x3f);
 		} else {
-			valc = (((int)instr >> 20)&0xfff);
-			valc = (valc << 20) >> 20;
+			s->valc = (((int)instr >> 20)&0xfff);
+			s->valc = (s->valc << 20) >> 20;
 		}
 	}
 	//PART C: get the immediate data of lw
-    if((icode)==(I_L)){
-        valc = ((instr >> 20)&0xfff);
-        valc = (valc << 20) >> 20;
+    if((s->icode)==(I_L)){
+        s->valc = ((instr >> 20)&0xfff);
+        s->valc = (s->valc << 20) >> 20;
         //valc = valc;
     }
 
 
 /////////////////////////////////////////////
-	if((icode)==(I_B) ){
-		valc = valc | (((instr>>31)&0x1)<<12) | (((instr>>25)&0x3f)<<5) | (((instr>>8)&0xf)<<1) | (((instr>>7)&0x1)<<11);
-		valc = (valc << 19) >> 19;
+	if((s->icode)==(I_B) ){
+		s->valc = s->valc | (((instr>>31)&0x1)<<12) | (((instr>>25)&0x3f)<<5) | (((instr>>8)&0xf)<<1) | (((instr>>7)&0x1)<<11);
+		s->valc = (s->valc << 19) >> 19;
 	}
-	if((icode)==(I_S) ){
-		valc = valc | (((instr>>25)&0x7f)<<5) | ((instr>>7)&0x1f);
-		valc = (valc << 20) >> 20;
+	if((s->icode)==(I_S) ){
+		s->valc = s->valc | (((instr>>25)&0x7f)<<5) | ((instr>>7)&0x1f);
+		s->valc = (s->valc << 20) >> 20;
 	}
 
     }
     else {
-	valc = 0;
+	s->valc = 0;
+    }
+
+    d->icode = s->icode;
+    d->ifun1 = s->ifun1;
+    d->ifun2 = s->ifun2;
+    d->rs1 = s->rs1;
+    d->rs2 = s->rs2;
+    d->rd = s->rd;
+    d->valc = s->valc;
+    d->handler = s->instr_valid ?
+	decode_handler(s->icode, s->ifun1, s->ifun2) : H_BAD;
+    d->op = instr_index(s->icode, s->ifun1, s->ifun2);
+}
+
+/*
+ * fetch_decoded - return the decoded instruction at address a, going
+ * through the predecode cache.  Sets imem_error if the fetch fails.
+ */
+decode_ptr fetch_decoded(sim_t s, word_t a)
+{
+    decode_ptr d;
+    word_t word = 0;
+
+    if (!(a & 0x3)) {
+	d = &s->predecode[(a >> 2) & (PREDECODE_SIZE-1)];
+	if (d->tag == a) {
+	    s->predecode_hits++;
+	    return d;
+	}
+    } else {
+	/* Misaligned PCs are rare enough not to be worth caching */
+	d = &s->unaligned_rec;
+    }
+    s->imem_error = !get_instr_val(s->mem, a, &word);
+    if (s->imem_error) {
+	s->instr = 0;
+	decode_instr(s, 0, &s->fetch_error_rec);
+	return &s->fetch_error_rec;
+    }
+    s->predecode_misses++;
+    s->instr = word;
+    decode_instr(s, word, d);
+    d->tag = a;
+    return d;
+}
+
+/*
+ * peek_decoded - return the decoded instruction at address a, from
+ * the predecode cache if it's there.  Otherwise it is decoded aside,
+ * as 0 if it can't be fetched, leaving the cache and counts as they
+ * were.
+ */
+decode_ptr peek_decoded(sim_t s, word_t a)
+{
+    decode_ptr d = &s->predecode[((uword_t) a >> 2) & (PREDECODE_SIZE-1)];
+    word_t word = 0;
+
+    if (!(a & 0x3) && d->tag == a)
+	return d;
+    d = &s->peek_rec;
+    if (!get_instr_val(s->mem, a, &word))
+	word = 0;
+    decode_instr(s, word, d);
+    d->tag = a;
+    return d;
+}
+
+/* Drop any cached decodings of the 4 bytes starting at a */
+void predecode_invalidate(sim_t s, word_t a)
+{
+    uword_t w;
+    uword_t last = ((uword_t) a + 3) >> 2;
+    for (w = (uword_t) a >> 2; w <= last; w++) {
+	decode_ptr d = &s->predecode[w & (PREDECODE_SIZE-1)];
+	if (d->tag == (word_t) (w << 2)) {
+	    d->tag = -1;
+	    s->predecode_invalidations++;
+	}
+    }
+}
+
+/* Empty the predecode cache */
+static void predecode_flush(sim_t s)
+{
+    int i;
+    if (!s->predecode)
+	s->predecode = (decode_ptr) malloc(PREDECODE_SIZE * sizeof(decode_rec));
+    for (i = 0; i < PREDECODE_SIZE; i++)
+	s->predecode[i].tag = -1;
+}
+
+/* Execute one instruction */
+/* Return resulting status */
+byte_t sim_step(sim_t s)
+{
+//int
+    word_t aluA;
+    word_t aluB;
+//unsigned int
+    uword_t aluA1;
+    uword_t aluB1;
+    decode_ptr d;
+
+    s->cond = FALSE;
+
+    s->status = STAT_AOK;
+    s->imem_error = s->dmem_error = FALSE;
+
+    update_state(s); /* Update state from last cycle */
+    s->amo_write = FALSE;
+
+    s->valp = s->pc;
+
+    d = fetch_decoded(s, s->valp);
+    if (s->imem_error) {
+	sim_log(s, "Couldn't fetch at address 0x%x\n", s->valp);
     }
+    s->icode = d->icode;
+    s->ifun1 = d->ifun1;
+    s->ifun2 = d->ifun2;
+    s->rs1 = d->rs1;
+    s->rs2 = d->rs2;
+    s->rd = d->rd;
+    s->valc = d->valc;
+    s->instr_valid = d->handler != H_BAD;
+
 //each instructions is 4 byte
-    valp+=4;
+    s->valp+=4;
 //output related information
 // 以上就是译码部分
 
-    sim_log("IF: Fetched %s at 0x%x.  rs1=%s, rs2=%s, rd=%s, Imm = 0x%x\n",
-	    iname(icode,ifun1,ifun2), pc, reg_name(rs1), reg_name(rs2), reg_name(rd), valc);
+    if (TRACE_ON(s, TRACE_FETCH))
+	sim_log_fetch(s, d, s->pc);
+    if (s->btrace)
+	trace_instr(s->btrace, s->pc, d->valc, TRACE_FIELDS(d));
+    if (s->counts)
+	count_instr(s->counts, d, s->pc);
+    if (s->cache)
+	cache_fetch(s->cache, s->pc);
+    if (s->prof)
+	profile_instr(s->prof, s->pc);
 //we already have icode,ifun1,ifun2,rs1,rs2,rd,imm
 
-    if (status == STAT_AOK && icode == 0) {
-	status = STAT_HLT;
+    if (s->status == STAT_AOK && s->icode == 0) {
+	s->status = STAT_HLT;
     }
 //we are going to get vala,valb, cond? ,destE,destM,aluA,aluB,
-    srcA = gen_srcA();
-    if (srcA != REG_NONE) {
-	vala = get_reg_val(reg, srcA);
+    s->srcA = gen_srcA(s);
+    if (s->srcA != REG_NONE) {
+	s->vala = get_reg_val(s->reg, s->srcA);
     } else {
-	vala = 0;
+	s->vala = 0;
     }
 
-    srcB = gen_srcB();
-    if (srcB != REG_NONE) {
-	valb = get_reg_val(reg, srcB);
+    s->srcB = gen_srcB(s);
+    if (s->srcB != REG_NONE) {
+	s->valb = get_reg_val(s->reg, s->srcB);
     } else {
-	valb = 0;
+	s->valb = 0;
     }
 
-    destE = gen_dstE();
-    destM = gen_dstM();
-    aluA = gen_aluA();
-    aluB = gen_aluB();
+    s->destE = gen_dstE(s);
+    s->destM = gen_dstM(s);
+    aluA = gen_aluA(s);
+    aluB = gen_aluB(s);
 
 //determine which function will be used
-    switch(icode){
+    switch(s->icode){
 	case I_B:
 		//in this ifun, if the comparison is correct, make cond true.
-		switch(ifun1){
+		switch(s->ifun1){
 			case 0:
-				if(aluA == aluB) cond = TRUE;
+				if(aluA == aluB) s->cond = TRUE;
 				break;
 //////////////////////////////////////
 /*PART A: supplement the function of bne/ble/bge here */
 			// for bne
 			case 1:
-				if(aluA != aluB) cond = TRUE;
+				if(aluA != aluB) s->cond = TRUE;
 				break;
 			// for ble
 			case 4:
-				if(aluA < aluB) cond = TRUE;
+				if(aluA < aluB) s->cond = TRUE;
 				break;
 			case 5:
-				if(aluA > aluB) cond = TRUE;
+				if(aluA > aluB) s->cond = TRUE;
 				break;
 //////////////////////////////////////
 
@@ -531,164 +703,216 @@ static byte_t sim_step()
 			case 6:
 				aluA1 = aluA;
 				aluB1 = aluB;
-				if(aluA1 < aluB1) cond = TRUE;
+				if(aluA1 < aluB1) s->cond = TRUE;
 				break;
 			case 7:
 				aluA1 = aluA;
 				aluB1 = aluB;
-				if(aluA1 >= aluB1) cond = TRUE;
+				if(aluA1 >= aluB1) s->cond = TRUE;
 				break;
 		}
 		break;
 ////////////////////// part c
     case I_L:
-        switch(ifun1){
+        switch(s->ifun1){
             case 2:
-                vale = aluA + valc;
+                s->vale = aluA + s->valc;
                 break;
         }
         break;
 ////////////////////////////
 	//PART B: supplement the function of addi/slti/sltiu/xori/ori/andi/slli/srli/srai
 	case I_OP:
-		switch(ifun1){
+		switch(s->ifun1){
 			case 0: // addi
-					vale = valc + aluA;
+					s->vale = s->valc + aluA;
 					break;
 
 			case 1: // slli, it is wrong!  notes:
-					vale = (aluA << (valc&0x3f));
+					s->vale = (aluA << (s->valc&0x3f));
                     //  rd = rs1 << shamt
 				break;
 
 			case 2: //slti It is wrong
-				if(aluA < valc){
-					vale = 1;
+				if(aluA < s->valc){
+					s->vale = 1;
 					break;
 				} else {
-					vale = 0;
+					s->vale = 0;
 					break;
 				}
 			case 3: //sltiu
-				if(aluA > valc) {
-					vale = 1;
+				if(aluA > s->valc) {
+					s->vale = 1;
 					break;
 				} else {
-					vale = 0;
+					s->vale = 0;
 					break;
 				}
 			case 4: // xori
-				vale = aluA ^ valc;
+				s->vale = aluA ^ s->valc;
 				break;
 			case 5: // srli and srai
-				if (ifun2 == 0x20){
+				if (s->ifun2 == 0x20){
 					//valc = 0x4;
-					vale = (aluA >> valc);
+					s->vale = (aluA >> s->valc);
 					break;
 				} else {
-					vale = ((unsigned int)aluA >> valc);
+					s->vale = ((unsigned int)aluA >> s->valc);
 					break;
 
 				}
 				break;
 
 			case 6: // ori
-				vale = aluA | valc;
+				s->vale = aluA | s->valc;
 				break;
 			case 7: // andi
-				vale = aluA & valc;
+				s->vale = aluA & s->valc;
 				break;
 		}
 		break;
 ////////////////////////////
 	case I_R:
-		switch(ifun1){
+		switch(s->ifun1){
 			case 0:
-				if(ifun2 == 0){
-					vale = aluA+aluB;
+				if(s->ifun2 == 0){
+					s->vale = aluA+aluB;
 					break;
 				}
 				else{
-					vale = aluA-aluB;
+					s->vale = aluA-aluB;
 					break;
 				}
 			case 1:
-				vale = aluA<<aluB;
+				s->vale = aluA<<aluB;
 				break;
 			case 2:
-				if(aluA < aluB) vale = 1;
-				else vale = 0;
+				if(aluA < aluB) s->vale = 1;
+				else s->vale = 0;
 				break;
 			case 3:
 				aluA1 = aluA;
 				aluB1 = aluB;
-				if(aluA1 < aluB1) vale = 1;
-				else vale = 0;
+				if(aluA1 < aluB1) s->vale = 1;
+				else s->vale = 0;
 				break;
 			case 4:
-				vale = aluA^aluB;
+				s->vale = aluA^aluB;
 				break;
 			case 5:
-				if(ifun2 != 0){
-					vale = aluA>>aluB;
+				if(s->ifun2 != 0){
+					s->vale = aluA>>aluB;
 					break;
 				}
 				else{
 					aluA1 = aluA;
-					vale = aluA1>>aluB;
+					s->vale = aluA1>>aluB;
 					break;
 				}
 			case 6:
-				vale = aluA|aluB;
+				s->vale = aluA|aluB;
 				break;
 			case 7:
-				vale = aluA&aluB;
+				s->vale = aluA&aluB;
 				break;
 
 
 			default:
-				vale = 0;
+				s->vale = 0;
 		}
 		break;
 
 	default:
-		vale = aluA+aluB;
+		s->vale = aluA+aluB;
 		break;
     }
 //   alu 单元的运算
 
 
 //get the address of memory and the data which will be written into memory
-    mem_addr = gen_mem_addr();
-    mem_data = gen_mem_data();
-
-    //if need read, read the data from mem_addr to valm
-    if (gen_mem_read()) {
-      dmem_error = dmem_error || !get_halfword_val(mem, mem_addr, &valm);
-      if (dmem_error) {
-	sim_log("Couldn't read at address 0x%x\n", mem_addr);
+    s->mem_addr = gen_mem_addr(s);
+    s->mem_data = gen_mem_data(s);
+
+    //atomics read and write memory at once, with nothing left pending
+    if (d->handler == H_AMO) {
+      s->dmem_error = !amo_exec(s, s->ifun2 >> 2, s->mem_addr, s->valb,
+				&s->valm);
+      if (s->dmem_error) {
+	sim_log(s, "Couldn't access address 0x%x atomically\n", s->mem_addr);
+      } else {
+	if (s->counts)
+	  count_data(s->counts, s->mem_addr, FALSE);
+	if (s->cache)
+	  cache_data(s->cache, s->mem_addr, FALSE);
+      }
+      if (s->amo_write) {
+	predecode_invalidate(s, s->mem_addr);
+	block_invalidate(s, s->mem_addr);
+	if (TRACE_ON(s, TRACE_MEMWRITE))
+	  sim_log(s, "Wrote 0x%x to address 0x%x\n", s->mem_data, s->mem_addr);
+	if (s->btrace)
+	  trace_mem(s->btrace, s->mem_addr, s->mem_data);
+	if (s->counts)
+	  count_data(s->counts, s->mem_addr, TRUE);
+	if (s->cache)
+	  cache_data(s->cache, s->mem_addr, TRUE);
+      }
+    } else if (d->handler == H_FENCE) {
+      /* Order this hart's accesses against other harts' on the host */
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      /* fence.i: pick up code written since, by any hart */
+      if (s->ifun1 == 1) {
+	predecode_flush(s);
+	block_flush(s);
+      }
+      s->valm = 0;
+    } else if (gen_mem_read(s)) {
+      s->dmem_error = s->dmem_error || !get_halfword_val(s->mem, s->mem_addr, &s->valm);
+      if (s->dmem_error) {
+	sim_log(s, "Couldn't read at address 0x%x\n", s->mem_addr);
+      } else {
+	if (s->counts)
+	  count_data(s->counts, s->mem_addr, FALSE);
+	if (s->cache)
+	  cache_data(s->cache, s->mem_addr, FALSE);
       }
     } else
-      valm = 0;
+      s->valm = 0;
 
-    mem_write = gen_mem_write();
-    if (mem_write) {
+    s->mem_write = gen_mem_write(s);
+    if (s->mem_write) {
       /* Do a test read of the data memory to make sure address is OK */
       word_t junk;
-      dmem_error = dmem_error || !get_halfword_val(mem, mem_addr, &junk);
+      s->dmem_error = s->dmem_error || !get_halfword_val(s->mem, s->mem_addr, &junk);
+      if (s->counts && !s->dmem_error)
+	count_data(s->counts, s->mem_addr, TRUE);
+      if (s->cache && !s->dmem_error)
+	cache_data(s->cache, s->mem_addr, TRUE);
     }
 
 //change the state
-    status = gen_Stat();
+    s->status = gen_Stat(s);
 
 
     /* Update PC */
-    pc_in = gen_new_pc();
+    s->pc_in = gen_new_pc(s);
 //in jal and jalr,pc+4 will be writen into rd
-    if(((icode)==(I_JAL) || (icode)==(I_JALR)))
-	vale = valp;
-
-    return status;
+    if(((s->icode)==(I_JAL) || (s->icode)==(I_JALR)))
+	s->vale = s->valp;
+
+    if (TRACE_ON(s, TRACE_BRANCH) && s->status == STAT_AOK &&
+	(s->icode == I_B || s->icode == I_JAL || s->icode == I_JALR))
+	sim_log_branch(s, s->pc, s->icode != I_B || s->cond, s->pc_in);
+    if (s->counts && s->status == STAT_AOK && s->icode == I_B)
+	count_branch(s->counts, s->cond);
+    if (s->prof && s->status == STAT_AOK &&
+	(s->icode == I_JAL || s->icode == I_JALR))
+	profile_jump(s->prof, d, s->pc, s->pc_in);
+    if (s->bpred && s->status == STAT_AOK)
+	bpred_update(s->bpred, d, s->pc, s->icode != I_B || s->cond, s->pc_in);
+
+    return s->status;
 }
 
 /*
@@ -699,12 +923,12 @@ static byte_t sim_step()
   Return number of instructions executed.
   if statusp nonnull, then will be set to status of final instruction
 */
-word_t sim_run(word_t max_instr, byte_t *statusp)
+word_t sim_run_seq(sim_t s, word_t max_instr, byte_t *statusp)
 {
     word_t icount = 0;
     byte_t run_status = STAT_AOK;
     while (icount < max_instr) {
-	run_status = sim_step();
+	run_status = sim_step(s);
 	icount++;
 	if (run_status != STAT_AOK)
 	    break;
@@ -714,23 +938,164 @@ word_t sim_run(word_t max_instr, byte_t *statusp)
     return icount;
 }
 
+/*
+ * sim_run_checked - run the SEQ model like sim_run, stepping the ISA
+ * model in isa alongside it.  After each instruction only what it
+ * changed is compared: the status, the next pc, the register written
+ * and the store made.  Stops at the first difference, which is
+ * reported on stdout, and clears *okp.
+ */
+word_t sim_run_checked(sim_t s, word_t max_instr, byte_t *statusp,
+		       state_ptr isa, bool_t *okp)
+{
+    word_t icount = 0;
+    byte_t run_status = STAT_AOK;
+    stat_t isa_status;
+    reg_id_t wreg;
+    word_t wval = 0;
+    word_t seq_pc;
+    bool_t stored;
+    bool_t ok = TRUE;
+
+    while (icount < max_instr) {
+	run_status = sim_step(s);
+	seq_pc = s->pc;
+	isa_status = step_state(isa, NULL);
+	icount++;
+
+	/* Register the SEQ model will write back on the next step */
+	wreg = REG_NONE;
+	if (s->destM != REG_NONE && s->destM != REG_X0) {
+	    wreg = s->destM;
+	    wval = s->valm;
+	} else if (s->destE != REG_NONE && s->destE != REG_X0) {
+	    wreg = s->destE;
+	    wval = s->vale;
+	}
+
+	/* A store is pending, or an atomic has already stored */
+	stored = s->mem_write || s->amo_write;
+	if (run_status != isa_status) {
+	    ok = FALSE;
+	} else if (run_status == STAT_AOK) {
+	    if (s->pc_in != isa->pc || wreg != isa->wreg ||
+		(wreg != REG_NONE && wval != isa->wval))
+		ok = FALSE;
+	    if (stored ? isa->wlen != 4 || s->mem_addr != isa->waddr ||
+		s->mem_data != isa->wdata : isa->wlen != 0)
+		ok = FALSE;
+	}
+
+	if (!ok) {
+	    printf("Mismatch with ISA model at instruction %d, "
+		   "pc 0x%x (%s):\n", icount, seq_pc,
+		   iname(s->icode, s->ifun1, s->ifun2));
+	    printf("\tseq\tisa\n");
+	    printf("status:\t%s\t%s\n",
+		   stat_name(run_status), stat_name(isa_status));
+	    printf("pc:\t0x%.8x\t0x%.8x\n", s->pc_in, isa->pc);
+	    printf("reg:\t%s=0x%.8x\t%s=0x%.8x\n",
+		   reg_name(wreg), wreg == REG_NONE ? 0 : wval,
+		   reg_name(isa->wreg), isa->wreg == REG_NONE ? 0 : isa->wval);
+	    printf("store:\t%d@0x%.8x=0x%.8x\t%d@0x%.8x=0x%.8x\n",
+		   stored ? 4 : 0, stored ? s->mem_addr : 0,
+		   stored ? s->mem_data : 0,
+		   isa->wlen, isa->wlen ? isa->waddr : 0,
+		   isa->wlen ? isa->wdata : 0);
+	    break;
+	}
+	if (run_status != STAT_AOK)
+	    break;
+    }
+    if (statusp)
+	*statusp = run_status;
+    *okp = ok;
+    return icount;
+}
+
 /* If dumpfile set nonNULL, lots of status info printed out */
-void sim_set_dumpfile(FILE *df)
+void sim_set_dumpfile(sim_t s, FILE *df)
 {
-    dumpfile = df;
+    s->dumpfile = df;
+}
+
+void sim_set_trace(sim_t s, int mask)
+{
+    s->trace = mask & TRACE_ALL;
+}
+
+bool_t sim_set_trace_file(sim_t s, FILE *file)
+{
+    bool_t ok = TRUE;
+    if (s->btrace)
+	ok = trace_close(s->btrace);
+    s->btrace = file ? trace_open(file, s->reg, s->pc_in) : NULL;
+    return ok;
+}
+
+void sim_set_counting(sim_t s, bool_t on)
+{
+    /* A bit for each page of the 32-bit address space */
+    size_t bitmap = (1 << (32 - PAGE_BITS)) / 8;
+    if (s->counts) {
+	free(s->counts->code_seen);
+	free(s->counts->data_seen);
+	free(s->counts);
+	s->counts = NULL;
+    }
+    if (on) {
+	s->counts = (count_ptr) calloc(1, sizeof(count_rec));
+	s->counts->code_seen = (byte_t *) calloc(1, bitmap);
+	s->counts->data_seen = (byte_t *) calloc(1, bitmap);
+    }
+}
+
+bool_t sim_get_counters(sim_t s, sim_counters_ptr c)
+{
+    int i;
+    if (!s->counts)
+	return FALSE;
+    *c = s->counts->c;
+    c->instrs = 0;
+    for (i = 0; i <= NUM_INSTR; i++)
+	c->instrs += c->ops[i];
+    c->jal = c->ops[find_instr("jal") - instruction_set];
+    c->jalr = c->ops[find_instr("jalr") - instruction_set];
+    return TRUE;
 }
 
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
  */
-void sim_log( const char *format, ... ) {
-    if (dumpfile) {
+void sim_log(sim_t s, const char *format, ... ) {
+    if (s->dumpfile) {
 	va_list arg;
 	va_start( arg, format );
-	vfprintf( dumpfile, format, arg );
+	vfprintf( s->dumpfile, format, arg );
 	va_end( arg );
     }
 }
 
+/* Log the fetch of decoded instruction d from address a */
+void sim_log_fetch(sim_t s, decode_ptr d, word_t a)
+{
+    sim_log(s, "IF: Fetched %s at 0x%x.  rs1=%s, rs2=%s, rd=%s, Imm = 0x%x\n",
+	    iname(d->icode,d->ifun1,d->ifun2), a, reg_name(d->rs1),
+	    reg_name(d->rs2), reg_name(d->rd), d->valc);
+}
+
+/* Log the write of val to register id */
+void sim_log_reg(sim_t s, reg_id_t id, word_t val)
+{
+    sim_log(s, "WB: %s = 0x%x\n", reg_name(id), val);
+}
 
+/* Log the branch or jump at a, which went to target if taken */
+void sim_log_branch(sim_t s, word_t a, bool_t taken, word_t target)
+{
+    if (taken)
+	sim_log(s, "BR: 0x%x taken to 0x%x\n", a, target);
+    else
+	sim_log(s, "BR: 0x%x not taken\n", a);
+}
@@ -0,0 +1,281 @@
+/***********************************************************************
+ *
+ * ssim-smp.c - Harts sharing one memory, on host threads
+ *
+ * Hart 0 is the simulator the program was loaded into.  sim_set_harts
+ * adds more, each a simulator of its own borrowing the memory of hart
+ * 0, and sim_run_harts runs each of them on a host thread of its own.
+ * The atomics of the A extension are done by sim_step, which all the
+ * engines hand them to, with host atomics on the word in memory, so
+ * they hold whether the harts take turns or all run at once.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+
+/* funct5 of the A extension instructions */
+#define AMO_ADD  0x00
+#define AMO_SWAP 0x01
+#define AMO_LR   0x02
+#define AMO_SC   0x03
+#define AMO_XOR  0x04
+#define AMO_OR   0x08
+#define AMO_AND  0x0c
+#define AMO_MIN  0x10
+#define AMO_MAX  0x14
+#define AMO_MINU 0x18
+#define AMO_MAXU 0x1c
+
+/* Words are little-endian in memory, whatever the host */
+static inline uword_t le_word(uword_t w)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(w);
+#else
+    return w;
+#endif
+}
+
+/* What the amo f5 stores, given old from memory and src from rs2 */
+static word_t amo_result(int f5, word_t old, word_t src)
+{
+    switch (f5) {
+    case AMO_ADD:
+	return old + src;
+    case AMO_XOR:
+	return old ^ src;
+    case AMO_OR:
+	return old | src;
+    case AMO_AND:
+	return old & src;
+    case AMO_MIN:
+	return old < src ? old : src;
+    case AMO_MAX:
+	return old > src ? old : src;
+    case AMO_MINU:
+	return (uword_t) old < (uword_t) src ? old : src;
+    case AMO_MAXU:
+	return (uword_t) old > (uword_t) src ? old : src;
+    default:
+	return src;	/* AMO_SWAP */
+    }
+}
+
+/*
+ * amo_exec - lr.w takes a reservation on the word and loads it.  sc.w
+ * stores if this hart's last lr.w was from the same address and the
+ * word there still holds what it loaded, as a compare-and-swap, and
+ * the others swap in their result the same way until no other hart
+ * gets in between.
+ */
+bool_t amo_exec(sim_t s, int f5, word_t a, word_t src, word_t *valp)
+{
+    uword_t *p;
+    uword_t old, want;
+    word_t result;
+
+    if ((a & 3) || (uword_t) a > s->mem->last - 3)
+	return FALSE;
+    p = (uword_t *) (mem_page(s->mem, a) + (a & PAGE_MASK));
+    old = __atomic_load_n(p, __ATOMIC_SEQ_CST);
+
+    if (f5 == AMO_LR) {
+	s->resv = TRUE;
+	s->resv_addr = a;
+	s->resv_val = *valp = le_word(old);
+	return TRUE;
+    }
+    if (f5 == AMO_SC) {
+	want = le_word(s->resv_val);
+	*valp = 1;
+	if (s->resv && s->resv_addr == a &&
+	    __atomic_compare_exchange_n(p, &want, le_word(src), FALSE,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+	    *valp = 0;
+	    s->amo_write = TRUE;
+	    s->mem_data = src;
+	}
+	s->resv = FALSE;
+	return TRUE;
+    }
+    do
+	result = amo_result(f5, le_word(old), src);
+    while (!__atomic_compare_exchange_n(p, &old, le_word(result), FALSE,
+					__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+    *valp = le_word(old);
+    s->amo_write = TRUE;
+    s->mem_data = result;
+    return TRUE;
+}
+
+bool_t sim_set_harts(sim_t s, int n)
+{
+    int i;
+
+    if (n < 1 || n > SIM_MAX_HARTS)
+	return FALSE;
+    for (i = 1; i < s->nharts; i++)
+	sim_destroy(s->harts[i]);
+    free(s->harts);
+    s->harts = NULL;
+    s->nharts = 0;
+    if (n == 1)
+	return TRUE;
+
+    sim_commit(s);
+    s->harts = (sim_t *) calloc(n, sizeof(sim_t));
+    s->harts[0] = s;
+    for (i = 1; i < n; i++) {
+	sim_t h = sim_create();
+	free_mem(h->mem);
+	free_reg(h->reg);
+	h->mem = s->mem;
+	h->reg = copy_reg(s->reg);
+	set_reg_val(h->reg, REG_X10, i);
+	h->pc = h->pc_in = s->pc;
+	h->vale = s->vale;
+	h->engine = s->engine;
+	h->hartid = i;
+	s->harts[i] = h;
+    }
+    s->nharts = n;
+    return TRUE;
+}
+
+sim_t sim_get_hart(sim_t s, int n)
+{
+    if (n == 0)
+	return s;
+    return n > 0 && n < s->nharts ? s->harts[n] : NULL;
+}
+
+/* State shared by the threads running the harts */
+typedef struct {
+    sim_t *harts;
+    int n;
+    word_t quantum;
+    word_t max_instr;
+    word_t *icounts;
+    byte_t *statuses;
+    int turn;			/* Hart that may run, with a quantum */
+    int *next;			/* Hart after each, -1 once it has stopped */
+    pthread_mutex_t lock;
+    pthread_cond_t *wake;	/* Signalled when it is each hart's turn */
+} smp_run_rec, *smp_run_ptr;
+
+typedef struct {
+    smp_run_ptr r;
+    int id;
+} hart_arg_rec, *hart_arg_ptr;
+
+/*
+ * run_hart - run hart a->id of a->r to the end, all at once if there
+ * is no quantum, otherwise a quantum at a time when its turn comes
+ */
+static void *run_hart(void *arg)
+{
+    hart_arg_ptr a = (hart_arg_ptr) arg;
+    smp_run_ptr r = a->r;
+    int i = a->id, j;
+    sim_t h = r->harts[i];
+    word_t left;
+    bool_t stopped;
+
+    if (!r->quantum) {
+	r->icounts[i] = sim_run(h, r->max_instr, &r->statuses[i]);
+	sim_commit(h);
+	return NULL;
+    }
+    do {
+	pthread_mutex_lock(&r->lock);
+	while (r->turn != i)
+	    pthread_cond_wait(&r->wake[i], &r->lock);
+	pthread_mutex_unlock(&r->lock);
+
+	left = r->max_instr - r->icounts[i];
+	r->icounts[i] += sim_run(h, left < r->quantum ? left : r->quantum,
+				 &r->statuses[i]);
+	/* Let the next hart see the last store */
+	sim_commit(h);
+	stopped = r->statuses[i] != STAT_AOK ||
+	    r->icounts[i] >= r->max_instr;
+
+	/* Pass the turn on, leaving this hart out if it has stopped */
+	pthread_mutex_lock(&r->lock);
+	r->turn = r->next[i];
+	if (stopped) {
+	    for (j = 0; r->next[j] != i; j++)
+		;
+	    r->next[j] = r->next[i];
+	    r->next[i] = -1;
+	    if (r->turn == i)
+		r->turn = -1;	/* It was the last one */
+	}
+	if (r->turn >= 0)
+	    pthread_cond_signal(&r->wake[r->turn]);
+	pthread_mutex_unlock(&r->lock);
+    } while (!stopped);
+    return NULL;
+}
+
+long long sim_run_harts(sim_t s, word_t quantum, word_t max_instr,
+			word_t *icounts, byte_t *statuses)
+{
+    int n = s->nharts ? s->nharts : 1;
+    smp_run_rec r;
+    hart_arg_ptr args = (hart_arg_ptr) calloc(n, sizeof(hart_arg_rec));
+    pthread_t *threads = (pthread_t *) calloc(n, sizeof(pthread_t));
+    long long total = 0;
+    int i;
+
+    r.harts = s->nharts ? s->harts : &s;
+    r.n = n;
+    r.quantum = quantum > 0 ? quantum : 0;
+    r.max_instr = max_instr;
+    r.icounts = (word_t *) calloc(n, sizeof(word_t));
+    r.statuses = (byte_t *) calloc(n, sizeof(byte_t));
+    r.turn = 0;
+    r.next = (int *) calloc(n, sizeof(int));
+    r.wake = (pthread_cond_t *) calloc(n, sizeof(pthread_cond_t));
+    pthread_mutex_init(&r.lock, NULL);
+    for (i = 0; i < n; i++) {
+	r.statuses[i] = STAT_AOK;
+	r.next[i] = (i + 1) % n;
+	pthread_cond_init(&r.wake[i], NULL);
+    }
+
+    if (max_instr > 0) {
+	for (i = 0; i < n; i++) {
+	    args[i].r = &r;
+	    args[i].id = i;
+	    if (pthread_create(&threads[i], NULL, run_hart, &args[i]) != 0) {
+		fprintf(stderr, "Couldn't start a thread for hart %d\n", i);
+		exit(1);
+	    }
+	}
+	for (i = 0; i < n; i++)
+	    pthread_join(threads[i], NULL);
+    }
+
+    for (i = 0; i < n; i++) {
+	total += r.icounts[i];
+	if (icounts)
+	    icounts[i] = r.icounts[i];
+	if (statuses)
+	    statuses[i] = r.statuses[i];
+	pthread_cond_destroy(&r.wake[i]);
+    }
+    pthread_mutex_destroy(&r.lock);
+    free(r.icounts);
+    free(r.statuses);
+    free(r.next);
+    free(r.wake);
+    free(args);
+    free(threads);
+    return total;
+}
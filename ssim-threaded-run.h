@@ -0,0 +1,210 @@
+/***********************************************************************
+ *
+ * ssim-threaded-run.h - Main loop of the threaded-code engine
+ *
+ * Included by ssim-threaded.c once for each value of TRACED, to define
+ * the loop RUN_NAME.  The trace macros test TRACED first, so each copy
+ * only has the tracing it needs.
+ *
+ ***********************************************************************/
+
+static word_t RUN_NAME(sim_t s, word_t max_instr, byte_t *statusp)
+{
+#ifdef THREADED_GOTO
+    static void *labels[H_NUM] = {
+	&&L_H_BAD, &&L_H_HALT, &&L_H_AMO, &&L_H_FENCE, &&L_H_CSR,
+	&&L_H_LUI, &&L_H_AUIPC, &&L_H_JAL, &&L_H_JALR,
+	&&L_H_BEQ, &&L_H_BNE, &&L_H_BLT, &&L_H_BGE, &&L_H_BLTU,
+	&&L_H_BGEU, &&L_H_BNONE,
+	&&L_H_LW, &&L_H_LSTALE, &&L_H_SW,
+	&&L_H_ADDI, &&L_H_SLLI, &&L_H_SLTI, &&L_H_SLTIU, &&L_H_XORI,
+	&&L_H_SRLI, &&L_H_SRAI, &&L_H_ORI, &&L_H_ANDI,
+	&&L_H_ADD, &&L_H_SUB, &&L_H_SLL, &&L_H_SLT, &&L_H_SLTU,
+	&&L_H_XOR, &&L_H_SRL, &&L_H_SRA, &&L_H_OR, &&L_H_AND
+    };
+#endif
+    word_t icount = 0;
+    word_t last;
+    long long hits = 0;
+    long long hits_before, misses_before;
+    bool_t refetch = FALSE;
+    byte_t run_status = STAT_AOK;
+    decode_ptr d;
+    word_t pc;		/* Local copy of pc */
+    word_t e;		/* Local copy of vale */
+    mem_t reg = s->reg;
+    mem_t mem = s->mem;
+    decode_ptr predecode = s->predecode;
+    word_t addr, val;
+
+    if (max_instr <= 0)
+	goto done;
+    last = max_instr - 1;
+
+    sim_commit(s);
+    s->status = STAT_AOK;
+    e = s->vale;
+    pc = s->pc;
+    NEXT();
+
+#ifndef THREADED_GOTO
+ dispatch:
+    switch (d->handler) {
+#endif
+
+    CASE(H_BAD):
+    CASE(H_HALT):
+    CASE(H_AMO):
+    CASE(H_FENCE):
+	goto bail;
+
+    CASE(H_CSR):
+	TRACE();
+	e = 0;
+	pc += 4;
+	NEXT();
+
+    CASE(H_LUI):
+	ALU(d->valc);
+
+    CASE(H_AUIPC):
+	ALU(pc + d->valc);
+
+    CASE(H_JAL):
+	TRACE();
+	e = pc + 4;
+	TRACE_JUMP(TRUE, d->valc);
+	PROFILE_JUMP(d->valc);
+	PREDICT(TRUE, d->valc);
+	WB(e);
+	pc = d->valc;
+	NEXT();
+
+    CASE(H_JALR):
+	TRACE();
+	addr = RS1 + d->valc;
+	e = pc + 4;
+	TRACE_JUMP(TRUE, addr);
+	PROFILE_JUMP(addr);
+	PREDICT(TRUE, addr);
+	WB(e);
+	pc = addr;
+	NEXT();
+
+    CASE(H_BEQ):
+	BRANCH(RS1 == RS2);
+    CASE(H_BNE):
+	BRANCH(RS1 != RS2);
+    CASE(H_BLT):
+	BRANCH(RS1 < RS2);
+    CASE(H_BGE):
+	/* Same comparison as the bge case of sim_step */
+	BRANCH(RS1 > RS2);
+    CASE(H_BLTU):
+	BRANCH((uword_t) RS1 < (uword_t) RS2);
+    CASE(H_BGEU):
+	BRANCH((uword_t) RS1 >= (uword_t) RS2);
+    CASE(H_BNONE):
+	BRANCH(0);
+
+    CASE(H_LW):
+	e = RS1 + d->valc;
+	/* Fall through */
+    CASE(H_LSTALE):
+	if (!get_halfword_val(mem, e, &val))
+	    goto bail;
+	TRACE();
+	COUNT_LOAD(e);
+	WB(val);
+	pc += 4;
+	NEXT();
+
+    CASE(H_SW):
+	addr = RS1 + d->valc;
+	val = RS2;
+	if (!set_halfword_val(mem, addr, val))
+	    goto bail;
+	TRACE();
+	e = addr;
+	predecode_invalidate(s, addr);
+	block_invalidate(s, addr);
+	TRACE_STORE(addr, val);
+	pc += 4;
+	NEXT();
+
+    CASE(H_ADDI):
+	ALU(RS1 + d->valc);
+    CASE(H_SLLI):
+	ALU(RS1 << (d->valc & 0x1f));
+    CASE(H_SLTI):
+	ALU(RS1 < d->valc);
+    CASE(H_SLTIU):
+	/* Same comparison as the sltiu case of sim_step */
+	ALU(RS1 > d->valc);
+    CASE(H_XORI):
+	ALU(RS1 ^ d->valc);
+    CASE(H_SRLI):
+	ALU((uword_t) RS1 >> (d->valc & 0x1f));
+    CASE(H_SRAI):
+	ALU(RS1 >> (d->valc & 0x1f));
+    CASE(H_ORI):
+	ALU(RS1 | d->valc);
+    CASE(H_ANDI):
+	ALU(RS1 & d->valc);
+
+    CASE(H_ADD):
+	ALU(RS1 + RS2);
+    CASE(H_SUB):
+	ALU(RS1 - RS2);
+    CASE(H_SLL):
+	ALU(RS1 << (RS2 & 0x1f));
+    CASE(H_SLT):
+	ALU(RS1 < RS2);
+    CASE(H_SLTU):
+	ALU((uword_t) RS1 < (uword_t) RS2);
+    CASE(H_XOR):
+	ALU(RS1 ^ RS2);
+    CASE(H_SRL):
+	ALU((uword_t) RS1 >> (RS2 & 0x1f));
+    CASE(H_SRA):
+	ALU(RS1 >> (RS2 & 0x1f));
+    CASE(H_OR):
+	ALU(RS1 | RS2);
+    CASE(H_AND):
+	ALU(RS1 & RS2);
+
+#ifndef THREADED_GOTO
+    }
+#endif
+
+ bail:
+    /* Already fetched and counted, sim_step will fetch it again */
+    icount--;
+    refetch = TRUE;
+
+ slow:
+    /* Let the SEQ model run this one, then carry on if it went fine */
+    s->vale = e;
+    s->pc_in = pc;
+    hits_before = s->predecode_hits;
+    misses_before = s->predecode_misses;
+    run_status = sim_step(s);
+    if (refetch) {
+	s->predecode_hits = hits_before;
+	s->predecode_misses = misses_before;
+	refetch = FALSE;
+    }
+    icount++;
+    if (run_status == STAT_AOK && icount < max_instr) {
+	sim_commit(s);
+	e = s->vale;
+	pc = s->pc;
+	NEXT();
+    }
+
+ done:
+    s->predecode_hits += hits;
+    if (statusp)
+	*statusp = run_status;
+    return icount;
+}
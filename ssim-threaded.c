@@ -0,0 +1,196 @@
+/***********************************************************************
+ *
+ * ssim-threaded.c - Threaded-code execution engine for the RISC-V
+ * simulator
+ *
+ * Runs predecoded instructions by jumping straight to a handler for
+ * each one instead of going through the control logic.  Every handler
+ * ends with its own copy of the dispatch code, so the host predicts
+ * each indirect jump separately.  Results are the same as sim_run:
+ * anything unusual (halt, bad instruction, address error) and the
+ * last instruction of the run are handed to sim_step, so the status,
+ * the pending writes and the trace all come out the same way.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sim.h"
+#include "sstrace.h"
+
+/* Use computed goto where the compiler has it, a switch otherwise */
+#ifdef __GNUC__
+#define THREADED_GOTO
+#endif
+
+#ifdef THREADED_GOTO
+#define CASE(h) L_##h
+#define DISPATCH() goto *labels[d->handler]
+#else
+#define CASE(h) case h
+#define DISPATCH() goto dispatch
+#endif
+
+/*
+ * TRACED is 0 in the copy of the loop without tracing, 1 in the one
+ * that writes the text trace and the binary one if there is one, and
+ * counts, profiles, predicts branches and simulates caches if asked
+ * to, 2 in the one that only writes the binary trace and 3 in the one
+ * that only profiles
+ */
+#define BTRACED (TRACED == 2 || (TRACED == 1 && s->btrace))
+#define PROFILED (TRACED == 3 || (TRACED == 1 && s->prof))
+
+/* Operands of the current instruction */
+#define RS1 get_reg_val(reg, d->rs1)
+#define RS2 get_reg_val(reg, d->rs2)
+#define WB(val) do {							\
+	set_reg_val(reg, d->rd, val);					\
+	if (TRACED && d->rd != REG_X0) {				\
+	    if (BTRACED)						\
+		trace_reg(s->btrace, d->rd, val);			\
+	    if (TRACED == 1 && TRACE_ON(s, TRACE_REGWRITE))		\
+		sim_log_reg(s, d->rd, val);				\
+	}								\
+    } while (0)
+
+/* Fetch the next instruction and jump to its handler */
+#define NEXT() do {							\
+	if (icount >= last)						\
+	    goto slow;							\
+	d = &predecode[(pc >> 2) & (PREDECODE_SIZE-1)];			\
+	if (d->tag == pc)						\
+	    hits++;							\
+	else {								\
+	    d = fetch_decoded(s, pc);					\
+	    if (s->imem_error)						\
+		goto slow;						\
+	}								\
+	icount++;							\
+	DISPATCH();							\
+    } while (0)
+
+/*
+ * Log and count the fetch once the handler knows it will complete the
+ * instruction, otherwise sim_step does
+ */
+#define TRACE() do {							\
+	if (BTRACED)							\
+	    trace_instr(s->btrace, pc, d->valc, TRACE_FIELDS(d));	\
+	if (TRACED == 1 && TRACE_ON(s, TRACE_FETCH))			\
+	    sim_log_fetch(s, d, pc);					\
+	if (TRACED == 1 && s->counts)					\
+	    count_instr(s->counts, d, pc);				\
+	if (TRACED == 1 && s->cache)					\
+	    cache_fetch(s->cache, pc);					\
+	if (PROFILED)							\
+	    profile_instr(s->prof, pc);					\
+    } while (0)
+
+/* Log where the branch or jump at pc went */
+#define TRACE_JUMP(taken, target) do {					\
+	if (TRACED == 1 && TRACE_ON(s, TRACE_BRANCH))			\
+	    sim_log_branch(s, pc, taken, target);			\
+    } while (0)
+
+/* Follow a call or return of the jal or jalr at pc */
+#define PROFILE_JUMP(target) do {					\
+	if (PROFILED)							\
+	    profile_jump(s->prof, d, pc, target);			\
+    } while (0)
+
+/* Log and count a store, and pass it through the caches */
+#define TRACE_STORE(addr, val) do {					\
+	if (BTRACED)							\
+	    trace_mem(s->btrace, addr, val);				\
+	if (TRACED == 1 && TRACE_ON(s, TRACE_MEMWRITE))			\
+	    sim_log(s, "Wrote 0x%x to address 0x%x\n", val, addr);	\
+	if (TRACED == 1 && s->counts)					\
+	    count_data(s->counts, addr, TRUE);				\
+	if (TRACED == 1 && s->cache)					\
+	    cache_data(s->cache, addr, TRUE);				\
+    } while (0)
+
+/* Count a load, and pass it through the caches */
+#define COUNT_LOAD(addr) do {						\
+	if (TRACED == 1 && s->counts)					\
+	    count_data(s->counts, addr, FALSE);				\
+	if (TRACED == 1 && s->cache)					\
+	    cache_data(s->cache, addr, FALSE);				\
+    } while (0)
+
+/* Count a conditional branch */
+#define COUNT_BRANCH(taken) do {					\
+	if (TRACED == 1 && s->counts)					\
+	    count_branch(s->counts, taken);				\
+    } while (0)
+
+/* Show the branch predictors where the branch or jump went */
+#define PREDICT(taken, target) do {					\
+	if (TRACED == 1 && s->bpred)					\
+	    bpred_update(s->bpred, d, pc, taken, target);		\
+    } while (0)
+
+/* Conditional branch */
+#define BRANCH(c) do {							\
+	TRACE();							\
+	if (c) {							\
+	    TRACE_JUMP(TRUE, pc + d->valc);				\
+	    COUNT_BRANCH(TRUE);						\
+	    PREDICT(TRUE, pc + d->valc);				\
+	    pc += d->valc;						\
+	} else {							\
+	    TRACE_JUMP(FALSE, pc + 4);					\
+	    COUNT_BRANCH(FALSE);					\
+	    PREDICT(FALSE, pc + 4);					\
+	    pc += 4;							\
+	}								\
+	NEXT();								\
+    } while (0)
+
+/* Register-immediate and register-register ALU operations */
+#define ALU(val) do { TRACE(); e = (val); WB(e); pc += 4; NEXT(); } while (0)
+
+/*
+ * The loop is built four times: run_traced logs whatever trace
+ * categories are selected and keeps the counts and the profile,
+ * run_btraced only writes the binary trace, run_profiled only profiles
+ * and run_plain has no trace code at all.
+ */
+#define TRACED 1
+#define RUN_NAME run_traced
+#include "ssim-threaded-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+#define TRACED 2
+#define RUN_NAME run_btraced
+#include "ssim-threaded-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+#define TRACED 3
+#define RUN_NAME run_profiled
+#include "ssim-threaded-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+#define TRACED 0
+#define RUN_NAME run_plain
+#include "ssim-threaded-run.h"
+#undef TRACED
+#undef RUN_NAME
+
+word_t sim_run_threaded(sim_t s, word_t max_instr, byte_t *statusp)
+{
+    if (TRACE_ON(s, TRACE_ALL) || s->counts || s->bpred || s->cache ||
+	(s->prof && s->btrace))
+	return run_traced(s, max_instr, statusp);
+    if (s->btrace)
+	return run_btraced(s, max_instr, statusp);
+    if (s->prof)
+	return run_profiled(s, max_instr, statusp);
+    return run_plain(s, max_instr, statusp);
+}
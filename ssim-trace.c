@@ -0,0 +1,62 @@
+/***********************************************************************
+ *
+ * ssim-trace.c - Writing binary execution traces
+ *
+ * The events of each instruction are added to a chunk in memory by
+ * the inline routines in sstrace.h, so tracing costs a few stores per
+ * instruction.  Full chunks go out with one write each.
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "isa.h"
+#include "sstrace.h"
+
+trace_writer_ptr trace_open(FILE *file, mem_t r, word_t pc)
+{
+    trace_writer_ptr t = (trace_writer_ptr) calloc(1, sizeof(trace_writer_rec));
+    int i;
+    t->file = file;
+    t->buf = (byte_t *) malloc(TRACE_CHUNK + TRACE_SLACK);
+    t->pos = t->buf;
+    t->limit = t->buf + TRACE_CHUNK;
+    memcpy(t->hdr.magic, TRACE_MAGIC, 4);
+    t->hdr.pc = pc;
+    for (i = 0; i < 32; i++)
+	t->hdr.regs[i] = get_reg_val(r, i);
+    trace_state_reset(&t->st, &t->hdr);
+    return t;
+}
+
+void trace_flush(trace_writer_ptr t)
+{
+    int i;
+    t->hdr.size = t->pos - t->buf;
+    if (t->hdr.size > 0 &&
+	(fwrite(&t->hdr, sizeof(t->hdr), 1, t->file) != 1 ||
+	 fwrite(t->buf, t->hdr.size, 1, t->file) != 1))
+	t->error = TRUE;
+
+    /* The next chunk starts from where this one left off */
+    t->hdr.first += t->hdr.ninstr;
+    t->hdr.ninstr = 0;
+    t->hdr.pc = t->st.pc;
+    t->hdr.addr = t->st.addr;
+    for (i = 0; i < 32; i++)
+	t->hdr.regs[i] = t->st.regs[i];
+    trace_state_reset(&t->st, &t->hdr);
+    t->pos = t->buf;
+    t->iend = NULL;
+}
+
+bool_t trace_close(trace_writer_ptr t)
+{
+    bool_t ok;
+    trace_flush(t);
+    ok = !t->error && fflush(t->file) == 0;
+    free(t->buf);
+    free(t);
+    return ok;
+}
@@ -0,0 +1,331 @@
+/***********************************************************************
+ *
+ * sstrace.c - Decode binary traces written by ssim -B
+ *
+ * Prints a binary trace (see sstrace.h) as the same text ssim prints
+ * at -v 2, or as CSV with one line per instruction.  Chunks are
+ * decoded on a pool of threads and printed in order.  Build with
+ *
+ *     gcc -O2 -o sstrace sstrace.c isa.c -lpthread
+ *
+ ***********************************************************************/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "isa.h"
+#include "libssim.h"
+#include "sstrace.h"
+
+/* Trace categories selectable with -T.  Branches aren't recorded */
+static struct {
+    char *name;
+    int mask;
+} trace_table[] =
+{
+    {"fetch",    TRACE_FETCH},
+    {"regwrite", TRACE_REGWRITE},
+    {"memwrite", TRACE_MEMWRITE},
+    {"all",      TRACE_FETCH | TRACE_REGWRITE | TRACE_MEMWRITE},
+    {NULL,       0}
+};
+
+static int trace_mask = TRACE_DEFAULT;
+static bool_t csv = FALSE;
+
+/* One chunk of the trace, and what it decodes to */
+typedef struct {
+    trace_chunk_hdr hdr;
+    const byte_t *events;
+    char *out;
+    size_t len;
+    bool_t bad;
+} chunk_rec, *chunk_ptr;
+
+/* The instruction a CSV line is being built for */
+typedef struct {
+    unsigned long long n;
+    word_t pc;
+    word_t valc;
+    byte_t fields[TRACE_NFIELDS];
+    char *name;
+    reg_id_t reg;
+    word_t val;
+    bool_t stored;
+    word_t addr;
+    word_t data;
+} csv_line;
+
+static void print_csv(FILE *out, csv_line *l)
+{
+    fprintf(out, "%llu,0x%x,%s,%s,%s,%s,0x%x,", l->n, l->pc, l->name,
+	    reg_name(l->fields[3]), reg_name(l->fields[4]),
+	    reg_name(l->fields[5]), l->valc);
+    if (l->reg != REG_NONE)
+	fprintf(out, "%s,0x%x,", reg_name(l->reg), l->val);
+    else
+	fprintf(out, ",,");
+    if (l->stored)
+	fprintf(out, "0x%x,0x%x\n", l->addr, l->data);
+    else
+	fprintf(out, ",\n");
+}
+
+/* Decode chunk c into c->out */
+static void decode_chunk(chunk_ptr c)
+{
+    trace_state_rec st;
+    char *dname[TRACE_DCACHE];
+    const byte_t *p = c->events;
+    const byte_t *end = p + c->hdr.size;
+    unsigned long long n = c->hdr.first;
+    bool_t have = FALSE;
+    csv_line l;
+    FILE *out = open_memstream(&c->out, &c->len);
+
+    trace_state_reset(&st, &c->hdr);
+    while (p < end) {
+	byte_t tag = *p++;
+	word_t pc, addr, val;
+	trace_dentry *e;
+	reg_id_t id;
+	int i;
+
+	switch (tag & TR_KIND) {
+	case TR_INSTR:
+	    pc = st.pc;
+	    if (tag & TR_JUMPED)
+		pc = (uword_t) pc + trace_unzigzag(trace_get_varint(&p, end));
+	    i = TRACE_DINDEX(pc);
+	    e = &st.dcache[i];
+	    if (tag & TR_DECODE) {
+		if (end - p < 4 + TRACE_NFIELDS) {
+		    c->bad = TRUE;
+		    break;
+		}
+		e->pc = pc;
+		e->valc = p[0] | p[1] << 8 | p[2] << 16 | (uword_t) p[3] << 24;
+		memcpy(e->fields, p + 4, TRACE_NFIELDS);
+		dname[i] = iname(e->fields[0], e->fields[1], e->fields[2]);
+		p += 4 + TRACE_NFIELDS;
+	    } else if (e->pc != pc) {
+		c->bad = TRUE;
+		break;
+	    }
+	    st.pc = pc + 4;
+	    if (csv) {
+		if (have)
+		    print_csv(out, &l);
+		have = TRUE;
+		l.n = n;
+		l.pc = pc;
+		l.valc = e->valc;
+		memcpy(l.fields, e->fields, TRACE_NFIELDS);
+		l.name = dname[i];
+		l.reg = REG_NONE;
+		l.stored = FALSE;
+	    } else if (trace_mask & TRACE_FETCH)
+		fprintf(out, "IF: Fetched %s at 0x%x.  rs1=%s, rs2=%s, rd=%s, "
+			"Imm = 0x%x\n", dname[i], pc, reg_name(e->fields[3]),
+			reg_name(e->fields[4]), reg_name(e->fields[5]), e->valc);
+	    n++;
+	    if (!(tag & TR_WROTE))
+		break;
+	    id = e->fields[TRACE_NFIELDS-1];
+	    if (id >= 32) {
+		c->bad = TRUE;
+		break;
+	    }
+	    goto wrote;
+
+	case TR_REG:
+	    id = (tag >> 2) & 0x1f;
+	wrote:
+	    val = (uword_t) st.regs[id] +
+		trace_unzigzag(trace_get_varint(&p, end));
+	    st.regs[id] = val;
+	    if (csv) {
+		l.reg = id;
+		l.val = val;
+	    } else if (trace_mask & TRACE_REGWRITE)
+		fprintf(out, "WB: %s = 0x%x\n", reg_name(id), val);
+	    break;
+
+	case TR_MEM:
+	    addr = (uword_t) st.addr + trace_unzigzag(trace_get_varint(&p, end));
+	    val = trace_get_varint(&p, end);
+	    st.addr = addr;
+	    if (csv) {
+		l.stored = TRUE;
+		l.addr = addr;
+		l.data = val;
+	    } else if (trace_mask & TRACE_MEMWRITE)
+		fprintf(out, "Wrote 0x%x to address 0x%x\n", val, addr);
+	    break;
+
+	default:
+	    c->bad = TRUE;
+	}
+	if (c->bad)
+	    break;
+    }
+    if (csv && have)
+	print_csv(out, &l);
+    fclose(out);
+}
+
+static void *decode_thread(void *arg)
+{
+    decode_chunk((chunk_ptr) arg);
+    return NULL;
+}
+
+/*
+ * parse_trace - turn a comma-separated list of trace category names
+ * into a mask.  Return -1 if any of them is unknown.
+ */
+static int parse_trace(char *list)
+{
+    int mask = 0;
+    char *p = list;
+    while (*p) {
+	int len = strcspn(p, ",");
+	int i;
+	for (i = 0; trace_table[i].name; i++)
+	    if ((int) strlen(trace_table[i].name) == len &&
+		!strncmp(p, trace_table[i].name, len))
+		break;
+	if (!trace_table[i].name)
+	    return -1;
+	mask |= trace_table[i].mask;
+	p += len;
+	if (*p == ',')
+	    p++;
+    }
+    return mask;
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-c] [-j n] [-T cats] trace\n", name);
+    printf("   -c     Print CSV, one line per instruction\n");
+    printf("   -j n   Decode on n threads (default one per core)\n");
+    printf("   -T c   Print categories c, comma-separated from fetch, regwrite,\n"
+	   "          memwrite, all (default fetch,memwrite)\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    int njobs = 0;
+    chunk_ptr chunks = NULL;
+    int nchunks = 0, maxchunks = 0;
+    struct stat sb;
+    byte_t *map;
+    size_t off;
+    int fd, c, i, base;
+
+    while ((c = getopt(argc, argv, "hcj:T:")) != -1) {
+	switch (c) {
+	case 'c':
+	    csv = TRUE;
+	    break;
+	case 'j':
+	    njobs = atoi(optarg);
+	    break;
+	case 'T':
+	    trace_mask = parse_trace(optarg);
+	    if (trace_mask < 0) {
+		printf("Invalid trace categories %s\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	default:
+	    usage(argv[0]);
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+    if (njobs <= 0)
+	njobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs <= 0)
+	njobs = 1;
+
+    if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &sb) < 0) {
+	fprintf(stderr, "Couldn't open trace %s\n", argv[optind]);
+	exit(1);
+    }
+    map = sb.st_size ? (byte_t *) mmap(NULL, sb.st_size, PROT_READ,
+				       MAP_PRIVATE, fd, 0) : NULL;
+    if (map == MAP_FAILED) {
+	fprintf(stderr, "Couldn't map trace %s\n", argv[optind]);
+	exit(1);
+    }
+
+    /* Find the chunks */
+    for (off = 0; off < (size_t) sb.st_size; ) {
+	chunk_ptr ch;
+	if (nchunks == maxchunks) {
+	    maxchunks = maxchunks ? 2*maxchunks : 256;
+	    chunks = (chunk_ptr) realloc(chunks, maxchunks * sizeof(chunk_rec));
+	}
+	ch = &chunks[nchunks];
+	if ((size_t) sb.st_size - off < sizeof(trace_chunk_hdr)) {
+	    fprintf(stderr, "Trace %s cut short\n", argv[optind]);
+	    exit(1);
+	}
+	memcpy(&ch->hdr, map + off, sizeof(trace_chunk_hdr));
+	off += sizeof(trace_chunk_hdr);
+	if (memcmp(ch->hdr.magic, TRACE_MAGIC, 4) ||
+	    (size_t) sb.st_size - off < ch->hdr.size) {
+	    fprintf(stderr, "Bad chunk in trace %s at offset %lu\n",
+		    argv[optind], (unsigned long) (off - sizeof(trace_chunk_hdr)));
+	    exit(1);
+	}
+	ch->events = map + off;
+	ch->out = NULL;
+	ch->bad = FALSE;
+	off += ch->hdr.size;
+	nchunks++;
+    }
+
+    if (csv)
+	printf("n,pc,instr,rs1,rs2,rd,imm,reg,value,addr,data\n");
+
+    /* Decode njobs chunks at a time, then print them in order */
+    for (base = 0; base < nchunks; base += njobs) {
+	pthread_t tid[njobs];
+	bool_t started[njobs];
+	int cnt = nchunks - base < njobs ? nchunks - base : njobs;
+	for (i = 1; i < cnt; i++)
+	    started[i] = !pthread_create(&tid[i], NULL, decode_thread,
+					 &chunks[base+i]);
+	decode_chunk(&chunks[base]);
+	for (i = 1; i < cnt; i++)
+	    if (started[i])
+		pthread_join(tid[i], NULL);
+	    else
+		decode_chunk(&chunks[base+i]);
+	for (i = 0; i < cnt; i++) {
+	    chunk_ptr ch = &chunks[base+i];
+	    fwrite(ch->out, 1, ch->len, stdout);
+	    free(ch->out);
+	    if (ch->bad) {
+		fprintf(stderr, "Bad event in trace %s after instruction %llu\n",
+			argv[optind], ch->hdr.first);
+		exit(1);
+	    }
+	}
+    }
+    free(chunks);
+    if (map)
+	munmap(map, sb.st_size);
+    close(fd);
+    return 0;
+}
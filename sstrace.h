@@ -0,0 +1,223 @@
+/***********************************************************************
+ *
+ * sstrace.h - Binary execution trace format
+ *
+ * A binary trace is a commit log of every instruction run: where it
+ * was fetched from, its decoded form and the registers and memory it
+ * wrote.  The simulator writes one with sim_set_trace_file and sstrace
+ * turns it back into text or CSV.
+ *
+ * The file is a run of chunks, each a trace_chunk_hdr followed by size
+ * bytes of events.  The header holds all the state the events are
+ * encoded against, so every chunk can be decoded on its own, in any
+ * order.  Each event starts with a tag byte:
+ *
+ *   TR_INSTR   an instruction.  With TR_JUMPED, the zigzag varint
+ *              difference of its pc from 4 past the last one follows.
+ *              With TR_DECODE, its decoded form follows: valc in 4
+ *              little-endian bytes, then icode, ifun1, ifun2, rs1, rs2
+ *              and rd a byte each.  The decoded form is left out when it's
+ *              the same as last time at the same pc, going by a direct
+ *              mapped cache of TRACE_DCACHE entries emptied at the
+ *              start of each chunk.  With TR_WROTE, the instruction's
+ *              first write was to rd and follows as in TR_REG, so most
+ *              instructions need no register tag.
+ *   TR_REG     register tag >> 2 was written.  The zigzag varint
+ *              difference from the last value written to it follows.
+ *   TR_MEM     a store.  The zigzag varint difference of the address
+ *              from the last one stored to follows, then the value as
+ *              a varint.
+ *
+ * Writes come after the instruction that made them.  Headers are in
+ * the byte order of the machine that wrote the trace.
+ *
+ * Include string.h and isa.h before this file.
+ *
+ ***********************************************************************/
+
+#define TRACE_MAGIC "sstc"
+#define TRACE_CHUNK (1<<20)	/* Bytes of events in a full chunk */
+#define TRACE_SLACK 64		/* Most bytes one instruction adds */
+#define TRACE_DCACHE 1024	/* Entries in the decoded form cache */
+#define TRACE_NFIELDS 6		/* Bytes of fields in a decoded form */
+
+/* Event tags */
+#define TR_INSTR  0
+#define TR_REG    1
+#define TR_MEM    2
+#define TR_KIND   3		/* Mask for the above */
+#define TR_JUMPED 4
+#define TR_DECODE 8
+#define TR_WROTE  16
+
+typedef struct {
+    char magic[4];		/* TRACE_MAGIC */
+    unsigned size;		/* Bytes of events after the header */
+    unsigned long long first;	/* Instructions traced before this chunk */
+    unsigned ninstr;		/* Instructions in this chunk */
+    word_t pc;			/* Where the first one is expected */
+    word_t addr;		/* Last address stored to */
+    word_t regs[32];		/* Last values written to the registers */
+} trace_chunk_hdr;
+
+/* A decoded form, as cached by pc */
+typedef struct {
+    word_t pc;
+    word_t valc;
+    byte_t fields[TRACE_NFIELDS];	/* icode, ifun1, ifun2, rs1, rs2, rd */
+} trace_dentry;
+
+/* What events are encoded against, kept by writer and reader alike */
+typedef struct {
+    word_t pc;
+    word_t addr;
+    word_t regs[32];
+    trace_dentry dcache[TRACE_DCACHE];
+} trace_state_rec, *trace_state_ptr;
+
+#define TRACE_DINDEX(pc) (((uword_t) (pc) >> 2) & (TRACE_DCACHE-1))
+
+/* Start decoding or encoding the chunk with header h */
+static inline void trace_state_reset(trace_state_ptr st,
+				     const trace_chunk_hdr *h)
+{
+    int i;
+    st->pc = h->pc;
+    st->addr = h->addr;
+    for (i = 0; i < 32; i++)
+	st->regs[i] = h->regs[i];
+    /* A pc of ~(i<<2) would be cached in another entry, so none match */
+    for (i = 0; i < TRACE_DCACHE; i++)
+	st->dcache[i].pc = ~(i << 2);
+}
+
+/*
+ * The fields of decode_ptr d, which sit in consecutive bytes in the
+ * same order as in the trace
+ */
+#define TRACE_FIELDS(d) (&(d)->icode)
+
+/* Signed differences are stored zigzag, so small ones are short */
+static inline uword_t trace_zigzag(uword_t v)
+{
+    return (v << 1) ^ (uword_t) ((word_t) v >> 31);
+}
+
+static inline uword_t trace_unzigzag(uword_t u)
+{
+    return (u >> 1) ^ -(u & 1);
+}
+
+static inline byte_t *trace_put_varint(byte_t *p, uword_t v)
+{
+    while (v >= 0x80) {
+	*p++ = (byte_t) (v | 0x80);
+	v >>= 7;
+    }
+    *p++ = (byte_t) v;
+    return p;
+}
+
+/* Read a varint at *pp, not going past end */
+static inline uword_t trace_get_varint(const byte_t **pp, const byte_t *end)
+{
+    const byte_t *p = *pp;
+    uword_t v = 0;
+    int shift = 0;
+    while (p < end && (*p & 0x80) && shift < 28) {
+	v |= (uword_t) (*p++ & 0x7f) << shift;
+	shift += 7;
+    }
+    if (p < end)
+	v |= (uword_t) *p++ << shift;
+    *pp = p;
+    return v;
+}
+
+
+/************ Writing ****************/
+
+/* A binary trace being written */
+typedef struct trace_writer_rec {
+    FILE *file;
+    byte_t *buf;		/* Events of the chunk being built */
+    byte_t *pos;
+    byte_t *limit;		/* The chunk is full once past this */
+    byte_t *itag;		/* Tag of the last instruction */
+    byte_t *iend;		/* and where its event ended */
+    reg_id_t ird;		/* and its rd */
+    trace_chunk_hdr hdr;	/* Header of the chunk being built */
+    trace_state_rec st;
+    bool_t error;		/* A chunk couldn't be written */
+} trace_writer_rec, *trace_writer_ptr;
+
+/* Start writing a trace to file, with registers r and next pc pc */
+trace_writer_ptr trace_open(FILE *file, mem_t r, word_t pc);
+
+/* Write out the chunk being built and start the next one */
+void trace_flush(trace_writer_ptr t);
+
+/* Write out what's left and free t.  Return FALSE if anything failed */
+bool_t trace_close(trace_writer_ptr t);
+
+/* Add the instruction at pc, decoded into valc and fields */
+static inline void trace_instr(trace_writer_ptr t, word_t pc, word_t valc,
+			       const byte_t *fields)
+{
+    trace_state_ptr st = &t->st;
+    trace_dentry *e = &st->dcache[TRACE_DINDEX(pc)];
+    byte_t tag = TR_INSTR;
+    byte_t *p;
+
+    if (t->pos > t->limit)
+	trace_flush(t);
+    /* Fill in the tag last, once we know what follows it */
+    p = t->pos + 1;
+    if (pc != st->pc) {
+	tag |= TR_JUMPED;
+	p = trace_put_varint(p, trace_zigzag((uword_t) pc - st->pc));
+    }
+    if (e->pc != pc || e->valc != valc ||
+	memcmp(e->fields, fields, TRACE_NFIELDS)) {
+	tag |= TR_DECODE;
+	p[0] = valc;
+	p[1] = valc >> 8;
+	p[2] = valc >> 16;
+	p[3] = valc >> 24;
+	memcpy(p + 4, fields, TRACE_NFIELDS);
+	p += 4 + TRACE_NFIELDS;
+	e->pc = pc;
+	e->valc = valc;
+	memcpy(e->fields, fields, TRACE_NFIELDS);
+    }
+    *t->pos = tag;
+    t->itag = t->pos;
+    t->iend = p;
+    t->ird = fields[TRACE_NFIELDS-1];
+    st->pc = pc + 4;
+    t->hdr.ninstr++;
+    t->pos = p;
+}
+
+/* Add the write of val to register id */
+static inline void trace_reg(trace_writer_ptr t, reg_id_t id, word_t val)
+{
+    byte_t *p = t->pos;
+    if (p == t->iend && id == t->ird)
+	*t->itag |= TR_WROTE;
+    else
+	*p++ = TR_REG | id << 2;
+    t->pos = trace_put_varint(p, trace_zigzag((uword_t) val -
+					      t->st.regs[id]));
+    t->st.regs[id] = val;
+}
+
+/* Add the store of val to addr */
+static inline void trace_mem(trace_writer_ptr t, word_t addr, word_t val)
+{
+    byte_t *p = t->pos;
+    *p++ = TR_MEM;
+    p = trace_put_varint(p, trace_zigzag((uword_t) addr - t->st.addr));
+    t->pos = trace_put_varint(p, val);
+    t->st.addr = addr;
+}
@@ -0,0 +1,86 @@
+/***********************************************************************
+ *
+ * yobench.c - Measure how fast .yo files are loaded
+ *
+ * Writes a generated .yo file of the given size to a temporary file
+ * and times load_mem on it, once with one instruction per line, the
+ * way the assembler lays programs out, and once with long lines of
+ * data.  Build with
+ *
+ *     gcc -O2 -o yobench yobench.c isa.c
+ *
+ ***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "isa.h"
+
+/* Write about mb megabytes of .yo text, with bpl bytes of code per line */
+static FILE *make_yo(int mb, int bpl)
+{
+    FILE *f = tmpfile();
+    long long size = 0;
+    uword_t addr = 0;
+    unsigned x = 12345;
+    int i, n;
+
+    if (!f) {
+	perror("tmpfile");
+	exit(1);
+    }
+    while (size < (long long) mb << 20) {
+	n = fprintf(f, "0x%.8x: ", addr);
+	for (i = 0; i < bpl; i++) {
+	    x = x * 1103515245 + 12345;
+	    n += fprintf(f, "%.2x", (x >> 16) & 0xff);
+	}
+	n += fprintf(f, bpl <= 4 ? "  |   addi t0,zero,5\n" : "\n");
+	if ((addr & 0x3f) == 0)
+	    n += fprintf(f, "                      | # section\n");
+	addr += bpl;
+	size += n;
+    }
+    rewind(f);
+    return f;
+}
+
+/* Load f into a fresh memory reps times and return MB/s */
+static double run(FILE *f, int reps)
+{
+    struct timeval t0, t1;
+    long long bytes;
+    double secs;
+    int i;
+
+    fseek(f, 0, SEEK_END);
+    bytes = ftell(f);
+    gettimeofday(&t0, NULL);
+    for (i = 0; i < reps; i++) {
+	mem_t m = init_mem(1LL << 32);
+	rewind(f);
+	if (load_mem(m, f, 1, NULL) == 0) {
+	    fprintf(stderr, "load_mem failed\n");
+	    exit(1);
+	}
+	free_mem(m);
+    }
+    gettimeofday(&t1, NULL);
+    secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+    return (double) bytes * reps / secs / (1 << 20);
+}
+
+int main(int argc, char *argv[])
+{
+    int mb = argc > 1 ? atoi(argv[1]) : 32;
+    int reps = argc > 2 ? atoi(argv[2]) : 5;
+    FILE *f;
+
+    f = make_yo(mb, 4);
+    printf("%d MB, one instruction per line: %.1f MB/s\n", mb, run(f, reps));
+    fclose(f);
+    f = make_yo(mb, 64);
+    printf("%d MB, 64 bytes per line:        %.1f MB/s\n", mb, run(f, reps));
+    fclose(f);
+    return 0;
+}